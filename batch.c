@@ -0,0 +1,445 @@
+#include "batch.h"
+#include "editor.h"
+#include "error_handler.h"
+#include "file.h"
+#include "parallel.h"
+#include "search.h"
+#include "ui.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Every file is a parallel_run task. The task makes a private EditorConfig
+// the current buffer of its thread (get_editor_config() is per thread), so
+// the editing functions run unchanged and no two files share any state.
+// Nothing is journaled and no undo history is kept.
+
+typedef enum {
+    BATCH_GOTO,
+    BATCH_FIND,
+    BATCH_REPLACE,
+    BATCH_INSERT,
+    BATCH_DELETE,
+} BatchOp;
+
+typedef struct {
+    BatchOp op;
+    char *arg;          // target, query or text
+    char *replacement;  // replace only
+    long long count;    // delete only
+    int line;           // in the script
+} BatchCommand;
+
+typedef enum {
+    BATCH_UNCHANGED,
+    BATCH_SAVED,
+    BATCH_SKIPPED,
+    BATCH_FAILED,
+} BatchOutcome;
+
+typedef struct {
+    BatchOutcome outcome;
+    char message[256];
+} BatchResult;
+
+typedef struct {
+    BatchCommand *commands;
+    int command_count;
+    char **filenames;
+    BatchResult *results;
+} BatchJob;
+
+// Splits off the next word of a script line: a run of non-blank characters,
+// or a double-quoted string. In a string \" \\ \n and \t are escapes and any
+// other backslash is kept, so regex escapes need no doubling. Returns NULL
+// at the end of the line or a # comment, or with *error set.
+static char *batch_next_word(char **cursor, const char **error) {
+    char *p = *cursor;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0' || *p == '#') {
+        *cursor = p;
+        return NULL;
+    }
+
+    char *word = p;
+    if (*p != '"') {
+        while (*p && *p != ' ' && *p != '\t') p++;
+        if (*p) *p++ = '\0';
+        *cursor = p;
+        return word;
+    }
+
+    // Unescaping never makes the string longer, so it is done in place.
+    char *out = word = ++p;
+    while (*p != '"') {
+        if (*p == '\0') {
+            *error = "unterminated string";
+            return NULL;
+        }
+        if (*p == '\\' && (p[1] == '"' || p[1] == '\\' || p[1] == 'n' || p[1] == 't')) {
+            *out++ = p[1] == 'n' ? '\n' : p[1] == 't' ? '\t' : p[1];
+            p += 2;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+    *cursor = p + 1;
+    return word;
+}
+
+static char *batch_strdup(const char *s) {
+    char *copy = strdup(s);
+    if (copy == NULL) editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (batch script).");
+    return copy;
+}
+
+// Parses one line of the script. Returns 1 for a command, 0 for a blank or
+// comment line and -1 with *error set for anything else.
+static int batch_parse_line(char *text, BatchCommand *command, const char **error) {
+    char *cursor = text;
+    char *name = batch_next_word(&cursor, error);
+    if (name == NULL) return *error ? -1 : 0;
+
+    char *args[3];
+    int arg_count = 0;
+    char *word;
+    while (arg_count < 3 && (word = batch_next_word(&cursor, error)) != NULL) args[arg_count++] = word;
+    if (*error) return -1;
+
+    static const struct {
+        const char *name;
+        BatchOp op;
+        int min_args, max_args;
+    } ops[] = {
+        { "goto", BATCH_GOTO, 1, 1 },
+        { "find", BATCH_FIND, 1, 1 },
+        { "replace", BATCH_REPLACE, 2, 2 },
+        { "insert", BATCH_INSERT, 1, 1 },
+        { "delete", BATCH_DELETE, 0, 1 },
+    };
+    int i = 0;
+    int op_count = sizeof(ops) / sizeof(ops[0]);
+    while (i < op_count && strcmp(ops[i].name, name) != 0) i++;
+    if (i == op_count) {
+        *error = "unknown command";
+        return -1;
+    }
+    if (arg_count < ops[i].min_args || arg_count > ops[i].max_args) {
+        *error = arg_count < ops[i].min_args ? "missing argument" : "too many arguments";
+        return -1;
+    }
+
+    command->op = ops[i].op;
+    command->count = 1;
+    if (command->op == BATCH_DELETE && arg_count == 1) {
+        char *end;
+        errno = 0;
+        command->count = strtoll(args[0], &end, 10);
+        if (errno || end == args[0] || *end != '\0' || command->count < 1) {
+            *error = "delete takes a positive count";
+            return -1;
+        }
+        return 1;
+    }
+    if (arg_count > 0) command->arg = batch_strdup(args[0]);
+    if (arg_count > 1) command->replacement = batch_strdup(args[1]);
+
+    if (command->op == BATCH_FIND || command->op == BATCH_REPLACE) {
+        SearchPattern *pattern = editor_compile_query(command->arg, error);
+        if (pattern == NULL) {
+            if (*error == NULL) *error = "empty query";
+            return -1;
+        }
+        search_free(pattern);
+    } else if (command->op == BATCH_GOTO && editor_goto_target(command->arg) == -1) {
+        // The scratch buffer is empty, so only the target's form is checked.
+        *error = editor_message_bar_text();
+        return -1;
+    }
+    return 1;
+}
+
+static void batch_free_script(BatchCommand *commands, int count) {
+    for (int i = 0; i < count; i++) {
+        free(commands[i].arg);
+        free(commands[i].replacement);
+    }
+    free(commands);
+}
+
+// Reads and checks the whole script before any file is touched. Returns the
+// number of commands, or -1 after reporting the problem.
+static int batch_load_script(const char *path, BatchCommand **commands_out) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    EditorConfig scratch;
+    init_editor_config(&scratch);
+    editor_set_config(&scratch);
+
+    BatchCommand *commands = NULL;
+    int count = 0, capacity = 0;
+    char *text = NULL;
+    size_t text_capacity = 0;
+    ssize_t len;
+    int line = 0;
+    int failed = 0;
+    while (!failed && (len = getline(&text, &text_capacity, fp)) != -1) {
+        line++;
+        while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r')) text[--len] = '\0';
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            BatchCommand *grown = realloc(commands, capacity * sizeof(BatchCommand));
+            if (grown == NULL) {
+                editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (batch script).");
+                break;
+            }
+            commands = grown;
+        }
+        BatchCommand *command = &commands[count];
+        memset(command, 0, sizeof(*command));
+        command->line = line;
+        const char *error = NULL;
+        int parsed = batch_parse_line(text, command, &error);
+        if (parsed == 1) {
+            count++;
+        } else if (parsed == -1) {
+            fprintf(stderr, "%s:%d: %s\n", path, line, error);
+            batch_free_script(commands, count + 1);
+            commands = NULL;
+            failed = 1;
+        }
+    }
+    if (!failed && ferror(fp)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        batch_free_script(commands, count);
+        failed = 1;
+    }
+    free(text);
+    fclose(fp);
+    editor_set_config(NULL);
+    free_editor_config(&scratch);
+
+    if (failed) return -1;
+    *commands_out = commands;
+    return count;
+}
+
+// Deletes the character after the cursor, joining the next line on at the
+// end of a line, the way Right followed by Backspace would.
+static int batch_delete_forward(EditorConfig *E) {
+    if (E->cy >= E->lines.size) return 0;
+    if (E->cx < (long long)E->lines.elements[E->cy].len) {
+        E->cx++;
+    } else if (E->cy + 1 < E->lines.size) {
+        E->cy++;
+        E->cx = 0;
+    } else {
+        return 0;
+    }
+    editor_del_char();
+    return 1;
+}
+
+// Runs one command on the current buffer. Returns 0 to go on, or -1 after
+// filling in why the file is left alone.
+static int batch_apply(const BatchCommand *command, BatchResult *result) {
+    EditorConfig *E = get_editor_config();
+    switch (command->op) {
+        case BATCH_GOTO:
+            editor_goto_target(command->arg);
+            break;
+        case BATCH_FIND: {
+            if (E->search_query == NULL || strcmp(E->search_query, command->arg) != 0) {
+                const char *error = NULL;
+                free(E->search_query);
+                search_free(E->search_pattern);
+                E->search_query = batch_strdup(command->arg);
+                E->search_pattern = editor_compile_query(command->arg, &error);
+                E->last_match_row = -1;
+                E->last_match_col = -1;
+            }
+            // A repeated find moves on from the match it stopped at; after
+            // any other move it starts from the cursor.
+            if (E->cy != E->last_match_row || E->cx != E->last_match_col) {
+                E->last_match_row = -1;
+                E->last_match_col = -1;
+            }
+            editor_find_next(1);
+            if (E->last_match_row == -1) {
+                result->outcome = BATCH_SKIPPED;
+                snprintf(result->message, sizeof(result->message), "line %d: no match for '%s'", command->line, command->arg);
+                return -1;
+            }
+            break;
+        }
+        case BATCH_REPLACE:
+            editor_replace_range(command->arg, command->replacement, 0, 0, E->lines.size, 0);
+            break;
+        case BATCH_INSERT:
+            for (const char *p = command->arg; *p; p++) {
+                if (*p == '\n') {
+                    editor_insert_newline();
+                } else {
+                    editor_insert_char((unsigned char)*p);
+                }
+            }
+            break;
+        case BATCH_DELETE:
+            for (long long i = 0; i < command->count; i++) {
+                if (!batch_delete_forward(E)) break;
+            }
+            break;
+    }
+    return 0;
+}
+
+static void batch_edit_file(void *ctx, int task) {
+    BatchJob *job = ctx;
+    const char *filename = job->filenames[task];
+    BatchResult *result = &job->results[task];
+
+    const char *problem = editor_file_unreadable(filename, 0);
+    if (problem) {
+        result->outcome = BATCH_FAILED;
+        snprintf(result->message, sizeof(result->message), "%s", problem);
+        return;
+    }
+
+    // Running out of memory or failing to read fails this file only. What
+    // the config holds by then may be half built, so it is not freed.
+    EditorErrorTrap trap;
+    EditorConfig config;
+    if (setjmp(trap.jump) != 0) {
+        editor_set_config(NULL);
+        result->outcome = BATCH_FAILED;
+        snprintf(result->message, sizeof(result->message), "%s", trap.message);
+        return;
+    }
+    editor_error_trap = &trap;
+    init_editor_config(&config);
+    config.recording_actions = false;
+    config.headless = true;
+    editor_set_config(&config);
+    editor_read_file(filename);
+
+    result->outcome = BATCH_UNCHANGED;
+    for (int i = 0; i < job->command_count; i++) {
+        if (batch_apply(&job->commands[i], result) == -1) break;
+    }
+
+    if (result->outcome == BATCH_UNCHANGED && config.dirty) {
+        EditorSaveStats stats;
+        if (editor_write_file_atomic(&config.lines, config.filename, &config.disk_stat, &stats) == -1) {
+            result->outcome = BATCH_FAILED;
+            snprintf(result->message, sizeof(result->message), "error saving: %s", strerror(errno));
+        } else {
+            result->outcome = BATCH_SAVED;
+        }
+    }
+    editor_error_trap = NULL;
+    editor_set_config(NULL);
+    free_editor_config(&config);
+}
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int index;
+} BatchFileId;
+
+static int batch_file_id_compare(const void *a, const void *b) {
+    const BatchFileId *x = a;
+    const BatchFileId *y = b;
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+    return x->index - y->index;
+}
+
+// Two tasks saving the same file would race, so later names for a file
+// already listed (the same path, or a link to it) are dropped. Returns the
+// number of names left in filenames, in their original order.
+static int batch_unique_files(char **filenames, int count) {
+    BatchFileId *ids = malloc(count * sizeof(BatchFileId));
+    char *duplicate = calloc(count, 1);
+    if (ids == NULL || duplicate == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (batch files).");
+        return 0;
+    }
+    int id_count = 0;
+    for (int i = 0; i < count; i++) {
+        struct stat st;
+        // A file that cannot be looked at is reported by its task.
+        if (stat(filenames[i], &st) == -1) continue;
+        ids[id_count++] = (BatchFileId){ .dev = st.st_dev, .ino = st.st_ino, .index = i };
+    }
+    qsort(ids, id_count, sizeof(BatchFileId), batch_file_id_compare);
+    for (int i = 1; i < id_count; i++) {
+        if (ids[i].dev == ids[i - 1].dev && ids[i].ino == ids[i - 1].ino) duplicate[ids[i].index] = 1;
+    }
+
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (!duplicate[i]) filenames[unique++] = filenames[i];
+    }
+    free(duplicate);
+    free(ids);
+    return unique;
+}
+
+int editor_batch_run(const char *script_path, char **filenames, int count) {
+    BatchCommand *commands = NULL;
+    int command_count = batch_load_script(script_path, &commands);
+    if (command_count == -1) return 2;
+
+    char **unique = malloc(count * sizeof(char *));
+    BatchResult *results = calloc(count, sizeof(BatchResult));
+    if (unique == NULL || results == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (batch files).");
+        return 1;
+    }
+    memcpy(unique, filenames, count * sizeof(char *));
+    int unique_count = batch_unique_files(unique, count);
+
+    BatchJob job = {
+        .commands = commands,
+        .command_count = command_count,
+        .filenames = unique,
+        .results = results,
+    };
+    parallel_run(unique_count, batch_edit_file, &job);
+
+    int totals[BATCH_FAILED + 1] = { 0 };
+    for (int i = 0; i < unique_count; i++) {
+        BatchResult *result = &results[i];
+        totals[result->outcome]++;
+        switch (result->outcome) {
+            case BATCH_SAVED:
+                printf("%s: saved\n", unique[i]);
+                break;
+            case BATCH_UNCHANGED:
+                printf("%s: unchanged\n", unique[i]);
+                break;
+            case BATCH_SKIPPED:
+                printf("%s: skipped, %s\n", unique[i], result->message);
+                break;
+            case BATCH_FAILED:
+                fprintf(stderr, "%s: %s\n", unique[i], result->message);
+                break;
+        }
+    }
+    printf("%d saved, %d unchanged, %d skipped, %d failed\n",
+           totals[BATCH_SAVED], totals[BATCH_UNCHANGED], totals[BATCH_SKIPPED], totals[BATCH_FAILED]);
+
+    free(results);
+    free(unique);
+    batch_free_script(commands, command_count);
+    return totals[BATCH_FAILED] > 0 ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Headless editing: `erwintext --batch script.ed file...` runs a script of
+// editor commands against each file without starting the terminal UI and
+// saves the files it changed. Files are spread over all cores, each loaded,
+// edited and saved by the same code the interactive editor uses.
+//
+// A script has one command per line; # starts a comment. Arguments are
+// single words or double-quoted strings (where \" \\ \n and \t are escapes):
+//
+//   goto TARGET             a line, N% or @byte offset, as Ctrl+G takes
+//   find QUERY              move to the next match, as Ctrl+F does; a file
+//                           with no match is left alone
+//   replace QUERY TEXT      replace every match in the file
+//   insert TEXT             type TEXT at the cursor
+//   delete [N]              delete N characters (default 1) after the cursor
+//
+// Queries are written as in the editor: /pattern/flags for a regex.
+
+// Returns the exit status: 0 if every file was processed, 1 if any could
+// not be, 2 if the script is invalid.
+int editor_batch_run(const char *script_path, char **filenames, int count);
+
+#endif // BATCH_H
@@ -0,0 +1,234 @@
+#include "buffer.h"
+#include "clipboard.h"
+#include "editor.h"
+#include "error_handler.h"
+#include "event_loop.h"
+#include "file.h"
+#include "filesearch.h"
+#include "journal.h"
+#include "swap.h"
+#include "syntax.h"
+#include "ui.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Buffers are kept in the order they were opened. Each EditorConfig is
+// allocated on its own, so pointers to it stay valid until it is closed.
+
+static struct {
+    EditorConfig **items;
+    int count, capacity;
+    int current;
+} B;
+
+EditorConfig *editor_buffer_new() {
+    if (B.count == B.capacity) {
+        int capacity = B.capacity ? B.capacity * 2 : 8;
+        EditorConfig **grown = realloc(B.items, capacity * sizeof(EditorConfig *));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (buffer list).");
+            return NULL;
+        }
+        B.items = grown;
+        B.capacity = capacity;
+    }
+    EditorConfig *config = malloc(sizeof(EditorConfig));
+    if (config == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (buffer).");
+        return NULL;
+    }
+    init_editor_config(config);
+    B.items[B.count++] = config;
+    editor_buffer_switch(B.count - 1);
+    return config;
+}
+
+void editor_buffer_init_empty() {
+    EditorConfig *E = get_editor_config();
+    EditorLine empty_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
+    if (empty_line.text == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (empty line text).");
+    }
+    editor_lines_array_append(&E->lines, empty_line);
+    editor_update_syntax(0);
+}
+
+int editor_buffer_count() {
+    return B.count;
+}
+
+int editor_buffer_index() {
+    return B.current;
+}
+
+void editor_buffer_switch(int index) {
+    if (index < 0 || index >= B.count) return;
+    EditorConfig *from = get_editor_config();
+    EditorConfig *to = B.items[index];
+    if (from != NULL && from != to) {
+        to->screen_rows = from->screen_rows;
+        to->screen_cols = from->screen_cols;
+        // Nothing in the buffer being left will be read for a while, so
+        // under a memory limit it is the one to give memory back.
+        editor_swap_trim(&from->lines);
+    }
+    B.current = index;
+    editor_set_config(to);
+    editor_request_redraw();
+}
+
+static const char *buffer_name(const EditorConfig *config) {
+    return config->filename ? config->filename : "[No Name]";
+}
+
+void editor_buffer_next(int step) {
+    if (B.count < 2) {
+        editor_set_status_message("No other buffers. Ctrl+O opens a file.");
+        return;
+    }
+    editor_buffer_switch(((B.current + step) % B.count + B.count) % B.count);
+    editor_set_status_message("Buffer %d of %d: %s", B.current + 1, B.count, buffer_name(get_editor_config()));
+}
+
+static int buffer_same_file(const char *a, const char *b) {
+    if (strcmp(a, b) == 0) return 1;
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+int editor_buffer_index_of(const EditorConfig *config) {
+    for (int i = 0; i < B.count; i++) {
+        if (B.items[i] == config) return i;
+    }
+    return -1;
+}
+
+int editor_buffer_find(const char *filename) {
+    for (int i = 0; i < B.count; i++) {
+        if (B.items[i]->filename && buffer_same_file(B.items[i]->filename, filename)) return i;
+    }
+    return -1;
+}
+
+int editor_buffer_dirty_count() {
+    int dirty = 0;
+    for (int i = 0; i < B.count; i++) dirty += B.items[i]->dirty != 0;
+    return dirty;
+}
+
+// Stops and frees the current buffer, leaving no buffer current.
+static void buffer_free_current(int discard) {
+    EditorConfig *E = get_editor_config();
+    editor_file_search_buffer_closed(E);
+    editor_clipboard_buffer_closed(E);
+    journal_stop(discard);
+    free_editor_config(E);
+    free(E);
+    memmove(&B.items[B.current], &B.items[B.current + 1], (B.count - B.current - 1) * sizeof(EditorConfig *));
+    B.count--;
+    editor_set_config(NULL);
+}
+
+void editor_buffer_close() {
+    EditorConfig *E = get_editor_config();
+    if (E->dirty) {
+        editor_set_status_message("WARNING! Buffer has unsaved changes. Press Ctrl+W again to close it anyway.");
+        editor_refresh_screen();
+        if (editor_read_key() != CTRL('w')) {
+            editor_set_status_message("");
+            return;
+        }
+    }
+
+    int rows = E->screen_rows;
+    int cols = E->screen_cols;
+    int index = B.current;
+    buffer_free_current(1);
+    if (B.count == 0) {
+        editor_buffer_new();
+        editor_buffer_init_empty();
+    } else {
+        editor_buffer_switch(index < B.count ? index : B.count - 1);
+    }
+    E = get_editor_config();
+    E->screen_rows = rows;
+    E->screen_cols = cols;
+    editor_set_status_message("Buffer %d of %d: %s", B.current + 1, B.count, buffer_name(E));
+}
+
+void editor_buffer_open() {
+    char *filename = editor_prompt("Open file: %s (ESC to cancel)");
+    if (filename == NULL) return;
+
+    int index = editor_buffer_find(filename);
+    if (index != -1) {
+        editor_buffer_switch(index);
+        editor_set_status_message("Buffer %d of %d: %s", B.current + 1, B.count, buffer_name(get_editor_config()));
+        free(filename);
+        return;
+    }
+    const char *problem = editor_file_unreadable(filename, 1);
+    if (problem) {
+        editor_set_status_message("Cannot open %s: %s", filename, problem);
+        free(filename);
+        return;
+    }
+
+    editor_buffer_new();
+    editor_open_file(filename);
+    free(filename);
+}
+
+void editor_buffer_open_files(char **filenames, int count) {
+    if (count <= 0) return;
+    EditorConfig **buffers = malloc(count * sizeof(EditorConfig *));
+    char **unique = malloc(count * sizeof(char *));
+    if (buffers == NULL || unique == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (opening files).");
+        return;
+    }
+
+    // The first file goes into the current buffer if nothing is in it yet.
+    EditorConfig *E = get_editor_config();
+    int reuse = E->lines.size == 0 && E->filename == NULL;
+    int first = reuse ? B.current : B.count;
+    int loaded = 0;
+    for (int i = 0; i < count; i++) {
+        int seen = editor_buffer_find(filenames[i]) != -1;
+        for (int j = 0; j < loaded && !seen; j++) seen = buffer_same_file(unique[j], filenames[i]);
+        if (seen) continue;
+        unique[loaded] = filenames[i];
+        buffers[loaded] = (loaded == 0 && reuse) ? E : editor_buffer_new();
+        loaded++;
+    }
+
+    editor_read_files(buffers, unique, loaded);
+
+    if (loaded > 1) {
+        long long lines = 0;
+        for (int i = 0; i < loaded; i++) lines += buffers[i]->lines.size;
+        editor_set_status_message("Opened %d files (%lld lines).", loaded, lines);
+    }
+    // Recovery prompts are shown over the buffer they are about.
+    for (int i = 0; i < loaded; i++) {
+        editor_buffer_switch(first + i);
+        editor_start_journal();
+    }
+    if (loaded > 0) editor_buffer_switch(first);
+    free(unique);
+    free(buffers);
+}
+
+void editor_buffer_free_all(int discard) {
+    while (B.count > 0) {
+        editor_set_config(B.items[B.count - 1]);
+        B.current = B.count - 1;
+        buffer_free_current(discard);
+    }
+    free(B.items);
+    B.items = NULL;
+    B.capacity = 0;
+    B.current = 0;
+}
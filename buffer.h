@@ -0,0 +1,38 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "editor.h"
+
+// Open buffers. Each is a whole EditorConfig with its own lines, cursor,
+// undo history, search state, syntax and journal, and the editor works on
+// the current one through get_editor_config(). Switching only changes which
+// one that is, so nothing is reloaded or re-highlighted.
+
+// Adds a buffer with no lines and makes it current.
+EditorConfig *editor_buffer_new();
+// Gives the current buffer the single empty line of a new document.
+void editor_buffer_init_empty();
+int editor_buffer_count();
+// Position of the current buffer, from 0.
+int editor_buffer_index();
+void editor_buffer_switch(int index);
+// Moves through the buffers; step is 1 for the next one, -1 for the previous.
+void editor_buffer_next(int step);
+// Returns the position of config in the buffer list, or -1.
+int editor_buffer_index_of(const EditorConfig *config);
+// Returns the index of the buffer holding filename, or -1.
+int editor_buffer_find(const char *filename);
+// Returns how many buffers have unsaved changes.
+int editor_buffer_dirty_count();
+// Closes the current buffer, asking first if it has unsaved changes.
+void editor_buffer_close();
+// Prompts for a file and opens it in a new buffer (Ctrl+O).
+void editor_buffer_open();
+// Opens each file in a buffer of its own, loading them in parallel, and
+// shows the first.
+void editor_buffer_open_files(char **filenames, int count);
+// Stops every journal, deleting the files if discard is set, and frees all
+// buffers.
+void editor_buffer_free_all(int discard);
+
+#endif // BUFFER_H
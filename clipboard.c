@@ -0,0 +1,392 @@
+#define _GNU_SOURCE // pipe2
+
+#include "clipboard.h"
+#include "cursors.h"
+#include "editor.h"
+#include "error_handler.h"
+#include "event_loop.h"
+#include "file.h"
+#include "swap.h"
+#include "ui.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// One transfer runs at a time. The editor thread saves the text to be
+// copied to a temporary file, a worker thread runs the helper and streams
+// that file to it or reads what it prints in large chunks, and the event
+// loop polls the
+// job: it shows how far along it is and, once a paste has arrived, inserts
+// it as a single splice at the cursor of the buffer Ctrl+V was pressed in,
+// whichever buffer is current by then.
+
+#define CLIPBOARD_CHUNK (1 << 20)
+#define CLIPBOARD_PROGRESS_MS 250
+
+typedef struct {
+    int copy;               // 1 to copy, 0 to paste
+    char *name;             // helper, for messages
+    char *argv[4];
+    int snapshot;           // copy: unlinked file holding the text to send
+    char *data;             // copy: chunk being sent; paste: text received
+    size_t len, capacity;
+    long long lines;        // copy: lines in data
+    atomic_size_t done;     // bytes sent or received so far
+    atomic_int finished;
+    atomic_int cancelled;
+    atomic_int pid;
+    int status;             // the helper's wait status, once finished
+    int error;              // errno of a failed transfer, 0 if none
+    EditorConfig *target;   // paste: the buffer it goes into
+    pthread_t thread;
+} ClipboardJob;
+
+static ClipboardJob *job;   // the transfer under way, editor thread only
+static long long progress_at;
+
+static long long clipboard_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int clipboard_tool_installed(const char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/usr/bin/%s", name);
+    if (access(path, X_OK) == 0) return 1;
+    snprintf(path, sizeof(path), "/bin/%s", name);
+    return access(path, X_OK) == 0;
+}
+
+// Fills in the helper for the job's direction. Returns -1 if there is none.
+static int clipboard_find_tool(ClipboardJob *job) {
+    const char *command = getenv(job->copy ? "ERWINTEXT_CLIPBOARD_COPY" : "ERWINTEXT_CLIPBOARD_PASTE");
+    if (command != NULL && command[0] != '\0') {
+        job->name = strdup(command);
+        job->argv[0] = "/bin/sh";
+        job->argv[1] = "-c";
+        job->argv[2] = job->name;
+        return job->name ? 0 : -1;
+    }
+
+    const char *session = getenv("XDG_SESSION_TYPE");
+    const char *wayland_tool = job->copy ? "wl-copy" : "wl-paste";
+    if (session != NULL && strcmp(session, "wayland") == 0 && clipboard_tool_installed(wayland_tool)) {
+        job->name = strdup(wayland_tool);
+        job->argv[0] = job->name;
+        return job->name ? 0 : -1;
+    }
+    if (clipboard_tool_installed("xclip")) {
+        job->name = strdup("xclip");
+        job->argv[0] = job->name;
+        job->argv[1] = job->copy ? "-i" : "-o";
+        return job->name ? 0 : -1;
+    }
+    return -1;
+}
+
+static void clipboard_free_job(ClipboardJob *job) {
+    if (job->copy) close(job->snapshot);
+    free(job->name);
+    free(job->data);
+    free(job);
+}
+
+// Keeps what the editor can hold in a line, as pasting always has:
+// printable ASCII and tabs. CR and CRLF become line breaks, and NUL and
+// other control bytes are dropped.
+static size_t clipboard_filter(char *text, size_t len) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        if (c == '\r') {
+            if (i + 1 < len && text[i + 1] == '\n') continue;
+            c = '\n';
+        }
+        if (c == '\n' || c == '\t' || (c >= 32 && c <= 126)) text[out++] = c;
+    }
+    return out;
+}
+
+static void *clipboard_worker(void *arg) {
+    ClipboardJob *job = arg;
+    // A helper that exits early must not take the editor down with it.
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, NULL);
+
+    if (job->copy && (job->data = malloc(CLIPBOARD_CHUNK)) == NULL) {
+        job->error = ENOMEM;
+        goto finish;
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        job->error = errno;
+        goto finish;
+    }
+    // The helper's end of the pipe: its stdin when copying, its stdout
+    // when pasting.
+    int theirs = job->copy ? fds[0] : fds[1];
+    int ours = job->copy ? fds[1] : fds[0];
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        sigprocmask(SIG_UNBLOCK, &pipe_signal, NULL);
+        // Its own process group, so cancelling reaches whatever a shell
+        // command started too.
+        setpgid(0, 0);
+        // xclip stays behind to serve the selection; it must not keep a
+        // terminal or our pipe open.
+        int null = open("/dev/null", O_RDWR);
+        dup2(job->copy ? theirs : null, STDIN_FILENO);
+        dup2(job->copy ? null : theirs, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execvp(job->argv[0], job->argv);
+        _exit(127);
+    }
+    close(theirs);
+    if (pid == -1) {
+        job->error = errno;
+        close(ours);
+        goto finish;
+    }
+    setpgid(pid, pid);
+    atomic_store(&job->pid, pid);
+    if (atomic_load(&job->cancelled)) kill(-pid, SIGTERM);
+
+    size_t done = 0;
+    while (!atomic_load(&job->cancelled)) {
+        ssize_t n;
+        if (job->copy) {
+            if (done == job->len) break;
+            size_t want = job->len - done < CLIPBOARD_CHUNK ? job->len - done : CLIPBOARD_CHUNK;
+            // After a short write the rest is simply read again.
+            n = pread(job->snapshot, job->data, want, (off_t)done);
+            if (n == 0) {
+                job->error = EIO;
+                break;
+            }
+            if (n > 0) n = write(ours, job->data, n);
+        } else {
+            if (job->capacity - done < CLIPBOARD_CHUNK) {
+                size_t capacity = job->capacity ? job->capacity * 2 : 4 * CLIPBOARD_CHUNK;
+                char *grown = realloc(job->data, capacity);
+                if (grown == NULL) {
+                    job->error = ENOMEM;
+                    break;
+                }
+                job->data = grown;
+                job->capacity = capacity;
+            }
+            n = read(ours, job->data + done, job->capacity - done);
+            if (n == 0) break;
+        }
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            job->error = errno;
+            break;
+        }
+        done += n;
+        atomic_store(&job->done, done);
+        editor_wake();
+    }
+    if (!job->copy) job->len = job->data ? clipboard_filter(job->data, done) : 0;
+    close(ours);
+    if (job->error) kill(-pid, SIGTERM);
+    while (waitpid(pid, &job->status, 0) == -1 && errno == EINTR) {}
+
+finish:
+    atomic_store(&job->finished, 1);
+    editor_wake();
+    return NULL;
+}
+
+static void clipboard_start(ClipboardJob *new_job) {
+    if (clipboard_find_tool(new_job) == -1) {
+        const char *op = new_job->copy ? "Copy" : "Paste";
+        const char *tools = new_job->copy ? "wl-copy" : "wl-paste";
+        clipboard_free_job(new_job);
+        editor_handle_error(ERR_CLIPBOARD_TOOL, "%s error: Neither %s nor xclip found. Please install one.", op, tools);
+        return;
+    }
+    if (pthread_create(&new_job->thread, NULL, clipboard_worker, new_job) != 0) {
+        const char *op = new_job->copy ? "Copy" : "Paste";
+        clipboard_free_job(new_job);
+        editor_handle_error(ERR_CLIPBOARD_TOOL, "%s error: Failed to start the clipboard thread.", op);
+        return;
+    }
+    job = new_job;
+    progress_at = clipboard_now_ms() + CLIPBOARD_PROGRESS_MS;
+    editor_set_status_message(job->copy ? "Copying using %s..." : "Pasting using %s...", job->name);
+}
+
+static void clipboard_cancel() {
+    atomic_store(&job->cancelled, 1);
+    pid_t pid = atomic_load(&job->pid);
+    if (pid > 0 && !atomic_load(&job->finished)) kill(-pid, SIGTERM);
+}
+
+// Returns 1 if a transfer is under way, after cancelling it if it goes the
+// same direction as the key just pressed.
+static int clipboard_busy(int copy) {
+    if (job == NULL) return 0;
+    if (job->copy != copy) {
+        editor_set_status_message("Wait for the clipboard %s to finish.", job->copy ? "copy" : "paste");
+        return 1;
+    }
+    clipboard_cancel();
+    editor_set_status_message("Cancelling...");
+    return 1;
+}
+
+void editor_clipboard_copy() {
+    EditorConfig *E = get_editor_config();
+    int all = E->select_all_active;
+    E->select_all_active = 0;
+    if (clipboard_busy(1)) return;
+
+    long long first = all ? 0 : E->cy;
+    long long end = all ? E->lines.size : E->cy + 1;
+    if (end > E->lines.size) end = E->lines.size;
+
+    ClipboardJob *new_job = calloc(1, sizeof(ClipboardJob));
+    if (new_job == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (clipboard).");
+        return;
+    }
+    new_job->copy = 1;
+
+    // The worker gets a snapshot, so editing can go on while it is sent.
+    // Unmodified and swapped-out lines go into it file to file, without
+    // being paged in.
+    EditorLinesArray range = { .elements = E->lines.elements + first, .size = end - first };
+    new_job->snapshot = editor_write_lines_snapshot(&range, E->filename, &E->disk_stat);
+    if (new_job->snapshot == -1) {
+        editor_set_status_message("Copy error: %s", strerror(errno));
+        free(new_job);
+        return;
+    }
+    for (long long i = first; i < end; i++) new_job->len += E->lines.elements[i].len + 1;
+    new_job->lines = end - first;
+    clipboard_start(new_job);
+}
+
+void editor_clipboard_paste() {
+    if (clipboard_busy(0) || editor_check_read_only()) return;
+    ClipboardJob *new_job = calloc(1, sizeof(ClipboardJob));
+    if (new_job == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (clipboard).");
+        return;
+    }
+    new_job->target = get_editor_config();
+    clipboard_start(new_job);
+}
+
+void editor_clipboard_buffer_closed(EditorConfig *config) {
+    if (job == NULL || job->copy || job->target != config) return;
+    job->target = NULL;
+    clipboard_cancel();
+}
+
+// Puts text in at the cursor as one splice of the cursor's line, and moves
+// the cursor to the end of it. Returns the number of lines pasted, or -1 if
+// the buffer is read-only.
+static long long clipboard_insert(const char *text, size_t len) {
+    EditorConfig *E = get_editor_config();
+    if (editor_check_read_only()) return -1;
+    editor_cursors_clear();
+    long long row = E->cy < E->lines.size ? E->cy : E->lines.size;
+    long long count = row < E->lines.size ? 1 : 0;
+    const char *line_text = "";
+    size_t line_len = 0, col = 0;
+    if (count) {
+        EditorLine *line = &E->lines.elements[row];
+        editor_line_page_in(line);
+        line_text = line->text;
+        line_len = line->len;
+        col = (size_t)E->cx < line->len ? (size_t)E->cx : line->len;
+    }
+
+    // The line before the cursor, the text, then the rest of the line.
+    size_t total = line_len + len + 1;
+    char *joined = malloc(total);
+    if (joined == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (pasting).");
+        return 0;
+    }
+    memcpy(joined, line_text, col);
+    memcpy(joined + col, text, len);
+    memcpy(joined + col + len, line_text + col, line_len - col);
+    joined[total - 1] = '\n';
+
+    long long newlines = 0;
+    size_t tail = len;  // bytes after the last newline of text
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            newlines++;
+            tail = len - i - 1;
+        }
+    }
+    editor_splice_rows(row, count, joined, total);
+    free(joined);
+
+    E->cy = row + newlines;
+    E->cx = newlines ? (long long)tail : (long long)(col + len);
+    if (E->cy >= E->lines.size) E->cy = E->lines.size - 1;
+    if (E->cy < 0) E->cy = 0;
+    if (E->cy < E->lines.size && E->cx > (long long)E->lines.elements[E->cy].len) E->cx = E->lines.elements[E->cy].len;
+    return newlines + (tail > 0);
+}
+
+void editor_clipboard_poll() {
+    if (job == NULL) return;
+    double megabytes = atomic_load(&job->done) / (1024.0 * 1024.0);
+
+    if (!atomic_load(&job->finished)) {
+        long long now = clipboard_now_ms();
+        if (now < progress_at || atomic_load(&job->cancelled)) return;
+        progress_at = now + CLIPBOARD_PROGRESS_MS;
+        if (job->copy) {
+            editor_set_status_message("Copying: %.1f of %.1f MB (Ctrl+Y again cancels)",
+                                      megabytes, job->len / (1024.0 * 1024.0));
+        } else {
+            editor_set_status_message("Pasting: %.1f MB (Ctrl+V again cancels)", megabytes);
+        }
+        editor_request_redraw();
+        return;
+    }
+
+    pthread_join(job->thread, NULL);
+    const char *op = job->copy ? "Copy" : "Paste";
+    int exited_ok = WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0;
+    if (atomic_load(&job->cancelled)) {
+        editor_set_status_message("%s cancelled.", op);
+    } else if (job->error) {
+        editor_set_status_message("%s error: %s: %s", op, job->name, strerror(job->error));
+    } else if (!exited_ok) {
+        editor_set_status_message("%s error: %s failed or returned an error.", op, job->name);
+    } else if (job->copy) {
+        editor_set_status_message("Copied %lld line%s (%.1f MB) using %s.",
+                                  job->lines, job->lines == 1 ? "" : "s", megabytes, job->name);
+    } else {
+        EditorConfig *current = get_editor_config();
+        editor_set_config(job->target);
+        long long lines = clipboard_insert(job->data ? job->data : "", job->len);
+        editor_set_config(current);
+        if (lines >= 0) editor_set_status_message("Pasted %lld line%s (%.1f MB) from clipboard using %s.",
+                                                  lines, lines == 1 ? "" : "s", megabytes, job->name);
+    }
+    clipboard_free_job(job);
+    job = NULL;
+    editor_request_redraw();
+}
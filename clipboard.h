@@ -0,0 +1,21 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+// System clipboard. Ctrl+Y copies the selection (everything after Ctrl+A)
+// or else the current line, and Ctrl+V pastes at the cursor. The helper
+// (wl-copy/wl-paste or xclip) runs on a worker thread, so the editor stays
+// usable while a large transfer is under way; the same key again cancels
+// it. ERWINTEXT_CLIPBOARD_COPY and ERWINTEXT_CLIPBOARD_PASTE replace the
+// helpers with shell commands, which read or print the text.
+
+struct EditorConfig;
+
+void editor_clipboard_copy();
+void editor_clipboard_paste();
+// Called from the event loop: shows progress, and applies a finished
+// paste at the cursor of the buffer it was asked for in.
+void editor_clipboard_poll();
+// Cancels a paste meant for config, which is being closed.
+void editor_clipboard_buffer_closed(struct EditorConfig *config);
+
+#endif // CLIPBOARD_H
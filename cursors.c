@@ -0,0 +1,425 @@
+#include "cursors.h"
+#include "editor.h"
+#include "error_handler.h"
+#include "event_loop.h"
+#include "input.h"
+#include "journal.h"
+#include "search.h"
+#include "swap.h"
+#include "syntax.h"
+#include "ui.h"
+#include "ui_constants.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// While there are several cursors, all of them, the main one included, sit
+// in E->cursors in (row, col) order with no two alike, and cursor_primary
+// says which one cx, cy is. An edit walks that list once: all the cursors
+// on a row are applied while the row's new text is built, so the row is
+// rewritten, recorded for undo and re-highlighted once however many
+// cursors it has, and each cursor's new column follows from the number of
+// edits before it on its row.
+//
+// Undo gets the old text of every row the first keystroke touched; the
+// keystrokes that follow touch only those rows, so until the cursors are
+// moved the whole run of typing is undone in one step without recording
+// the rows again.
+
+// How many lines Ctrl+L scans between checks for a queued ESC/Ctrl+C.
+#define CURSOR_SCAN_CHECK_INTERVAL 4096
+
+static int cursor_compare(const void *a, const void *b) {
+    const EditorCursor *x = a;
+    const EditorCursor *y = b;
+    if (x->row != y->row) return x->row < y->row ? -1 : 1;
+    if (x->col != y->col) return x->col < y->col ? -1 : 1;
+    return 0;
+}
+
+static void cursors_push(EditorConfig *E, long long row, long long col) {
+    if (E->cursor_count == E->cursor_capacity) {
+        long long capacity = E->cursor_capacity ? E->cursor_capacity * 2 : 64;
+        EditorCursor *grown = realloc(E->cursors, capacity * sizeof(EditorCursor));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (cursors).");
+            return;
+        }
+        E->cursors = grown;
+        E->cursor_capacity = capacity;
+    }
+    E->cursors[E->cursor_count++] = (EditorCursor){ .row = row, .col = col };
+}
+
+// The cursors changed other than by an edit.
+static void cursors_changed(EditorConfig *E) {
+    E->cursors_journaled = false;
+    E->cursor_edit_open = false;
+}
+
+// Merges cursors that have come together, keeping track of the main one,
+// and puts cx, cy on it. The cursors must be sorted.
+static void cursors_settle(EditorConfig *E) {
+    long long kept = 0;
+    long long primary = 0;
+    for (long long i = 0; i < E->cursor_count; i++) {
+        if (kept == 0 || cursor_compare(&E->cursors[kept - 1], &E->cursors[i]) != 0) {
+            E->cursors[kept++] = E->cursors[i];
+        }
+        if (i == E->cursor_primary) primary = kept - 1;
+    }
+    E->cursor_count = kept;
+    E->cursor_primary = primary;
+    if (kept > 0) {
+        E->cy = E->cursors[primary].row;
+        E->cx = E->cursors[primary].col;
+    }
+    // One cursor left is just the ordinary one.
+    if (kept == 1) E->cursor_count = 0;
+}
+
+// Sorts cursors that may be out of order, keeping track of the main one.
+static void cursors_sort(EditorConfig *E) {
+    EditorCursor primary = E->cursors[E->cursor_primary];
+    qsort(E->cursors, E->cursor_count, sizeof(EditorCursor), cursor_compare);
+    EditorCursor *found = bsearch(&primary, E->cursors, E->cursor_count, sizeof(EditorCursor), cursor_compare);
+    E->cursor_primary = found - E->cursors;
+    cursors_settle(E);
+}
+
+// Starts a list holding just the main cursor, unless there is one already.
+static void cursors_begin(EditorConfig *E) {
+    if (E->cursor_count > 0) return;
+    long long row = E->cy < E->lines.size ? E->cy : E->lines.size - 1;
+    long long col = E->cy < E->lines.size ? E->cx : 0;
+    cursors_push(E, row, col);
+    E->cursor_primary = 0;
+}
+
+static void cursors_report(EditorConfig *E) {
+    if (E->cursor_count > 1) {
+        editor_set_status_message("%lld cursors. Type to edit at all of them; ESC leaves one.", E->cursor_count);
+    } else {
+        editor_set_status_message("No other place to put a cursor.");
+    }
+    editor_request_redraw();
+}
+
+void editor_cursors_clear() {
+    EditorConfig *E = get_editor_config();
+    E->cursor_count = 0;
+    cursors_changed(E);
+}
+
+void editor_cursors_add_matches() {
+    EditorConfig *E = get_editor_config();
+    if (E->search_pattern == NULL) {
+        editor_set_status_message("Search with Ctrl+F first; Ctrl+L puts a cursor on every match.");
+        return;
+    }
+    if (E->lines.size == 0) return;
+
+    cursors_begin(E);
+    long long existing = E->cursor_count;
+    for (long long row = 0; row < E->lines.size; row++) {
+        if (row > 0 && (row & (CURSOR_SCAN_CHECK_INTERVAL - 1)) == 0) {
+            if (editor_input_cancel_requested()) {
+                E->cursor_count = existing;
+                cursors_settle(E);
+                editor_set_status_message("Adding cursors cancelled.");
+                return;
+            }
+            editor_swap_trim(&E->lines);
+        }
+        EditorLine *line = &E->lines.elements[row];
+        editor_line_page_in(line);
+        size_t from = 0;
+        size_t start, stop;
+        while (from <= line->len && search_next(E->search_pattern, line->text, line->len, from, &start, &stop)) {
+            cursors_push(E, row, start);
+            from = stop > start ? stop : start + 1;
+        }
+    }
+    cursors_sort(E);
+    cursors_changed(E);
+    cursors_report(E);
+}
+
+// The index of the character drawn at or just after display column target.
+static long long cursors_col_at_display(const EditorLine *line, long long target) {
+    long long display = 0;
+    size_t i = 0;
+    for (; i < line->len && display < target; i++) {
+        display += line->text[i] == '\t' ? TAB_STOP - display % TAB_STOP : 1;
+    }
+    return i;
+}
+
+void editor_cursors_add_column() {
+    EditorConfig *E = get_editor_config();
+    if (E->lines.size == 0 || E->cy >= E->lines.size) return;
+
+    char *answer = editor_prompt("Add cursors in this column down to line (N, or +N/-N lines): %s");
+    if (answer == NULL) return;
+    char *end;
+    errno = 0;
+    long long n = strtoll(answer, &end, 10);
+    if (errno || end == answer || *end != '\0') {
+        editor_set_status_message("Invalid line: %s", answer);
+        free(answer);
+        return;
+    }
+    long long target = (answer[0] == '+' || answer[0] == '-') ? E->cy + n : n - 1;
+    free(answer);
+    if (target < 0) target = 0;
+    if (target >= E->lines.size) target = E->lines.size - 1;
+
+    long long display = get_cx_display();
+    long long first = target < E->cy ? target : E->cy;
+    long long last = target < E->cy ? E->cy : target;
+    cursors_begin(E);
+    for (long long row = first; row <= last; row++) {
+        EditorLine *line = &E->lines.elements[row];
+        editor_line_page_in(line);
+        cursors_push(E, row, cursors_col_at_display(line, display));
+    }
+    cursors_sort(E);
+    cursors_changed(E);
+    cursors_report(E);
+}
+
+static void cursors_move(EditorConfig *E, int key) {
+    for (long long i = 0; i < E->cursor_count; i++) {
+        EditorCursor *cursor = &E->cursors[i];
+        switch (key) {
+            case KEY_LEFT:
+                if (cursor->col > 0) cursor->col--;
+                break;
+            case KEY_RIGHT:
+                if (cursor->col < (long long)E->lines.elements[cursor->row].len) cursor->col++;
+                break;
+            case KEY_HOME:
+                cursor->col = 0;
+                break;
+            case KEY_END:
+                cursor->col = E->lines.elements[cursor->row].len;
+                break;
+            case KEY_UP:
+                if (cursor->row > 0) cursor->row--;
+                break;
+            case KEY_DOWN:
+                if (cursor->row + 1 < E->lines.size) cursor->row++;
+                break;
+        }
+        long long len = E->lines.elements[cursor->row].len;
+        if (cursor->col > len) cursor->col = len;
+    }
+    // Cursors stopped at the top or bottom can end up out of order.
+    if (key == KEY_UP || key == KEY_DOWN) {
+        cursors_sort(E);
+    } else {
+        cursors_settle(E);
+    }
+    cursors_changed(E);
+}
+
+static void cursors_push_change(EditorLineChange **changes, long long *count, long long *capacity, EditorLineChange change) {
+    if (*count == *capacity) {
+        long long new_capacity = *capacity ? *capacity * 2 : 256;
+        EditorLineChange *grown = realloc(*changes, new_capacity * sizeof(EditorLineChange));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (cursor undo record).");
+            return;
+        }
+        *changes = grown;
+        *capacity = new_capacity;
+    }
+    (*changes)[(*count)++] = change;
+}
+
+// Inserts c at every cursor, or with c < 0 deletes the character before
+// every cursor.
+static void cursors_edit(int c) {
+    EditorConfig *E = get_editor_config();
+    if (E->cursor_count == 0 || editor_check_read_only()) return;
+    if (!E->cursors_journaled) {
+        journal_record_cursors(E->cursors, E->cursor_count, E->cursor_primary);
+        E->cursors_journaled = true;
+    }
+    journal_record(c < 0 ? JOURNAL_CURSOR_DELETE_CHAR : JOURNAL_CURSOR_INSERT_CHAR, E->cy, E->cx, c < 0 ? 0 : c);
+
+    int record = !E->cursor_edit_open;
+    EditorLineChange *changes = NULL;
+    long long change_count = 0, change_capacity = 0;
+    long long *rows = malloc(E->cursor_count * sizeof(long long));
+    if (rows == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (cursor edit).");
+        return;
+    }
+    long long changed_rows = 0;
+    int all_rows_changed = 1;
+    long long origin_cy = E->cy;
+    long long origin_cx = E->cx;
+
+    for (long long i = 0; i < E->cursor_count;) {
+        long long row = E->cursors[i].row;
+        long long end = i;
+        size_t edits = 0;
+        for (; end < E->cursor_count && E->cursors[end].row == row; end++) {
+            if (c >= 0 || E->cursors[end].col > 0) edits++;
+        }
+        if (edits == 0) {
+            all_rows_changed = 0;
+            i = end;
+            continue;
+        }
+
+        EditorLine *line = &E->lines.elements[row];
+        editor_line_page_in(line);
+        size_t len = c >= 0 ? line->len + edits : line->len - edits;
+        char *text = malloc(len + 1);
+        if (text == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory for line %lld.", row);
+            return;
+        }
+        char *out = text;
+        size_t copied = 0;
+        long long done = 0;
+        for (; i < end; i++) {
+            EditorCursor *cursor = &E->cursors[i];
+            size_t at = cursor->col;
+            if (c >= 0) {
+                memcpy(out, line->text + copied, at - copied);
+                out += at - copied;
+                *out++ = (char)c;
+                copied = at;
+                cursor->col += ++done;
+            } else if (at > 0) {
+                memcpy(out, line->text + copied, at - 1 - copied);
+                out += at - 1 - copied;
+                copied = at;
+                cursor->col -= ++done;
+            }
+        }
+        memcpy(out, line->text + copied, line->len - copied);
+        text[len] = '\0';
+
+        EditorLineChange change = { .row = row, .len = line->len };
+        change.text = editor_line_replace_text(line, text, len);
+        if (record) {
+            cursors_push_change(&changes, &change_count, &change_capacity, change);
+        } else {
+            free(change.text);
+        }
+        rows[changed_rows++] = row;
+    }
+    editor_update_syntax_list(rows, changed_rows);
+    free(rows);
+
+    // Backspace can bring two cursors together.
+    cursors_settle(E);
+    if (change_count > 0) {
+        EditorAction action = { .type = ACTION_REPLACE_LINES, .row = origin_cy, .col = origin_cx,
+                                .changes = changes, .change_count = change_count };
+        editor_record_action(action);
+        E->cursor_edit_open = all_rows_changed;
+    }
+    if (changed_rows > 0) E->dirty = 1;
+    editor_swap_trim(&E->lines);
+}
+
+void editor_cursors_insert_char(int c) {
+    cursors_edit(c);
+}
+
+void editor_cursors_del_char() {
+    cursors_edit(-1);
+}
+
+int editor_cursors_handle_key(int c) {
+    EditorConfig *E = get_editor_config();
+    if (E->cursor_count == 0) return 0;
+
+    switch (c) {
+        case 27:
+            editor_cursors_clear();
+            editor_set_status_message("");
+            return 1;
+        case KEY_BACKSPACE:
+        case KEY_DC:
+        case 127:
+            editor_cursors_del_char();
+            return 1;
+        case '\t':
+            editor_cursors_insert_char('\t');
+            return 1;
+        case KEY_LEFT:
+        case KEY_RIGHT:
+        case KEY_UP:
+        case KEY_DOWN:
+        case KEY_HOME:
+        case KEY_END:
+            cursors_move(E, c);
+            return 1;
+        // Keys that leave the cursors alone.
+        case CTRL('s'):
+        case CTRL('l'):
+        case CTRL('t'):
+        case CTRL('k'):
+        case CTRL('e'):
+            return 0;
+    }
+    if (c >= 32 && c <= 126) {
+        editor_cursors_insert_char(c);
+        return 1;
+    }
+    editor_cursors_clear();
+    return 0;
+}
+
+int editor_cursors_restore(const EditorCursor *cursors, long long count, long long primary) {
+    EditorConfig *E = get_editor_config();
+    if (count < 2 || primary < 0 || primary >= count) return -1;
+    for (long long i = 0; i < count; i++) {
+        if (cursors[i].row < 0 || cursors[i].row >= E->lines.size || cursors[i].col < 0 ||
+            cursors[i].col > (long long)E->lines.elements[cursors[i].row].len) return -1;
+        if (i > 0 && cursor_compare(&cursors[i - 1], &cursors[i]) >= 0) return -1;
+    }
+    E->cursor_count = 0;
+    for (long long i = 0; i < count; i++) cursors_push(E, cursors[i].row, cursors[i].col);
+    E->cursor_primary = primary;
+    cursors_settle(E);
+    cursors_changed(E);
+    return 0;
+}
+
+// The display column of the character at col.
+static long long cursors_display_col(const EditorLine *line, long long col) {
+    long long display = 0;
+    for (long long i = 0; i < col && i < (long long)line->len; i++) {
+        display += line->text[i] == '\t' ? TAB_STOP - display % TAB_STOP : 1;
+    }
+    return display;
+}
+
+void editor_cursors_visible(void (*mark)(int y, int x)) {
+    EditorConfig *E = get_editor_config();
+    if (E->cursor_count == 0) return;
+
+    // First cursor at or below the top of the screen.
+    long long lo = 0, hi = E->cursor_count;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        if (E->cursors[mid].row < E->row_offset) lo = mid + 1;
+        else hi = mid;
+    }
+    for (long long i = lo; i < E->cursor_count && E->cursors[i].row < E->row_offset + E->screen_rows; i++) {
+        if (i == E->cursor_primary) continue;
+        EditorLine *line = &E->lines.elements[E->cursors[i].row];
+        editor_line_page_in(line);
+        long long x = cursors_display_col(line, E->cursors[i].col) - E->col_offset;
+        if (x < 0 || x >= E->screen_cols) continue;
+        mark((int)(E->cursors[i].row - E->row_offset), (int)x);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef CURSORS_H
+#define CURSORS_H
+
+#include "editor.h"
+
+// Multiple cursors. Ctrl+L puts a cursor on every match of the last search
+// and Ctrl+T one in the cursor's column on each line up to a given line.
+// Typing, Backspace and the arrow, Home and End keys then act at every
+// cursor; ESC, or any other editing key, goes back to the main one.
+
+void editor_cursors_add_matches();
+void editor_cursors_add_column();
+void editor_cursors_clear();
+// Returns 1 if c was applied at every cursor, 0 if it is left to
+// editor_process_keypress (the extra cursors are dropped first unless c
+// leaves them alone).
+int editor_cursors_handle_key(int c);
+void editor_cursors_insert_char(int c);
+void editor_cursors_del_char();
+// Installs cursors read back from the journal. Returns -1 if they do not
+// fit the buffer.
+int editor_cursors_restore(const EditorCursor *cursors, long long count, long long primary);
+// Calls mark(y, x) for the screen cell of every extra cursor in view.
+void editor_cursors_visible(void (*mark)(int y, int x));
+
+#endif // CURSORS_H
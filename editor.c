@@ -12,178 +12,343 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <unistd.h>
-#include <sys/wait.h>
-#include <signal.h>
 #include "error_handler.h"
 #include "editor_lines_array.h"
+#include "journal.h"
+#include "event_loop.h"
+#include "input.h"
+#include "vt100.h"
+#include "swap.h"
+#include "intern.h"
+#include "parallel.h"
+#include "filesearch.h"
+#include "buffer.h"
+#include "macro.h"
+#include "cursors.h"
+#include "filter.h"
+#include "clipboard.h"
+
+// Each thread has its own current buffer. The editor thread switches it
+// between open buffers; batch workers (batch.c) each edit a private one.
+static _Thread_local EditorConfig *E;
 
-void handle_winch(int sig);
+EditorConfig *get_editor_config() {
+    return E;
+}
 
-extern time_t status_message_time;
+void editor_set_config(EditorConfig *config) {
+    E = config;
+}
 
-static EditorConfig E;
+void init_editor_config(EditorConfig *config) {
+    memset(config, 0, sizeof(*config));
+    init_editor_lines_array(&config->lines);
+    config->search_direction = 1;
+    config->last_match_row = -1;
+    config->last_match_col = -1;
+    config->find_active = false;
+    config->recording_actions = true;
+    config->hl_stale_hint = -1;
+}
 
-EditorConfig *get_editor_config() {
-    return &E;
+void free_editor_config(EditorConfig *config) {
+    free_editor_lines_array(&config->lines);
+    free(config->filename);
+    config->filename = NULL;
+    free(config->search_query);
+    config->search_query = NULL;
+    search_free(config->search_pattern);
+    config->search_pattern = NULL;
+    for (int i = 0; i < config->undo_history_len; ++i) {
+        editor_free_action(&config->undo_history[i]);
+    }
+    config->undo_history_len = 0;
+    config->undo_history_idx = 0;
+    for (long long i = 0; i < config->open_group_len; ++i) {
+        editor_free_action(&config->open_group[i]);
+    }
+    free(config->open_group);
+    config->open_group = NULL;
+    config->open_group_len = config->open_group_capacity = 0;
+    config->grouping_actions = false;
+    free(config->cursors);
+    config->cursors = NULL;
+    config->cursor_count = config->cursor_capacity = config->cursor_primary = 0;
 }
 
 void init_editor() {
-    E.cx = 0;
-    E.cy = 0;
-    init_editor_lines_array(&E.lines);
-    E.row_offset = 0;
-    E.col_offset = 0;
-    E.filename = NULL;
-    E.dirty = 0;
-    E.select_all_active = 0;
-
-    E.undo_history_len = 0;
-    E.undo_history_idx = 0;
-    for (int i = 0; i < MAX_UNDO_STATES; ++i) {
-        // Initialize each EditorAction in the history to a default state if necessary
-        // For now, we'll just ensure its internal pointers are NULL or safe.
-        E.undo_history[i].line_content = NULL; // Ensure this is NULL initially
-    }
-
-    E.search_query = NULL;
-    E.search_direction = 1;
-    E.last_match_row = -1;
-    E.last_match_col = -1;
-    E.find_active = false;
-    E.recording_actions = true;
-
-    initscr();
-    raw();
-    noecho();
-    keypad(stdscr, TRUE);
-
-    signal(SIGWINCH, handle_winch);
-
-    getmaxyx(stdscr, E.screen_rows, E.screen_cols);
-    E.screen_rows -= 2;
-
-    if (has_colors()) {
-        start_color();
-        use_default_colors();
-        init_pair(HL_NORMAL, COLOR_WHITE, COLOR_BLACK);
-        init_pair(HL_COMMENT, COLOR_CYAN, COLOR_BLACK);
-        init_pair(HL_KEYWORD1, COLOR_YELLOW, COLOR_BLACK);
-        init_pair(HL_KEYWORD2, COLOR_GREEN, COLOR_BLACK);
-        init_pair(HL_STRING, COLOR_MAGENTA, COLOR_BLACK);
-        init_pair(HL_NUMBER, COLOR_RED, COLOR_BLACK);
-        init_pair(HL_MATCH, COLOR_BLACK, COLOR_YELLOW);
-        init_pair(HL_PREPROC, COLOR_BLUE, COLOR_BLACK);
-    }
-
-    mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
-}
+    editor_swap_init();
+    editor_intern_init();
+    editor_buffer_new();
 
-void cleanup_editor() {
-    endwin();
+    const char *backend = getenv("ERWINTEXT_BACKEND");
+    if (backend && strcmp(backend, "vt100") == 0 && vt100_init() == 0) {
+        vt100_get_window_size(&E->screen_rows, &E->screen_cols);
+    } else {
+        initscr();
+        raw();
+        noecho();
+        keypad(stdscr, TRUE);
+
+        getmaxyx(stdscr, E->screen_rows, E->screen_cols);
+
+        if (has_colors()) {
+            start_color();
+            use_default_colors();
+            init_pair(HL_NORMAL, COLOR_WHITE, COLOR_BLACK);
+            init_pair(HL_COMMENT, COLOR_CYAN, COLOR_BLACK);
+            init_pair(HL_KEYWORD1, COLOR_YELLOW, COLOR_BLACK);
+            init_pair(HL_KEYWORD2, COLOR_GREEN, COLOR_BLACK);
+            init_pair(HL_STRING, COLOR_MAGENTA, COLOR_BLACK);
+            init_pair(HL_NUMBER, COLOR_RED, COLOR_BLACK);
+            init_pair(HL_MATCH, COLOR_BLACK, COLOR_YELLOW);
+            init_pair(HL_PREPROC, COLOR_BLUE, COLOR_BLACK);
+        }
 
-    free_editor_lines_array(&E.lines);
-    if (E.filename) {
-        free(E.filename);
+        mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
     }
-    if (E.search_query) {
-        free(E.search_query);
+    E->screen_rows -= 2;
+
+    editor_event_loop_init();
+    editor_input_start();
+    editor_syntax_worker_start();
+}
+
+void cleanup_editor() {
+    if (vt100_backend_active) {
+        vt100_shutdown();
+    } else {
+        endwin();
     }
+    editor_buffer_free_all(0);
+}
 
-    for (int i = 0; i < E.undo_history_len; ++i) {
-        if (E.undo_history[i].type == ACTION_DELETE_LINE && E.undo_history[i].line_content) {
-            free(E.undo_history[i].line_content);
-        }
+// Empties the buffer and forgets everything tied to its old contents, ready
+// for another file to be read in. The caller deals with the journal.
+void editor_reset_buffer() {
+    free_editor_lines_array(&E->lines);
+    init_editor_lines_array(&E->lines);
+    for (int i = 0; i < E->undo_history_len; ++i) {
+        editor_free_action(&E->undo_history[i]);
     }
+    E->undo_history_len = 0;
+    E->undo_history_idx = 0;
+    free(E->filename);
+    E->filename = NULL;
+    memset(&E->disk_stat, 0, sizeof(E->disk_stat));
+    E->cx = 0;
+    E->cy = 0;
+    E->row_offset = 0;
+    E->col_offset = 0;
+    E->dirty = 0;
+    E->select_all_active = 0;
+    E->last_match_row = -1;
+    E->last_match_col = -1;
+    E->find_active = false;
+    E->hl_stale_hint = -1;
+    editor_select_syntax_highlight();
 }
 
 void editor_move_cursor(int key) {
-    EditorLine *line = (E.cy >= E.lines.size) ? NULL : &E.lines.elements[E.cy];
+    EditorLine *line = (E->cy >= E->lines.size) ? NULL : &E->lines.elements[E->cy];
 
     switch (key) {
         case KEY_LEFT:
-            if (E.cx > 0) {
-                E.cx--;
-            } else if (E.cy > 0) {
-                E.cy--;
-                E.cx = E.lines.elements[E.cy].len;
+            if (E->cx > 0) {
+                E->cx--;
+            } else if (E->cy > 0) {
+                E->cy--;
+                E->cx = E->lines.elements[E->cy].len;
             }
             break;
         case KEY_RIGHT:
-            if (line && (size_t)E.cx < line->len) {
-                E.cx++;
-            } else if (line && (size_t)E.cx == line->len && E.cy < E.lines.size - 1) {
-                if (line && (size_t)E.cx == line->len && E.cy < E.lines.size - 1) {
-                E.cy++;
-                E.cx = 0;
+            if (line && (size_t)E->cx < line->len) {
+                E->cx++;
+            } else if (line && (size_t)E->cx == line->len && E->cy < E->lines.size - 1) {
+                if (line && (size_t)E->cx == line->len && E->cy < E->lines.size - 1) {
+                E->cy++;
+                E->cx = 0;
             }
             }
             break;
         case KEY_UP:
-            if (E.cy > 0) {
-                E.cy--;
+            if (E->cy > 0) {
+                E->cy--;
             }
             break;
         case KEY_DOWN:
-            if (E.cy < E.lines.size - 1) {
-                E.cy++;
+            if (E->cy < E->lines.size - 1) {
+                E->cy++;
             }
             break;
         case KEY_HOME:
-            E.cx = 0;
+            E->cx = 0;
             break;
         case KEY_END:
-            if (line) E.cx = line->len;
+            if (line) E->cx = line->len;
             break;
         case KEY_PPAGE:
+            editor_jump_rows(-E->screen_rows);
+            break;
         case KEY_NPAGE:
-            {
-                int times = E.screen_rows;
-                while (times--) {
-                    if (key == KEY_PPAGE) {
-                        if (E.cy > 0) E.cy--;
-                    } else {
-                        if (E.cy < E.lines.size - 1) E.cy++;
-                    }
-                }
-            }
+            editor_jump_rows(E->screen_rows);
             break;
     }
-    line = (E.cy >= E.lines.size) ? NULL : &E.lines.elements[E.cy];
-    int line_len = line ? line->len : 0;
-    if (E.cx > line_len) {
-        E.cx = line_len;
+    line = (E->cy >= E->lines.size) ? NULL : &E->lines.elements[E->cy];
+    long long line_len = line ? (long long)line->len : 0;
+    if (E->cx > line_len) {
+        E->cx = line_len;
+    }
+}
+
+// Moves the cursor and the viewport together by delta rows, clamped to the
+// buffer, so paging and wheel scrolling cost the same however far they go.
+void editor_jump_rows(long long delta) {
+    long long last = E->lines.size > 0 ? E->lines.size - 1 : 0;
+
+    E->cy += delta;
+    if (E->cy < 0) E->cy = 0;
+    if (E->cy > last) E->cy = last;
+
+    E->row_offset += delta;
+    if (E->row_offset > last) E->row_offset = last;
+    if (E->row_offset < 0) E->row_offset = 0;
+
+    EditorLine *line = (E->cy < E->lines.size) ? &E->lines.elements[E->cy] : NULL;
+    long long line_len = line ? (long long)line->len : 0;
+    if (E->cx > line_len) E->cx = line_len;
+}
+
+// Puts the cursor on row/col and centers that row on screen.
+static void editor_jump_to(long long row, long long col) {
+    long long last = E->lines.size > 0 ? E->lines.size - 1 : 0;
+    if (row < 0) row = 0;
+    if (row > last) row = last;
+
+    long long line_len = (row < E->lines.size) ? (long long)E->lines.elements[row].len : 0;
+    if (col < 0) col = 0;
+    if (col > line_len) col = line_len;
+
+    E->cy = row;
+    E->cx = col;
+    E->row_offset = row - E->screen_rows / 2;
+    if (E->row_offset < 0) E->row_offset = 0;
+}
+
+// Maps a byte offset in the file to a row. While the buffer still matches
+// what was loaded or last saved, every line knows where it starts on disk
+// and a binary search finds the row; otherwise line lengths are summed.
+static long long editor_row_for_offset(off_t offset, long long *col) {
+    long long size = E->lines.size;
+    if (size == 0) {
+        *col = 0;
+        return 0;
+    }
+
+    if (!E->dirty && E->lines.elements[0].disk_offset == 0) {
+        long long lo = 0;
+        long long hi = size - 1;
+        while (lo < hi) {
+            long long mid = lo + (hi - lo + 1) / 2;
+            if (E->lines.elements[mid].disk_offset <= offset) lo = mid;
+            else hi = mid - 1;
+        }
+        *col = offset - E->lines.elements[lo].disk_offset;
+        return lo;
+    }
+
+    off_t start = 0;
+    for (long long i = 0; i < size; i++) {
+        off_t next = start + (off_t)E->lines.elements[i].len + 1;
+        if (offset < next || i == size - 1) {
+            *col = offset - start;
+            return i;
+        }
+        start = next;
     }
+    *col = 0;
+    return size - 1;
 }
 
-void editor_process_keypress() {
-    int c = getch();
+int editor_goto_target(const char *target) {
+    char *end;
+    errno = 0;
+    if (target[0] == '@') {
+        long long offset = strtoll(target + 1, &end, 10);
+        if (errno || end == target + 1 || *end != '\0' || offset < 0) {
+            editor_set_status_message("Invalid byte offset: %s", target);
+            return -1;
+        }
+        long long col;
+        long long row = editor_row_for_offset((off_t)offset, &col);
+        editor_jump_to(row, col);
+        return 0;
+    }
+
+    long long n = strtoll(target, &end, 10);
+    if (errno || end == target || n < 0 || (*end != '\0' && strcmp(end, "%") != 0)) {
+        editor_set_status_message("Invalid line number: %s", target);
+        return -1;
+    }
+    if (*end == '%') {
+        if (n > 100) n = 100;
+        long long last = E->lines.size > 0 ? E->lines.size - 1 : 0;
+        editor_jump_to(last / 100 * n + last % 100 * n / 100, 0);
+    } else {
+        if (n > E->lines.size) n = E->lines.size;
+        editor_jump_to(n - 1, 0);
+    }
+    return 0;
+}
+
+void editor_goto() {
+    char *target = editor_prompt("Go to line, N%%, or @byte offset (ESC to cancel): %s");
+    if (target == NULL) return;
+    editor_goto_target(target);
+    free(target);
+}
+
+void editor_process_keypress(int c) {
     bool cursor_moved = false;
-    int original_cx = E.cx;
-    int original_cy = E.cy;
+    long long original_cx = E->cx;
+    long long original_cy = E->cy;
 
-    if (E.find_active && c != KEY_UP && c != KEY_DOWN && c != CTRL('f')) {
-        E.find_active = false;
+    if (editor_file_search_handle_key(c)) {
+        editor_request_redraw();
+        return;
+    }
+
+    if (E->find_active && c != KEY_UP && c != KEY_DOWN && c != CTRL('f')) {
+        E->find_active = false;
         editor_set_status_message("");
-        for (int i = 0; i < E.lines.size; i++) {
-            editor_update_syntax(i);
-        }
-        editor_refresh_screen();
+        editor_update_syntax_all();
+        editor_request_redraw();
     }
 
-    if (E.select_all_active && c != KEY_BACKSPACE && c != 127 && c != KEY_DC) {
-        E.select_all_active = 0;
+    if (E->select_all_active && c != KEY_BACKSPACE && c != 127 && c != KEY_DC && c != CTRL('y')) {
+        E->select_all_active = 0;
         editor_set_status_message("");
     }
 
+    if (editor_cursors_handle_key(c)) {
+        editor_request_redraw();
+        return;
+    }
+
     switch (c) {
         case CTRL('q'):
         case CTRL('c'):
-            if (E.dirty) {
-                editor_set_status_message("WARNING! File has unsaved changes. Press Ctrl+Q/C again to force quit.");
+            if (editor_buffer_dirty_count() > 0) {
+                if (editor_buffer_dirty_count() > 1) {
+                    editor_set_status_message("WARNING! %d buffers have unsaved changes. Press Ctrl+Q/C again to force quit.", editor_buffer_dirty_count());
+                } else {
+                    editor_set_status_message("WARNING! File has unsaved changes. Press Ctrl+Q/C again to force quit.");
+                }
                 editor_refresh_screen();
-                int c2 = getch();
+                int c2 = editor_read_key();
                 if (c2 != CTRL('q') && c2 != CTRL('c')) return;
             }
+            editor_buffer_free_all(1);
             cleanup_editor();
             exit(0);
             break;
@@ -193,25 +358,90 @@ void editor_process_keypress() {
             break;
 
         case CTRL('a'):
-            E.select_all_active = 1;
-            E.cx = 0;
-            E.cy = 0;
+            E->select_all_active = 1;
+            E->cx = 0;
+            E->cy = 0;
             editor_set_status_message("All text selected. Press Backspace to delete.");
             cursor_moved = true;
             break;
 
         case CTRL('v'):
-            paste_from_clipboard();
+            editor_clipboard_paste();
+            break;
+
+        case CTRL('y'):
+            editor_clipboard_copy();
             break;
 
         case CTRL('z'):
             editor_undo();
             break;
 
+        case CTRL('g'):
+            editor_goto();
+            cursor_moved = true;
+            break;
+
+        case CTRL('u'):
+            editor_jump_rows(-(E->screen_rows / 2));
+            cursor_moved = true;
+            break;
+
+        case CTRL('d'):
+            editor_jump_rows(E->screen_rows / 2);
+            cursor_moved = true;
+            break;
+
         case CTRL('f'):
             editor_find();
             break;
 
+        case CTRL('r'):
+            editor_replace();
+            break;
+
+        case CTRL('k'):
+            editor_macro_toggle_recording();
+            break;
+
+        case CTRL('e'):
+            editor_macro_replay();
+            break;
+
+        case CTRL('l'):
+            editor_cursors_add_matches();
+            break;
+
+        case CTRL('t'):
+            editor_cursors_add_column();
+            break;
+
+        case CTRL('x'):
+            editor_filter();
+            cursor_moved = true;
+            break;
+
+        case CTRL('p'):
+            editor_file_search();
+            cursor_moved = true;
+            break;
+
+        case CTRL('o'):
+            editor_buffer_open();
+            return;
+
+        case CTRL('n'):
+            editor_buffer_next(1);
+            return;
+
+        case CTRL('b'):
+            editor_buffer_next(-1);
+            return;
+
+        case CTRL('w'):
+            editor_buffer_close();
+            return;
+
         case KEY_BACKSPACE:
         case KEY_DC:
         case 127:
@@ -236,7 +466,7 @@ void editor_process_keypress() {
             break;
 
         case KEY_UP:
-            if (E.find_active) {
+            if (E->find_active) {
                 editor_find_next(-1);
             } else {
                 editor_move_cursor(c);
@@ -244,7 +474,7 @@ void editor_process_keypress() {
             }
             break;
         case KEY_DOWN:
-            if (E.find_active) {
+            if (E->find_active) {
                 editor_find_next(1);
             }
             else {
@@ -261,15 +491,16 @@ void editor_process_keypress() {
         case KEY_MOUSE:
             {
                 MEVENT event;
-                if (getmouse(&event) == OK) {
+                if (editor_get_mouse(&event) == OK) {
                     if (event.bstate & BUTTON1_CLICKED) {
-                        E.cy = event.y + E.row_offset;
+                        E->cy = event.y + E->row_offset;
                         
-                        int target_display_cx = event.x + E.col_offset;
-                        int actual_cx = 0;
-                        if (E.cy < E.lines.size) {
-                            EditorLine *line = &E.lines.elements[E.cy];
-                            int current_display_cx = 0;
+                        long long target_display_cx = event.x + E->col_offset;
+                        long long actual_cx = 0;
+                        if (E->cy < E->lines.size) {
+                            EditorLine *line = &E->lines.elements[E->cy];
+                            editor_line_page_in(line);
+                            long long current_display_cx = 0;
                             for (size_t char_idx = 0; char_idx < line->len; char_idx++) {
                                 int char_display_width = 1;
                                 if (line->text[char_idx] == '\t') {
@@ -282,26 +513,22 @@ void editor_process_keypress() {
                                 actual_cx = char_idx + 1;
                             }
                         }
-                        E.cx = actual_cx;
+                        E->cx = actual_cx;
 
-                        if (E.cy >= E.lines.size) {
-                            E.cy = E.lines.size > 0 ? E.lines.size - 1 : 0;
+                        if (E->cy >= E->lines.size) {
+                            E->cy = E->lines.size > 0 ? E->lines.size - 1 : 0;
                         }
-                        EditorLine *line = (E.cy < E.lines.size) ? &E.lines.elements[E.cy] : NULL;
-                        int line_len = line ? line->len : 0;
-                        if (E.cx > line_len) {
-                            E.cx = line_len;
+                        EditorLine *line = (E->cy < E->lines.size) ? &E->lines.elements[E->cy] : NULL;
+                        long long line_len = line ? (long long)line->len : 0;
+                        if (E->cx > line_len) {
+                            E->cx = line_len;
                         }
                         cursor_moved = true;
                     } else if (event.bstate & BUTTON4_PRESSED) {
-                        for (int i = 0; i < 3; ++i) {
-                            editor_move_cursor(KEY_UP);
-                        }
+                        editor_jump_rows(-3);
                         cursor_moved = true;
                     } else if (event.bstate & BUTTON5_PRESSED) {
-                        for (int i = 0; i < 3; ++i) {
-                            editor_move_cursor(KEY_DOWN);
-                        }
+                        editor_jump_rows(3);
                         cursor_moved = true;
                     }
                 }
@@ -314,143 +541,168 @@ void editor_process_keypress() {
             break;
     }
 
-    if (E.dirty || cursor_moved || original_cx != E.cx || original_cy != E.cy || time(NULL) - status_message_time < 5) {
-        editor_refresh_screen();
+    if (E->dirty || cursor_moved || original_cx != E->cx || original_cy != E->cy || time(NULL) - status_message_time < 5) {
+        editor_request_redraw();
     }
 }
 
+bool editor_check_read_only() {
+    if (E->read_only == NULL) return false;
+    editor_set_status_message("%s", E->read_only);
+    return true;
+}
+
 void editor_insert_char(int c) {
-    EditorAction action = { .type = ACTION_INSERT_CHAR, .row = E.cy, .col = E.cx, .character = (char)c };
+    if (editor_check_read_only()) return;
+    journal_record(JOURNAL_INSERT_CHAR, E->cy, E->cx, c);
+    EditorAction action = { .type = ACTION_INSERT_CHAR, .row = E->cy, .col = E->cx, .character = (char)c };
     editor_record_action(action);
-    if (E.cy == E.lines.size) {
+    if (E->cy == E->lines.size) {
         EditorLine new_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
         if (new_line.text == NULL) {
             editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to prepare new line for character insertion.");
             return;
         }
-        editor_lines_array_append(&E.lines, new_line);
+        editor_lines_array_append(&E->lines, new_line);
     }
 
-    EditorLine *line = &E.lines.elements[E.cy];
+    EditorLine *line = &E->lines.elements[E->cy];
+    editor_line_make_writable(line);
     line->text = realloc(line->text, line->len + 2);
     if (line->text == NULL) {
-        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory for line %d.", E.cy);
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory for line %lld.", E->cy);
         return;
     }
-    memmove(&line->text[E.cx + 1], &line->text[E.cx], line->len - E.cx + 1);
-    line->text[E.cx] = c;
+    memmove(&line->text[E->cx + 1], &line->text[E->cx], line->len - E->cx + 1);
+    line->text[E->cx] = c;
     line->len++;
-    E.cx++;
-    E.dirty = 1;
+    editor_line_mark_modified(line, line->len - 1);
+    E->cx++;
+    E->dirty = 1;
 
-    editor_update_syntax(E.cy);
+    editor_update_syntax(E->cy);
 }
 
 int editor_insert_newline() {
-    EditorAction action = { .type = ACTION_INSERT_NEWLINE, .row = E.cy, .col = E.cx };
+    if (editor_check_read_only()) return -1;
+    journal_record(JOURNAL_INSERT_NEWLINE, E->cy, E->cx, 0);
+    EditorAction action = { .type = ACTION_INSERT_NEWLINE, .row = E->cy, .col = E->cx };
     editor_record_action(action);
-    if (E.lines.size == 0) {
+    if (E->lines.size == 0) {
         EditorLine new_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
         if (new_line.text == NULL) {
             editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory for initial line text.");
             return -1;
         }
-        editor_lines_array_append(&E.lines, new_line);
-        E.cy = 0;
-        E.cx = 0;
-        E.dirty = 1;
+        editor_lines_array_append(&E->lines, new_line);
+        E->cy = 0;
+        E->cx = 0;
+        E->dirty = 1;
         editor_update_syntax(0);
         return 0;
     }
 
-    EditorLine new_line = { .text = NULL, .len = 0, .hl = NULL, .hl_open_comment = 0 };
-    editor_lines_array_insert(&E.lines, E.cy + 1, new_line);
-
-    E.lines.elements[E.cy].hl = NULL;
-    E.lines.elements[E.cy].hl_open_comment = 0;
-
-    if (E.cx == 0) {
-        E.lines.elements[E.cy].text = strdup("");
-        if (E.lines.elements[E.cy].text == NULL) {
+    if (E->cx == 0) {
+        // Splitting at column 0 just opens an empty line above; the current
+        // line moves down untouched, so it stays clean for incremental saves.
+        EditorLine empty_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
+        if (empty_line.text == NULL) {
             editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory for new empty line text.");
             return -1;
         }
-        E.lines.elements[E.cy].len = 0;
+        // An empty line passes its comment state straight through.
+        if (E->cy > 0) empty_line.hl_open_comment = E->lines.elements[E->cy - 1].hl_open_comment;
+        editor_lines_array_insert(&E->lines, E->cy, empty_line);
     } else {
-        EditorLine *current_line = &E.lines.elements[E.cy];
-        E.lines.elements[E.cy + 1].len = current_line->len - E.cx;
-        E.lines.elements[E.cy + 1].text = strdup(&current_line->text[E.cx]);
-        if (E.lines.elements[E.cy + 1].text == NULL) {
+        EditorLine new_line = { .text = NULL, .len = 0, .hl = NULL, .hl_open_comment = 0 };
+        editor_lines_array_insert(&E->lines, E->cy + 1, new_line);
+
+        EditorLine *current_line = &E->lines.elements[E->cy];
+        editor_line_make_writable(current_line);
+        E->lines.elements[E->cy + 1].len = current_line->len - E->cx;
+        E->lines.elements[E->cy + 1].text = strdup(&current_line->text[E->cx]);
+        if (E->lines.elements[E->cy + 1].text == NULL) {
             editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory for split line text.");
             return -1;
         }
-        E.lines.elements[E.cy + 1].hl = NULL;
-        E.lines.elements[E.cy + 1].hl_open_comment = 0;
+        E->lines.elements[E->cy + 1].hl = NULL;
+        editor_line_mark_modified(&E->lines.elements[E->cy + 1], 0);
+        // The tail inherits the state the following line was lexed against,
+        // so editor_update_syntax notices if the split changes it.
+        E->lines.elements[E->cy + 1].hl_open_comment = current_line->hl_open_comment;
 
-        current_line->text = realloc(current_line->text, E.cx + 1);
+        current_line->text = realloc(current_line->text, E->cx + 1);
         if (current_line->text == NULL) {
             editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory for truncated line.");
             return -1;
         }
-        current_line->text[E.cx] = '\0';
-        current_line->len = E.cx;
+        current_line->text[E->cx] = '\0';
+        current_line->len = E->cx;
+        editor_line_mark_modified(current_line, E->cx + E->lines.elements[E->cy + 1].len);
     }
 
-    E.cy++;
-    E.cx = 0;
-    E.dirty = 1;
+    E->cy++;
+    E->cx = 0;
+    E->dirty = 1;
 
-    editor_update_syntax(E.cy - 1);
-    editor_update_syntax(E.cy);
+    editor_update_syntax(E->cy - 1);
+    editor_update_syntax(E->cy);
 
     return 0;
 }
 
 void editor_del_char() {
-    EditorAction action = { .type = ACTION_DELETE_CHAR, .row = E.cy, .col = E.cx };
-    if (E.cx > 0) {
-        action.character = E.lines.elements[E.cy].text[E.cx - 1];
+    if (editor_check_read_only()) return;
+    journal_record(E->select_all_active ? JOURNAL_CLEAR_ALL : JOURNAL_DELETE_CHAR, E->cy, E->cx, 0);
+    // Nothing before the cursor: no change, so nothing to undo either.
+    if (!E->select_all_active && (E->cy >= E->lines.size || (E->cx == 0 && E->cy == 0))) return;
+
+    EditorAction action = { .type = ACTION_DELETE_CHAR, .row = E->cy, .col = E->cx };
+    if (E->cy < E->lines.size) editor_line_page_in(&E->lines.elements[E->cy]);
+    if (E->cy > 0 && E->cy <= E->lines.size) editor_line_page_in(&E->lines.elements[E->cy - 1]);
+    if (E->cx > 0) {
+        action.character = E->lines.elements[E->cy].text[E->cx - 1];
     } else {
         action.type = ACTION_DELETE_LINE;
-        action.line_content = strdup(E.lines.elements[E.cy].text);
-        action.line_len = E.lines.elements[E.cy].len;
+        action.line_content = strdup(E->lines.elements[E->cy].text);
+        action.line_len = E->lines.elements[E->cy].len;
     }
     editor_record_action(action);
-    if (E.select_all_active) {
-        free_editor_lines_array(&E.lines);
-        init_editor_lines_array(&E.lines);
+    if (E->select_all_active) {
+        free_editor_lines_array(&E->lines);
+        init_editor_lines_array(&E->lines);
         EditorLine new_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
         if (new_line.text == NULL) {
             editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (clear all text).");
         }
-        editor_lines_array_append(&E.lines, new_line);
-        E.cx = 0;
-        E.cy = 0;
-        E.dirty = 1;
-        E.select_all_active = 0;
+        editor_lines_array_append(&E->lines, new_line);
+        E->cx = 0;
+        E->cy = 0;
+        E->dirty = 1;
+        E->select_all_active = 0;
         editor_update_syntax(0);
         editor_set_status_message("All text deleted.");
         return;
     }
 
-    if (E.cy == E.lines.size || E.lines.size == 0) return;
-    if (E.cx == 0 && E.cy == 0 && E.lines.elements[0].len == 0) return;
-
-    EditorLine *line = &E.lines.elements[E.cy];
-    if (E.cx > 0) {
-        memmove(&line->text[E.cx - 1], &line->text[E.cx], line->len - E.cx + 1);
+    EditorLine *line = &E->lines.elements[E->cy];
+    if (E->cx > 0) {
+        editor_line_make_writable(line);
+        memmove(&line->text[E->cx - 1], &line->text[E->cx], line->len - E->cx + 1);
         line->len--;
+        editor_line_mark_modified(line, line->len + 1);
         line->text = realloc(line->text, line->len + 1);
         if (line->text == NULL) {
             editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (del char realloc).");
             return;
         }
-        E.cx--;
-        E.dirty = 1;
-        editor_update_syntax(E.cy);
+        E->cx--;
+        E->dirty = 1;
+        editor_update_syntax(E->cy);
     } else {
-        if (E.cy > 0) {
-            EditorLine *prev_line = &E.lines.elements[E.cy - 1];
+        if (E->cy > 0) {
+            EditorLine *prev_line = &E->lines.elements[E->cy - 1];
+            editor_line_make_writable(prev_line);
             prev_line->text = realloc(prev_line->text, prev_line->len + line->len + 1);
             if (prev_line->text == NULL) {
                 editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (merge line realloc).");
@@ -459,331 +711,917 @@ void editor_del_char() {
             memcpy(&prev_line->text[prev_line->len], line->text, line->len);
             prev_line->len += line->len;
             prev_line->text[prev_line->len] = '\0';
+            prev_line->hl_open_comment = line->hl_open_comment;
+            editor_line_mark_modified(prev_line, prev_line->len - line->len);
 
-            editor_lines_array_delete(&E.lines, E.cy);
+            editor_lines_array_delete(&E->lines, E->cy);
 
-            if (E.lines.size == 0) {
+            if (E->lines.size == 0) {
                 EditorLine new_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
                 if (new_line.text == NULL) {
                     editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (empty file text).");
                 }
-                editor_lines_array_append(&E.lines, new_line);
-                E.cx = 0;
-                E.cy = 0;
+                editor_lines_array_append(&E->lines, new_line);
+                E->cx = 0;
+                E->cy = 0;
                 editor_update_syntax(0);
             } else {
-                E.cx = prev_line->len;
-                E.cy--;
-                editor_update_syntax(E.cy);
+                E->cx = prev_line->len;
+                E->cy--;
+                editor_update_syntax(E->cy);
             }
-            E.dirty = 1;
+            E->dirty = 1;
         }
     }
 }
 
-void editor_undo() {
-    if (E.undo_history_idx <= 0) {
-        editor_set_status_message("Nothing to undo.");
-        return;
-    }
-
-    E.undo_history_idx--;
-    EditorAction last_action = E.undo_history[E.undo_history_idx];
-
-    E.recording_actions = false; // Temporarily disable recording
+// Rows spliced in are lexed together; the row after them was lexed against
+// whatever came before and may now start in a different comment state.
+static void editor_highlight_spliced_rows(long long first, long long count) {
+    editor_update_syntax_rows(first, first + count);
+    if (first + count < E->lines.size) editor_update_syntax(first + count);
+}
 
-    switch (last_action.type) {
+// Reverts one recorded action. Text the action owned and handed back to
+// the buffer is cleared from it, so freeing the action later is safe.
+static void editor_undo_action(EditorAction *action) {
+    switch (action->type) {
         case ACTION_INSERT_CHAR:
             // Undo insert char: delete char at recorded position
             // Need to adjust cursor to recorded position first
-            E.cy = last_action.row;
-            E.cx = last_action.col;
+            E->cy = action->row;
+            E->cx = action->col;
             // Perform the deletion without recording it
-            EditorLine *line_to_delete_from = &E.lines.elements[E.cy];
-            memmove(&line_to_delete_from->text[E.cx], &line_to_delete_from->text[E.cx + 1], line_to_delete_from->len - E.cx);
+            EditorLine *line_to_delete_from = &E->lines.elements[E->cy];
+            editor_line_make_writable(line_to_delete_from);
+            memmove(&line_to_delete_from->text[E->cx], &line_to_delete_from->text[E->cx + 1], line_to_delete_from->len - E->cx);
             line_to_delete_from->len--;
+            editor_line_mark_modified(line_to_delete_from, line_to_delete_from->len + 1);
             line_to_delete_from->text = realloc(line_to_delete_from->text, line_to_delete_from->len + 1);
-            E.dirty = 1;
-            editor_update_syntax(E.cy);
+            E->dirty = 1;
+            editor_update_syntax(E->cy);
             break;
         case ACTION_DELETE_CHAR:
             // Undo delete char: insert char at recorded position
             // Need to adjust cursor to recorded position first
-            E.cy = last_action.row;
-            E.cx = last_action.col;
+            E->cy = action->row;
+            E->cx = action->col;
             // Perform the insertion without recording it
-            EditorLine *line_to_insert_into = &E.lines.elements[E.cy];
+            EditorLine *line_to_insert_into = &E->lines.elements[E->cy];
+            editor_line_make_writable(line_to_insert_into);
             line_to_insert_into->text = realloc(line_to_insert_into->text, line_to_insert_into->len + 2);
-            memmove(&line_to_insert_into->text[E.cx + 1], &line_to_insert_into->text[E.cx], line_to_insert_into->len - E.cx + 1);
-            line_to_insert_into->text[E.cx] = last_action.character;
+            memmove(&line_to_insert_into->text[E->cx + 1], &line_to_insert_into->text[E->cx], line_to_insert_into->len - E->cx + 1);
+            line_to_insert_into->text[E->cx] = action->character;
             line_to_insert_into->len++;
-            E.dirty = 1;
-            editor_update_syntax(E.cy);
+            editor_line_mark_modified(line_to_insert_into, line_to_insert_into->len - 1);
+            E->dirty = 1;
+            editor_update_syntax(E->cy);
             break;
         case ACTION_INSERT_NEWLINE:
             // Undo insert newline: delete the newline at the recorded position
-            E.cy = last_action.row;
-            E.cx = last_action.col;
+            E->cy = action->row;
+            E->cx = action->col;
             // Perform the deletion without recording it
-            if (E.cy < E.lines.size - 1) { // If not the last line
-                EditorLine *current_line = &E.lines.elements[E.cy];
-                EditorLine *next_line = &E.lines.elements[E.cy + 1];
+            if (E->cy < E->lines.size - 1) { // If not the last line
+                EditorLine *current_line = &E->lines.elements[E->cy];
+                EditorLine *next_line = &E->lines.elements[E->cy + 1];
+                editor_line_make_writable(current_line);
+                editor_line_page_in(next_line);
 
                 current_line->text = realloc(current_line->text, current_line->len + next_line->len + 1);
                 memcpy(&current_line->text[current_line->len], next_line->text, next_line->len);
                 current_line->len += next_line->len;
                 current_line->text[current_line->len] = '\0';
+                current_line->hl_open_comment = next_line->hl_open_comment;
+                editor_line_mark_modified(current_line, current_line->len - next_line->len);
 
-                editor_lines_array_delete(&E.lines, E.cy + 1);
-                E.dirty = 1;
-                editor_update_syntax(E.cy);
+                editor_lines_array_delete(&E->lines, E->cy + 1);
+                E->dirty = 1;
+                editor_update_syntax(E->cy);
             }
             break;
         case ACTION_DELETE_LINE:
-            // Undo delete line: insert line with recorded content
+            // Undo delete line: split the joined text back off the end of
+            // the line above, then insert the line with recorded content
             {
-                EditorLine new_line = { .text = last_action.line_content, .len = last_action.line_len, .hl = NULL, .hl_open_comment = 0 };
-                editor_lines_array_insert(&E.lines, last_action.row, new_line);
-                E.cy = last_action.row;
-                E.cx = last_action.col;
-                E.dirty = 1;
-                editor_update_syntax(E.cy);
+                if (action->row > 0 && action->row <= E->lines.size) {
+                    EditorLine *prev_line = &E->lines.elements[action->row - 1];
+                    if (prev_line->len >= action->line_len) {
+                        editor_line_make_writable(prev_line);
+                        prev_line->len -= action->line_len;
+                        prev_line->text[prev_line->len] = '\0';
+                        editor_line_mark_modified(prev_line, prev_line->len + action->line_len);
+                        editor_update_syntax(action->row - 1);
+                    }
+                }
+                EditorLine new_line = { .text = action->line_content, .len = action->line_len, .hl = NULL, .hl_open_comment = 0 };
+                editor_lines_array_insert(&E->lines, action->row, new_line);
+                action->line_content = NULL; // now owned by the line
+                E->cy = action->row;
+                E->cx = action->col;
+                E->dirty = 1;
+                editor_update_syntax(E->cy);
+            }
+            break;
+        case ACTION_REPLACE_LINES:
+            // Undo replace: put back the old text of every rewritten line
+            for (long long i = action->change_count - 1; i >= 0; i--) {
+                EditorLineChange *change = &action->changes[i];
+                free(editor_line_replace_text(&E->lines.elements[change->row], change->text, change->len));
+                editor_update_syntax(change->row);
+            }
+            free(action->changes);
+            action->changes = NULL;
+            action->change_count = 0;
+            E->cy = action->row;
+            E->cx = action->col;
+            E->dirty = 1;
+            break;
+        case ACTION_SPLICE_LINES: {
+            // Undo splice: put the lines taken out back in place of the new ones
+            long long restored = action->removed.size;
+            editor_lines_array_splice(&E->lines, action->row, action->line_count, &action->removed, NULL);
+            free_editor_lines_array(&action->removed);
+            editor_highlight_spliced_rows(action->row, restored);
+            E->cy = action->row < E->lines.size ? action->row : E->lines.size - 1;
+            E->cx = 0;
+            E->dirty = 1;
+            break;
+        }
+        case ACTION_GROUP:
+            for (long long i = action->group_len - 1; i >= 0; i--) {
+                editor_undo_action(&action->group[i]);
             }
             break;
         default:
             editor_set_status_message("Undo: Unknown action type.");
             break;
     }
+}
+
+void editor_undo() {
+    if (editor_check_read_only()) return;
+    EditorAction *action;
+    if (E->grouping_actions) {
+        // Inside a group (a macro that presses Ctrl+Z) the group's own
+        // latest action is the one to take back.
+        if (E->open_group_len == 0) {
+            editor_set_status_message("Nothing to undo.");
+            return;
+        }
+        action = &E->open_group[E->open_group_len - 1];
+    } else {
+        if (E->undo_history_idx <= 0) {
+            editor_set_status_message("Nothing to undo.");
+            return;
+        }
+        action = &E->undo_history[E->undo_history_idx - 1];
+    }
+
+    journal_record(JOURNAL_UNDO, E->cy, E->cx, 0);
+    E->cursor_edit_open = false;
+    E->recording_actions = false; // Temporarily disable recording
+    editor_undo_action(action);
+    if (E->grouping_actions) {
+        editor_free_action(action);
+        E->open_group_len--;
+    } else {
+        E->undo_history_idx--;
+    }
 
     editor_set_status_message("Undo successful.");
-    editor_refresh_screen();
+    editor_request_redraw();
 
-    E.recording_actions = true; // Re-enable recording
+    E->recording_actions = true; // Re-enable recording
 }
 
-void editor_find() {
-    char *query = editor_prompt("Search (Use arrows to navigate, ESC to cancel): %s",
-                                 E.search_query ? E.search_query : "");
+// A query written as /pattern/flags is a regular expression; the flags are
+// i (ignore case) and w (whole words). Anything else is searched literally.
+static const char *editor_query_regex_flags(const char *query) {
+    const char *close = strlen(query) > 1 && query[0] == '/' ? strrchr(query, '/') : NULL;
+    if (close == NULL || close == query || strspn(close + 1, "iw") != strlen(close + 1)) return NULL;
+    return close;
+}
 
-    if (query == NULL) {
-        editor_set_status_message("");
-        E.find_active = false;
-        for (int i = 0; i < E.lines.size; i++) {
-            editor_update_syntax(i);
-        }
-        editor_refresh_screen();
-        return;
+SearchPattern *editor_compile_query(const char *query, const char **error) {
+    const char *close = editor_query_regex_flags(query);
+    if (close == NULL) return search_compile(query, 0, error);
+
+    int flags = SEARCH_REGEX;
+    if (strchr(close + 1, 'i')) flags |= SEARCH_IGNORE_CASE;
+    if (strchr(close + 1, 'w')) flags |= SEARCH_WHOLE_WORD;
+    char *pattern = strndup(query + 1, close - query - 1);
+    if (pattern == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (search pattern).");
+        return NULL;
     }
+    SearchPattern *compiled = search_compile(pattern, flags, error);
+    free(pattern);
+    return compiled;
+}
 
-    if (E.search_query) {
-        if (strcmp(E.search_query, query) != 0) {
-            free(E.search_query);
-            E.search_query = query;
-            E.last_match_row = -1;
-            E.last_match_col = -1;
-        } else {
-            free(query);
+// Incremental search. Each change to the query re-highlights the visible
+// rows at once; the rest of the buffer is then scanned while the prompt is
+// idle, in order from the cursor, and the scan stops as soon as a key is
+// queued. When a literal query is extended, only rows that matched the
+// previous query (plus any it had not reached yet) are checked again.
+
+#define FIND_PROMPT "Search (/regex/iw for patterns, arrows to navigate, ESC to cancel): %s"
+#define ISEARCH_CHECK_INTERVAL 256
+
+static struct {
+    char *query;              // query the scan is for; NULL until the first key
+    SearchPattern *pattern;   // NULL for an empty or invalid query
+    const char *error;
+    long long origin_cy, origin_cx, origin_row_offset, origin_col_offset;
+    long long *rows;          // matching rows found so far, in scan order
+    long long row_count, row_capacity;
+    long long *domain;        // rows left over from the previous query
+    long long domain_len, domain_pos;
+    long long next_k;         // next row to scan, counted from origin_cy
+    int moved;                // the cursor sits on a match of this query
+    int done;
+} isearch;
+
+static void editor_isearch_push(long long **list, long long *count, long long *capacity, long long row) {
+    if (*count == *capacity) {
+        long long new_capacity = *capacity ? *capacity * 2 : 256;
+        long long *grown = realloc(*list, new_capacity * sizeof(long long));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (search results).");
+            return;
         }
-    } else {
-        E.search_query = query;
-        E.last_match_row = -1;
-        E.last_match_col = -1;
+        *list = grown;
+        *capacity = new_capacity;
     }
+    (*list)[(*count)++] = row;
+}
 
-    E.find_active = true;
-    editor_find_next(1);
+static void editor_isearch_highlight_visible() {
+    // Nothing is drawn while a macro replays.
+    if (editor_macro_replaying()) return;
+    for (long long r = E->row_offset; r < E->row_offset + E->screen_rows && r < E->lines.size; r++) {
+        editor_update_syntax(r);
+    }
 }
 
-void editor_find_next(int direction) {
-    if (E.search_query == NULL) return;
+static void editor_isearch_move_to(long long row, long long col) {
+    E->cy = row;
+    E->cx = col;
+    editor_scroll();
+    editor_isearch_highlight_visible();
+    editor_refresh_screen();
+}
 
-    int current_row = E.last_match_row;
-    int current_col = E.last_match_col;
+static void editor_isearch_restore_origin() {
+    E->cy = isearch.origin_cy;
+    E->cx = isearch.origin_cx;
+    E->row_offset = isearch.origin_row_offset;
+    E->col_offset = isearch.origin_col_offset;
+}
 
-    if (current_row == -1) {
-        current_row = E.cy;
-        current_col = E.cx;
-        E.search_direction = direction;
+static void editor_isearch_set_query(const char *buffer) {
+    if (isearch.query && strcmp(isearch.query, buffer) == 0) return;
+
+    SearchPattern *pattern = NULL;
+    isearch.error = NULL;
+    if (*buffer) pattern = editor_compile_query(buffer, &isearch.error);
+
+    int refine = pattern && isearch.pattern && isearch.query &&
+                 !editor_query_regex_flags(buffer) && !editor_query_regex_flags(isearch.query) &&
+                 strstr(buffer, isearch.query) != NULL;
+    if (refine) {
+        // Earlier matches, then whatever the previous scan had not reached.
+        long long *domain = isearch.rows;
+        long long len = isearch.row_count;
+        long long capacity = isearch.row_capacity;
+        for (long long i = isearch.domain_pos; i < isearch.domain_len; i++) {
+            editor_isearch_push(&domain, &len, &capacity, isearch.domain[i]);
+        }
+        free(isearch.domain);
+        isearch.domain = domain;
+        isearch.domain_len = len;
+        isearch.rows = NULL;
+        isearch.row_capacity = 0;
     } else {
-        current_col += direction;
+        isearch.domain_len = 0;
+        isearch.next_k = 0;
     }
+    isearch.domain_pos = 0;
+    isearch.row_count = 0;
+
+    free(isearch.query);
+    isearch.query = strdup(buffer);
+    search_free(isearch.pattern);
+    isearch.pattern = pattern;
+    E->search_pattern = pattern;
+    isearch.moved = 0;
+    isearch.done = pattern == NULL || E->lines.size == 0;
+
+    if (pattern == NULL) editor_isearch_restore_origin();
+    editor_isearch_highlight_visible();
+}
 
-    int query_len = strlen(E.search_query);
-    int original_row = current_row;
-    int original_col = current_col;
+static void editor_isearch_finish() {
+    isearch.done = 1;
+    if (!isearch.moved && isearch.row_count > 0) {
+        size_t start, end;
+        EditorLine *line = &E->lines.elements[isearch.rows[0]];
+        editor_line_page_in(line);
+        if (search_next(isearch.pattern, line->text, line->len, 0, &start, &end)) {
+            isearch.moved = 1;
+            editor_isearch_move_to(isearch.rows[0], start);
+        }
+    }
+    if (isearch.row_count == 0) {
+        editor_isearch_restore_origin();
+        editor_isearch_highlight_visible();
+    }
+    editor_set_status_message(FIND_PROMPT " [%lld matching lines]", isearch.query, isearch.row_count);
+    editor_refresh_screen();
+}
 
-    while (1) {
-        if (current_row < 0 || current_row >= E.lines.size) break;
+static void editor_isearch_scan() {
+    long long size = E->lines.size;
+    unsigned long long steps = 0;
+    while (!isearch.done) {
+        if ((++steps & (ISEARCH_CHECK_INTERVAL - 1)) == 0) {
+            if (editor_input_pending()) return;
+            editor_swap_trim(&E->lines);
+        }
 
-        EditorLine *line = &E.lines.elements[current_row];
-        char *match = NULL;
+        long long row;
+        long long k;
+        if (isearch.domain_pos < isearch.domain_len) {
+            row = isearch.domain[isearch.domain_pos++];
+            k = (row - isearch.origin_cy + size) % size;
+        } else if (isearch.next_k < size) {
+            k = isearch.next_k++;
+            row = (isearch.origin_cy + k) % size;
+        } else {
+            editor_isearch_finish();
+            return;
+        }
 
-        if (direction == 1) {
-            if ((size_t)current_col >= line->len) {
-                current_row++;
-                current_col = 0;
+        EditorLine *line = &E->lines.elements[row];
+        editor_line_page_in(line);
+        size_t start, end;
+        if (!search_next(isearch.pattern, line->text, line->len, 0, &start, &end)) continue;
+        editor_isearch_push(&isearch.rows, &isearch.row_count, &isearch.row_capacity, row);
+
+        if (!isearch.moved) {
+            // On the starting row only matches at or after the cursor count
+            // the first time round.
+            if (k == 0 && (long long)start < isearch.origin_cx &&
+                !search_next(isearch.pattern, line->text, line->len, isearch.origin_cx, &start, &end)) {
                 continue;
             }
-            match = strstr(line->text + current_col, E.search_query);
-        } else {
-            if (current_col < 0) {
-                current_row--;
-                if (current_row < 0) break;
-                current_col = E.lines.elements[current_row].len - 1;
-            for (int i = current_col; i >= 0; i--) {
-                if ((size_t)i + query_len <= line->len && strncmp(line->text + i, E.search_query, query_len) == 0) {
-                    match = line->text + i;
-                    break;
-                }
-            }
+            isearch.moved = 1;
+            editor_isearch_move_to(row, start);
         }
     }
+}
 
-    if (match) {
-        E.cy = current_row;
-        E.cx = match - line->text;
-        E.last_match_row = E.cy;
-        E.last_match_col = E.cx;
-        editor_set_status_message("Found '%s' at %d:%d", E.search_query, E.cy + 1, E.cx + 1);
-        editor_refresh_screen();
+static void editor_isearch_callback(const char *buffer, int key) {
+    if (key != 0) {
+        editor_isearch_set_query(buffer);
+    } else if (!isearch.done) {
+        editor_isearch_scan();
+    }
+}
+
+void editor_find() {
+    char *previous_query = E->search_query;
+    SearchPattern *previous_pattern = E->search_pattern;
+    isearch.origin_cy = E->cy < E->lines.size ? E->cy : (E->lines.size > 0 ? E->lines.size - 1 : 0);
+    isearch.origin_cx = E->cx;
+    isearch.origin_row_offset = E->row_offset;
+    isearch.origin_col_offset = E->col_offset;
+    isearch.done = 1;
+    E->search_pattern = NULL;
+    E->find_active = true;
+
+    char *query = editor_prompt_with_callback(FIND_PROMPT, editor_isearch_callback);
+
+    SearchPattern *pattern = isearch.pattern;
+    int moved = isearch.moved && query && isearch.query && strcmp(query, isearch.query) == 0;
+    const char *error = isearch.error;
+    free(isearch.query);
+    free(isearch.rows);
+    free(isearch.domain);
+    isearch.query = NULL;
+    isearch.pattern = NULL;
+    isearch.rows = NULL;
+    isearch.domain = NULL;
+    isearch.row_count = isearch.row_capacity = isearch.domain_len = isearch.domain_pos = 0;
+
+    if (query == NULL || pattern == NULL) {
+        search_free(pattern);
+        E->search_query = previous_query;
+        E->search_pattern = previous_pattern;
+        E->find_active = false;
+        editor_isearch_restore_origin();
+        if (query != NULL) {
+            editor_set_status_message("Invalid pattern: %s", error ? error : "empty");
+            editor_macro_search_failed();
+        }
+        free(query);
+        editor_update_syntax_all();
+        editor_request_redraw();
         return;
     }
 
-    if (direction == 1) {
-        current_row++;
-        current_col = 0;
+    free(previous_query);
+    search_free(previous_pattern);
+    E->search_query = query;
+    E->search_pattern = pattern;
+    if (moved) {
+        E->last_match_row = E->cy;
+        E->last_match_col = E->cx;
+        editor_set_status_message("Found '%s' at %lld:%lld", E->search_query, E->cy + 1, E->cx + 1);
+        editor_request_redraw();
     } else {
-        current_row--;
-        current_col = E.lines.elements[current_row].len - 1;
+        // The background scan did not get that far; finish the search here.
+        editor_isearch_restore_origin();
+        E->last_match_row = -1;
+        E->last_match_col = -1;
+        editor_find_next(1);
     }
+}
 
-    if (current_row >= E.lines.size) {
-        current_row = 0;
-        current_col = 0;
-    } else if (current_row < 0) {
-        current_row = E.lines.size - 1;
-        current_col = E.lines.elements[current_row].len - 1;
+// How many lines the search scans between checks for a queued ESC/Ctrl+C.
+#define SEARCH_CANCEL_CHECK_INTERVAL 4096
+
+// Visits every line once, starting at the cursor (or just past the last
+// match) and wrapping around, then the starting line again for the part
+// that was skipped.
+void editor_find_next(int direction) {
+    if (E->search_pattern == NULL || E->lines.size == 0) return;
+
+    long long row = E->last_match_row;
+    long long col = E->last_match_col;
+    if (row == -1 || row >= E->lines.size) {
+        row = E->cy < E->lines.size ? E->cy : E->lines.size - 1;
+        col = E->cx;
+        E->search_direction = direction;
+    } else {
+        col += direction;
     }
 
-    if (current_row == original_row && current_col == original_col) {
-        break;
+    int wrapped = 0;
+    for (long long steps = 0; steps <= E->lines.size; steps++) {
+        if (steps > 0 && (steps & (SEARCH_CANCEL_CHECK_INTERVAL - 1)) == 0) {
+            if (editor_input_cancel_requested()) {
+                editor_set_status_message("Search cancelled.");
+                editor_request_redraw();
+                return;
+            }
+            // No line text is held here, so lines scanned so far can go.
+            editor_swap_trim(&E->lines);
+        }
+
+        EditorLine *line = &E->lines.elements[row];
+        editor_line_page_in(line);
+        size_t start, end;
+        int found = direction == 1
+            ? col <= (long long)line->len && search_next(E->search_pattern, line->text, line->len, col, &start, &end)
+            : col >= 0 && search_prev(E->search_pattern, line->text, line->len, col, &start, &end);
+
+        // A macro replay goes round the buffer once; matches past the wrap
+        // would make it repeat its edits forever.
+        if (found && wrapped && editor_macro_replaying()) break;
+        if (found) {
+            E->cy = row;
+            E->cx = start;
+            E->last_match_row = E->cy;
+            E->last_match_col = E->cx;
+            editor_set_status_message("Found '%s' at %lld:%lld", E->search_query, E->cy + 1, E->cx + 1);
+            editor_request_redraw();
+            return;
+        }
+
+        if (direction == 1) {
+            if (row + 1 == E->lines.size) wrapped = 1;
+            row = row + 1 < E->lines.size ? row + 1 : 0;
+            col = 0;
+        } else {
+            if (row == 0) wrapped = 1;
+            row = row > 0 ? row - 1 : E->lines.size - 1;
+            col = E->lines.elements[row].len;
+        }
     }
+
+    editor_set_status_message("No more matches for '%s'", E->search_query);
+    E->last_match_row = -1;
+    E->last_match_col = -1;
+    editor_macro_search_failed();
+    editor_request_redraw();
 }
-editor_set_status_message("No more matches for '%s'", E.search_query);
-E.last_match_row = -1;
-E.last_match_col = -1;
-editor_refresh_screen();
+
+// Replace. editor_replace_range finds the matches for a block of rows at a
+// time and rebuilds each line that has any in one pass, spreading the rows
+// over the worker pool, then installs the new lines and re-highlights just
+// those. The old text of every rewritten line goes into a single undo
+// action, so the whole command is undone in one step.
+
+#define REPLACE_BLOCK_LINES 65536
+// Fewer rows than this per task are not worth a thread.
+#define REPLACE_TASK_MIN_LINES 4096
+
+typedef struct {
+    EditorLine *lines;
+    long long block_start, block_len;
+    int task_count;
+    SearchPattern **patterns;  // one per task; a pattern is not thread-safe
+    const char *replacement;
+    size_t replacement_len;
+    long long from_row, from_col, to_row, to_col;
+    int wrapped;               // the range runs past the end back to the top
+    char **new_text;           // per block row; NULL if unchanged
+    size_t *new_len;
+    long long *counts;
+    int *failed;               // per task
+} ReplaceJob;
+
+static int editor_replace_in_range(const ReplaceJob *job, long long row, long long col) {
+    int after_from = row > job->from_row || (row == job->from_row && col >= job->from_col);
+    int before_to = row < job->to_row || (row == job->to_row && col < job->to_col);
+    return job->wrapped ? after_from || before_to : after_from && before_to;
 }
 
-void paste_from_clipboard() {
-    int pipefd[2];
-    pid_t pid;
-    char buffer[1024];
-    ssize_t bytes_read;
-    char *clipboard_tool = NULL;
-    char *argv[3];
-    int tool_found = 0;
+static void editor_replace_task(void *ctx, int task) {
+    ReplaceJob *job = ctx;
+    long long begin = job->block_len * task / job->task_count;
+    long long end = job->block_len * (task + 1) / job->task_count;
+    SearchPattern *pattern = job->patterns[task];
+    size_t *spans = NULL;
+    size_t span_capacity = 0;
+
+    for (long long i = begin; i < end; i++) {
+        long long row = job->block_start + i;
+        EditorLine *line = &job->lines[row];
+        size_t span_count = 0;
+        size_t removed = 0;
+        // The first row is searched from the start of the range, as the
+        // interactive search that found the match did; a scan from column 0
+        // could step over it inside an earlier, overlapping match. Only a
+        // wrapped range that ends on its own first row starts at 0.
+        int first_row = row == job->from_row;
+        size_t from = first_row && !(job->wrapped && row == job->to_row) ? (size_t)job->from_col : 0;
+        size_t start, stop;
+        while (search_next(pattern, line->text, line->len, from, &start, &stop)) {
+            from = stop;
+            if (!editor_replace_in_range(job, row, start)) {
+                if (first_row && from < (size_t)job->from_col) from = job->from_col;
+                continue;
+            }
+            if (span_count + 2 > span_capacity) {
+                size_t new_capacity = span_capacity ? span_capacity * 2 : 64;
+                size_t *grown = realloc(spans, new_capacity * sizeof(size_t));
+                if (grown == NULL) {
+                    job->failed[task] = 1;
+                    free(spans);
+                    return;
+                }
+                spans = grown;
+                span_capacity = new_capacity;
+            }
+            spans[span_count++] = start;
+            spans[span_count++] = stop;
+            removed += stop - start;
+        }
+        if (span_count == 0) continue;
 
-    if (getenv("XDG_SESSION_TYPE") != NULL && strcmp(getenv("XDG_SESSION_TYPE"), "wayland") == 0) {
-        if (access("/usr/bin/wl-paste", X_OK) == 0 || access("/bin/wl-paste", X_OK) == 0) {
-            clipboard_tool = "wl-paste";
-            argv[0] = "wl-paste";
-            argv[1] = NULL;
-            tool_found = 1;
+        size_t len = line->len - removed + span_count / 2 * job->replacement_len;
+        char *text = malloc(len + 1);
+        if (text == NULL) {
+            job->failed[task] = 1;
+            break;
         }
+        char *out = text;
+        size_t copied = 0;
+        for (size_t s = 0; s < span_count; s += 2) {
+            memcpy(out, line->text + copied, spans[s] - copied);
+            out += spans[s] - copied;
+            memcpy(out, job->replacement, job->replacement_len);
+            out += job->replacement_len;
+            copied = spans[s + 1];
+        }
+        memcpy(out, line->text + copied, line->len - copied);
+        text[len] = '\0';
+        job->new_text[i] = text;
+        job->new_len[i] = len;
+        job->counts[i] = span_count / 2;
     }
-    
-    if (!tool_found) {
-        if (access("/usr/bin/xclip", X_OK) == 0 || access("/bin/xclip", X_OK) == 0) {
-            clipboard_tool = "xclip";
-            argv[0] = "xclip";
-            argv[1] = "-o";
-            argv[2] = NULL;
-            tool_found = 1;
+    free(spans);
+}
+
+static void editor_replace_push_change(EditorLineChange **changes, long long *count, long long *capacity, EditorLineChange change) {
+    if (*count == *capacity) {
+        long long new_capacity = *capacity ? *capacity * 2 : 256;
+        EditorLineChange *grown = realloc(*changes, new_capacity * sizeof(EditorLineChange));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (replace undo record).");
+            return;
         }
+        *changes = grown;
+        *capacity = new_capacity;
     }
+    (*changes)[(*count)++] = change;
+}
 
-    if (!tool_found) {
-        editor_handle_error(ERR_CLIPBOARD_TOOL, "Paste error: Neither wl-paste nor xclip found. Please install one.");
-        return;
+// Replaces every match of query that starts in [from, to). When from comes
+// after to, the range wraps: from to the end of the buffer, then the top of
+// the buffer up to to. Returns the number of replacements, or -1 if the
+// query does not compile.
+long long editor_replace_range(const char *query, const char *replacement, long long from_row, long long from_col, long long to_row, long long to_col) {
+    if (editor_check_read_only()) return 0;
+    const char *error = NULL;
+    int wrapped = from_row > to_row || (from_row == to_row && from_col > to_col);
+    long long first = wrapped ? 0 : from_row;
+    long long last = wrapped || to_row >= E->lines.size ? E->lines.size : to_row + 1;
+    long long span = last - first < REPLACE_BLOCK_LINES ? last - first : REPLACE_BLOCK_LINES;
+    int task_count = parallel_worker_count();
+    if (span / REPLACE_TASK_MIN_LINES + 1 < task_count) task_count = span / REPLACE_TASK_MIN_LINES + 1;
+    SearchPattern **patterns = calloc(task_count, sizeof(SearchPattern *));
+    if (patterns == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (replace).");
+        return -1;
+    }
+    for (int t = 0; t < task_count; t++) {
+        patterns[t] = editor_compile_query(query, &error);
+        if (patterns[t] == NULL) {
+            for (int i = 0; i < t; i++) search_free(patterns[i]);
+            free(patterns);
+            return -1;
+        }
     }
 
-    editor_set_status_message("Attempting to paste using %s...", clipboard_tool);
-    editor_refresh_screen();
+    journal_record_replace(from_row, from_col, to_row, to_col, query, replacement);
+
+    ReplaceJob job = {
+        .task_count = task_count,
+        .patterns = patterns,
+        .replacement = replacement,
+        .replacement_len = strlen(replacement),
+        .from_row = from_row, .from_col = from_col,
+        .to_row = to_row, .to_col = to_col,
+        .wrapped = wrapped,
+        .new_text = malloc(REPLACE_BLOCK_LINES * sizeof(char *)),
+        .new_len = malloc(REPLACE_BLOCK_LINES * sizeof(size_t)),
+        .counts = malloc(REPLACE_BLOCK_LINES * sizeof(long long)),
+        .failed = calloc(task_count, sizeof(int)),
+    };
+    if (job.new_text == NULL || job.new_len == NULL || job.counts == NULL || job.failed == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (replace).");
+        return -1;
+    }
 
-    fflush(stdout);
+    EditorLineChange *changes = NULL;
+    long long change_count = 0, change_capacity = 0;
+    long long replaced = 0;
+
+    for (long long block = first; block < last; block += REPLACE_BLOCK_LINES) {
+        job.lines = E->lines.elements;
+        job.block_start = block;
+        job.block_len = last - block < REPLACE_BLOCK_LINES ? last - block : REPLACE_BLOCK_LINES;
+        for (long long i = 0; i < job.block_len; i++) {
+            editor_line_page_in(&E->lines.elements[block + i]);
+            job.new_text[i] = NULL;
+        }
+        parallel_run(task_count, editor_replace_task, &job);
+        for (int t = 0; t < task_count; t++) {
+            if (job.failed[t]) editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (replacing text).");
+        }
 
-    if (pipe(pipefd) == -1) {
-        editor_handle_error(ERR_CLIPBOARD_TOOL, "Paste error: Failed to create pipe.");
-        return;
+        for (long long i = 0; i < job.block_len; i++) {
+            if (job.new_text[i] == NULL) continue;
+            long long row = block + i;
+            EditorLine *line = &E->lines.elements[row];
+            EditorLineChange change = { .row = row, .len = line->len };
+            change.text = editor_line_replace_text(line, job.new_text[i], job.new_len[i]);
+            editor_replace_push_change(&changes, &change_count, &change_capacity, change);
+            editor_update_syntax(row);
+            replaced += job.counts[i];
+        }
+        editor_swap_trim(&E->lines);
     }
 
-    pid = fork();
-    if (pid == -1) {
-        editor_handle_error(ERR_CLIPBOARD_TOOL, "Paste error: Failed to fork process.");
-        close(pipefd[0]);
-        close(pipefd[1]);
+    for (int t = 0; t < task_count; t++) search_free(patterns[t]);
+    free(patterns);
+    free(job.new_text);
+    free(job.new_len);
+    free(job.counts);
+    free(job.failed);
+
+    if (change_count > 0) {
+        EditorAction action = { .type = ACTION_REPLACE_LINES, .row = E->cy, .col = E->cx,
+                                .changes = changes, .change_count = change_count };
+        editor_record_action(action);
+        E->dirty = 1;
+    }
+    return replaced;
+}
+
+#define REPLACE_CONFIRM_PROMPT "Replace this match? (y)es, (n)o, (a)ll remaining, (q)uit"
+
+// Interactive replace: steps through the matches from the cursor to the end
+// of the buffer and round again to where it started. Each (y)es is undone
+// on its own; (a)ll replaces every remaining match as one undo step.
+void editor_replace() {
+    if (editor_check_read_only()) return;
+    char *query = editor_prompt("Replace (/regex/iw for patterns, ESC to cancel): %s");
+    if (query == NULL) return;
+    const char *error = NULL;
+    SearchPattern *pattern = editor_compile_query(query, &error);
+    if (pattern == NULL) {
+        editor_set_status_message("Invalid pattern: %s", error ? error : "empty");
+        free(query);
+        return;
+    }
+    char *replacement = editor_prompt_allow_empty("Replace with: %s");
+    if (replacement == NULL || E->lines.size == 0) {
+        search_free(pattern);
+        free(query);
+        free(replacement);
         return;
     }
 
-    if (pid == 0) {
-        close(pipefd[0]);
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[1]);
+    long long origin_row = E->cy < E->lines.size ? E->cy : E->lines.size - 1;
+    long long origin_col = E->cy < E->lines.size ? E->cx : 0;
+    long long row = origin_row;
+    long long col = origin_col;
+    int wrapped = 0;
+    long long replaced = 0;
+    size_t replacement_len = strlen(replacement);
+
+    for (long long steps = 0;; steps++) {
+        if (steps > 0 && (steps & (SEARCH_CANCEL_CHECK_INTERVAL - 1)) == 0) {
+            if (editor_input_cancel_requested()) break;
+            editor_swap_trim(&E->lines);
+        }
 
-        execvp(clipboard_tool, argv);
-        
-        _exit(1);
-    } else {
-        close(pipefd[1]);
-
-        while ((bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes_read] = '\0';
-            for (int i = 0; i < bytes_read; ++i) {
-                if (buffer[i] == '\n' || buffer[i] == '\r') {
-                    editor_insert_newline();
-                } else if (buffer[i] >= 32 && buffer[i] <= 126) {
-                    editor_insert_char(buffer[i]);
-                }
+        EditorLine *line = &E->lines.elements[row];
+        editor_line_page_in(line);
+        size_t start, end;
+        int found = col <= (long long)line->len && search_next(pattern, line->text, line->len, col, &start, &end);
+        if (found && wrapped && (row > origin_row || (row == origin_row && (long long)start >= origin_col))) break;
+        if (!found) {
+            if (wrapped && row >= origin_row) break;
+            if (row + 1 < E->lines.size) {
+                row++;
+            } else {
+                row = 0;
+                wrapped = 1;
             }
+            col = 0;
+            continue;
         }
-        close(pipefd[0]);
-
-        int status;
-        waitpid(pid, &status, 0);
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-            editor_set_status_message("Pasted from clipboard using %s.", clipboard_tool);
+        E->cy = row;
+        E->cx = start;
+        editor_set_status_message(REPLACE_CONFIRM_PROMPT);
+        editor_refresh_screen();
+        int c = editor_read_key();
+        if (c == 'y' || c == 'Y') {
+            long long before = (long long)line->len;
+            replaced += editor_replace_range(query, replacement, row, start, row, start + 1);
+            // Keep the stopping point on the same text once round.
+            if (wrapped && row == origin_row) origin_col += (long long)E->lines.elements[row].len - before;
+            col = start + replacement_len;
+        } else if (c == 'n' || c == 'N') {
+            col = end;
+        } else if (c == 'a' || c == 'A') {
+            if (!wrapped && row == origin_row && (long long)start == origin_col) {
+                replaced += editor_replace_range(query, replacement, 0, 0, E->lines.size, 0);
+            } else {
+                replaced += editor_replace_range(query, replacement, row, start, origin_row, origin_col);
+            }
+            break;
         } else {
-            editor_set_status_message("Paste error: %s failed or returned an error.", clipboard_tool);
+            break;
+        }
+    }
+
+    editor_set_status_message("Replaced %lld occurrence%s of '%s'", replaced, replaced == 1 ? "" : "s", query);
+    editor_request_redraw();
+    search_free(pattern);
+    free(query);
+    free(replacement);
+}
+
+long long editor_splice_rows(long long first, long long count, const char *text, size_t len) {
+    if (first < 0 || count < 0 || count > E->lines.size - first) return -1;
+    if (editor_check_read_only()) return -1;
+    journal_record_splice(first, count, text, len);
+
+    EditorLinesArray inserted;
+    init_editor_lines_array(&inserted);
+    editor_lines_array_append_buffer(&inserted, text, len, -1);
+    if (inserted.size == 0 && count == E->lines.size) {
+        // Never leave the buffer without a line.
+        EditorLine empty = { .text = strdup(""), .len = 0 };
+        if (empty.text == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (empty file text).");
         }
+        editor_lines_array_append(&inserted, empty);
     }
+    long long inserted_count = inserted.size;
+
+    EditorAction action = { .type = ACTION_SPLICE_LINES, .row = first, .col = 0, .line_count = inserted_count };
+    init_editor_lines_array(&action.removed);
+    editor_lines_array_splice(&E->lines, first, count, &inserted, &action.removed);
+    free_editor_lines_array(&inserted);
+    // A save rewrites the file under lines held by undo without updating
+    // their offsets, so once undone they must not be read back from it.
+    for (long long i = 0; i < action.removed.size; i++) action.removed.elements[i].disk_clean = 0;
+    editor_record_action(action);
+
+    editor_highlight_spliced_rows(first, inserted_count);
+    editor_swap_trim(&E->lines);
+    E->cy = first < E->lines.size ? first : E->lines.size - 1;
+    E->cx = 0;
+    E->dirty = 1;
+    return inserted_count;
+}
+
+// Frees whatever text an action still owns.
+void editor_free_action(EditorAction *action) {
+    free(action->line_content);
+    action->line_content = NULL;
+    for (long long i = 0; i < action->change_count; i++) free(action->changes[i].text);
+    free(action->changes);
+    action->changes = NULL;
+    action->change_count = 0;
+    if (action->removed.elements) free_editor_lines_array(&action->removed);
+    for (long long i = 0; i < action->group_len; i++) editor_free_action(&action->group[i]);
+    free(action->group);
+    action->group = NULL;
+    action->group_len = 0;
+}
+
+static void editor_push_group_action(EditorAction action) {
+    if (E->open_group_len == E->open_group_capacity) {
+        long long capacity = E->open_group_capacity ? E->open_group_capacity * 2 : 64;
+        EditorAction *grown = realloc(E->open_group, capacity * sizeof(EditorAction));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (undo group).");
+            return;
+        }
+        E->open_group = grown;
+        E->open_group_capacity = capacity;
+    }
+    E->open_group[E->open_group_len++] = action;
+}
+
+void editor_begin_action_group() {
+    journal_record(JOURNAL_GROUP_BEGIN, E->cy, E->cx, 0);
+    E->grouping_actions = true;
+    E->cursor_edit_open = false;
+}
+
+void editor_end_action_group() {
+    if (!E->grouping_actions) return;
+    journal_record(JOURNAL_GROUP_END, E->cy, E->cx, 0);
+    E->grouping_actions = false;
+    EditorAction action = { .type = ACTION_GROUP, .group = E->open_group, .group_len = E->open_group_len };
+    E->open_group = NULL;
+    E->open_group_len = 0;
+    E->open_group_capacity = 0;
+    if (action.group_len == 0) {
+        editor_free_action(&action);
+        return;
+    }
+    action.row = action.group[0].row;
+    action.col = action.group[0].col;
+    editor_record_action(action);
 }
 
 void editor_record_action(EditorAction action) {
-    if (!E.recording_actions) {
+    E->cursor_edit_open = false;
+    if (!E->recording_actions) {
+        editor_free_action(&action);
         return;
     }
-    if (E.undo_history_idx < E.undo_history_len) {
-        for (int i = E.undo_history_idx; i < E.undo_history_len; ++i) {
-            // In a real implementation, you'd free any memory associated with these discarded actions
-            // For now, we're just overwriting them.
+    if (E->grouping_actions) {
+        editor_push_group_action(action);
+        return;
+    }
+    if (E->undo_history_idx < E->undo_history_len) {
+        for (int i = E->undo_history_idx; i < E->undo_history_len; ++i) {
+            editor_free_action(&E->undo_history[i]);
         }
-        E.undo_history_len = E.undo_history_idx;
+        E->undo_history_len = E->undo_history_idx;
     }
 
-    if (E.undo_history_len == MAX_UNDO_STATES) {
-        // In a real implementation, you'd free any memory associated with the oldest action
-        // For now, we're just overwriting it.
-        memmove(&E.undo_history[0], &E.undo_history[1], (MAX_UNDO_STATES - 1) * sizeof(EditorAction));
-        E.undo_history_len--;
-        E.undo_history_idx--;
+    if (E->undo_history_len == MAX_UNDO_STATES) {
+        editor_free_action(&E->undo_history[0]);
+        memmove(&E->undo_history[0], &E->undo_history[1], (MAX_UNDO_STATES - 1) * sizeof(EditorAction));
+        E->undo_history_len--;
+        E->undo_history_idx--;
     }
 
-    E.undo_history[E.undo_history_idx] = action;
-    E.undo_history_len++;
-    E.undo_history_idx++;
-
-    E.undo_history_len++;
-    E.undo_history_idx++;
+    E->undo_history[E->undo_history_idx] = action;
+    E->undo_history_len++;
+    E->undo_history_idx++;
 }
\ No newline at end of file
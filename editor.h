@@ -4,8 +4,11 @@
 #include <ncurses.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/stat.h>
 #include "syntax.h"
 #include "editor_lines_array.h"
+#include "search.h"
+#include "journal.h"
 
 #include "editor_actions.h"
 
@@ -14,17 +17,23 @@
 
 typedef struct {
     EditorLinesArray lines;
-    int cx, cy;
+    long long cx, cy;
     int dirty;
 } EditorStateSnapshot;
 
-typedef struct {
+// A position in the buffer; see cursors.h.
+typedef struct EditorCursor {
+    long long row, col;
+} EditorCursor;
+
+typedef struct EditorConfig {
     EditorLinesArray lines;
-    int cx, cy;
-    int row_offset;
-    int col_offset;
+    long long cx, cy;
+    long long row_offset;
+    long long col_offset;
     int screen_rows, screen_cols;
     char *filename;
+    struct stat disk_stat; // file the lines' disk offsets refer to; st_nlink 0 if none
     int dirty;
     int select_all_active;
 
@@ -33,29 +42,71 @@ typedef struct {
     int undo_history_idx;
 
     char *search_query;
+    SearchPattern *search_pattern; // compiled from search_query
     int search_direction; // 1 for forward, -1 for backward
-    int last_match_row;
-    int last_match_col;
+    long long last_match_row;
+    long long last_match_col;
     bool find_active;
     bool recording_actions;
+    bool grouping_actions;      // actions go to open_group until the group ends
+    EditorAction *open_group;
+    long long open_group_len, open_group_capacity;
+    bool headless;              // never drawn, so never highlighted (batch mode)
+    const char *read_only;      // why edits are refused; NULL if they are not
+    EditorCursor *cursors;      // every cursor, sorted, while there are several
+    long long cursor_count, cursor_capacity;
+    long long cursor_primary;   // index of cx, cy in cursors
+    bool cursors_journaled;     // the journal holds the current cursors
+    bool cursor_edit_open;      // the last undo action covers further typing
+
+    EditorSyntax *syntax;       // NULL for plain text
+    long long hl_stale_hint;    // no line before this row waits on the highlighter; -1 if none
+    Journal *journal;
 } EditorConfig;
 
+// The buffer being edited; see buffer.h for the others.
 EditorConfig *get_editor_config();
-extern EditorSyntax *E_syntax;
+// Makes config the buffer the editor works on without touching the buffer
+// list; buffer.h is the way to switch buffers.
+void editor_set_config(EditorConfig *config);
+void init_editor_config(EditorConfig *config);
+// Frees everything the buffer owns except its journal, which must have been
+// stopped.
+void free_editor_config(EditorConfig *config);
 
 
 void init_editor();
 void cleanup_editor();
+void editor_reset_buffer();
 void editor_move_cursor(int key);
-void editor_process_keypress();
+void editor_jump_rows(long long delta);
+void editor_goto();
+// Moves to a line, N% or @byte offset as Ctrl+G does. Returns -1 and sets
+// the status message if target is not one of those.
+int editor_goto_target(const char *target);
+void editor_process_keypress(int c);
+// Returns true, with the reason on the status bar, if the buffer must not
+// be changed. Every editing path asks before it touches the lines.
+bool editor_check_read_only();
 void editor_insert_char(int c);
 int editor_insert_newline();
 void editor_del_char();
 void editor_undo();
 void editor_find();
 void editor_find_next(int direction);
-void paste_from_clipboard();
+// Compiles a search query: /pattern/flags is a regex, anything else literal.
+SearchPattern *editor_compile_query(const char *query, const char **error);
+long long editor_replace_range(const char *query, const char *replacement, long long from_row, long long from_col, long long to_row, long long to_col);
+void editor_replace();
+// Replaces count rows from first with the lines of text, cut up the way a
+// file is on loading, as one undo step. Returns the number of lines put in,
+// or -1 if the rows are not in the buffer or it is read-only.
+long long editor_splice_rows(long long first, long long count, const char *text, size_t len);
 void editor_record_action(EditorAction action);
+// Everything recorded between these two is undone as a single step.
+void editor_begin_action_group();
+void editor_end_action_group();
+void editor_free_action(EditorAction *action);
 void editor_free_snapshot(EditorStateSnapshot *snapshot);
 
 
@@ -2,6 +2,7 @@
 #define EDITOR_ACTIONS_H
 
 #include <stddef.h> // For size_t
+#include "editor_lines_array.h"
 
 // Enum for different types of editor actions
 typedef enum {
@@ -9,17 +10,33 @@ typedef enum {
     ACTION_DELETE_CHAR,
     ACTION_INSERT_NEWLINE,
     ACTION_DELETE_LINE,
+    ACTION_REPLACE_LINES, // a replace command; restores every line it rewrote
+    ACTION_GROUP,         // several actions undone as one step (macro replay)
+    ACTION_SPLICE_LINES,  // a run of lines swapped for others (filter command)
     // Add more action types as needed
 } EditorActionType;
 
-// Structure to represent a single editor action
+// Former contents of one line rewritten by a replace.
 typedef struct {
+    long long row;
+    char *text;
+    size_t len;
+} EditorLineChange;
+
+// Structure to represent a single editor action
+typedef struct EditorAction {
     EditorActionType type;
-    int row;
-    int col;
+    long long row;
+    long long col;
     char character; // For insert/delete char
     char *line_content; // For delete line (stores content of deleted line)
     size_t line_len; // For delete line (stores length of deleted line)
+    EditorLineChange *changes; // For replace lines, in ascending row order
+    long long change_count;
+    struct EditorAction *group; // For a group, in the order they happened
+    long long group_len;
+    EditorLinesArray removed; // For splice lines, the lines taken out
+    long long line_count;     // For splice lines, how many lines went in
 } EditorAction;
 
 #endif // EDITOR_ACTIONS_H
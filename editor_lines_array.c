@@ -1,10 +1,25 @@
 #include "editor_lines_array.h"
 #include "error_handler.h"
+#include "intern.h"
+#include "parallel.h"
+#include "swap.h"
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define EDITOR_LINES_ARRAY_INIT_CAPACITY 8
 
+// Versions let results computed off the main thread (highlighting) tell
+// whether the line they were computed for still exists unchanged. Batch
+// workers load and edit files at the same time, so the counter is atomic.
+static atomic_ullong line_version_counter;
+
+static unsigned long long editor_line_reserve_versions(size_t count) {
+    return atomic_fetch_add(&line_version_counter, count) + 1;
+}
+
 void init_editor_lines_array(EditorLinesArray *array) {
     array->elements = malloc(sizeof(EditorLine) * EDITOR_LINES_ARRAY_INIT_CAPACITY);
     if (array->elements == NULL) {
@@ -12,13 +27,27 @@ void init_editor_lines_array(EditorLinesArray *array) {
     }
     array->size = 0;
     array->capacity = EDITOR_LINES_ARRAY_INIT_CAPACITY;
+    array->resident = 0;
+    array->swap_hand = 0;
+}
+
+// What lines count against the memory limit while resident (see swap.h).
+static long long editor_lines_resident_cost(const EditorLine *lines, long long count) {
+    long long cost = 0;
+    for (long long i = 0; i < count; i++) {
+        if (!lines[i].swapped) cost += (long long)lines[i].len * 2 + 1;
+    }
+    return cost;
 }
 
 void free_editor_lines_array(EditorLinesArray *array) {
     if (array->elements) {
-        for (int i = 0; i < array->size; ++i) {
-            free(array->elements[i].text);
+        editor_swap_account(array, -array->resident);
+        for (long long i = 0; i < array->size; ++i) {
+            editor_swap_release(&array->elements[i], array->elements[i].len);
+            editor_line_free_text(&array->elements[i]);
             free(array->elements[i].hl);
+            free(array->elements[i].render);
         }
         free(array->elements);
         array->elements = NULL;
@@ -27,24 +56,36 @@ void free_editor_lines_array(EditorLinesArray *array) {
     array->capacity = 0;
 }
 
-void editor_lines_array_grow(EditorLinesArray *array) {
-    int new_capacity = array->capacity * 2;
-    EditorLine *new_elements = realloc(array->elements, sizeof(EditorLine) * new_capacity);
+// Every capacity change goes through here so the byte count can never wrap.
+static void editor_lines_array_resize(EditorLinesArray *array, long long new_capacity, const char *what) {
+    if (new_capacity < 0 || (unsigned long long)new_capacity > SIZE_MAX / sizeof(EditorLine)) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to %s EditorLinesArray capacity: %lld lines is too many.", what, new_capacity);
+        return;
+    }
+    EditorLine *new_elements = realloc(array->elements, sizeof(EditorLine) * (size_t)new_capacity);
     if (new_elements == NULL) {
-        editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to grow EditorLinesArray capacity.");
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to %s EditorLinesArray capacity.", what);
+        return;
     }
     array->elements = new_elements;
     array->capacity = new_capacity;
 }
 
+void editor_lines_array_grow(EditorLinesArray *array) {
+    long long new_capacity = array->capacity > LLONG_MAX / 2 ? LLONG_MAX : array->capacity * 2;
+    editor_lines_array_resize(array, new_capacity, "grow");
+}
+
 void editor_lines_array_append(EditorLinesArray *array, EditorLine line) {
     if (array->size == array->capacity) {
         editor_lines_array_grow(array);
     }
+    line.version = editor_line_reserve_versions(1);
+    editor_swap_account(array, editor_lines_resident_cost(&line, 1));
     array->elements[array->size++] = line;
 }
 
-void editor_lines_array_insert(EditorLinesArray *array, int index, EditorLine line) {
+void editor_lines_array_insert(EditorLinesArray *array, long long index, EditorLine line) {
     if (index < 0 || index > array->size) {
         editor_handle_error(ERR_NONE, "Invalid index for EditorLinesArray insertion.");
         return;
@@ -53,28 +94,327 @@ void editor_lines_array_insert(EditorLinesArray *array, int index, EditorLine li
         editor_lines_array_grow(array);
     }
     memmove(&array->elements[index + 1], &array->elements[index], (array->size - index) * sizeof(EditorLine));
+    line.version = editor_line_reserve_versions(1);
+    editor_swap_account(array, editor_lines_resident_cost(&line, 1));
     array->elements[index] = line;
     array->size++;
 }
 
-void editor_lines_array_delete(EditorLinesArray *array, int index) {
+void editor_lines_array_delete(EditorLinesArray *array, long long index) {
     if (index < 0 || index >= array->size) {
         editor_handle_error(ERR_NONE, "Invalid index for EditorLinesArray deletion.");
         return;
     }
-    free(array->elements[index].text);
+    editor_swap_account(array, -editor_lines_resident_cost(&array->elements[index], 1));
+    editor_swap_release(&array->elements[index], array->elements[index].len);
+    editor_line_free_text(&array->elements[index]);
     free(array->elements[index].hl);
+    free(array->elements[index].render);
     memmove(&array->elements[index], &array->elements[index + 1], (array->size - index - 1) * sizeof(EditorLine));
     array->size--;
 
     // Shrink array if significantly underutilized
     if (array->capacity > EDITOR_LINES_ARRAY_INIT_CAPACITY && array->size < array->capacity / 4) {
-        int new_capacity = array->capacity / 2;
-        EditorLine *new_elements = realloc(array->elements, sizeof(EditorLine) * new_capacity);
-        if (new_elements == NULL) {
-            editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to shrink EditorLinesArray capacity.");
+        editor_lines_array_resize(array, array->capacity / 2, "shrink");
+    }
+}
+
+void editor_lines_array_splice(EditorLinesArray *array, long long index, long long remove_count,
+                               EditorLinesArray *insert, EditorLinesArray *removed) {
+    if (index < 0 || remove_count < 0 || remove_count > array->size - index) {
+        editor_handle_error(ERR_NONE, "Invalid range for EditorLinesArray splice.");
+        return;
+    }
+    if (editor_swap_enabled()) {
+        // Lines held for undo are left out of the count: the trim could
+        // never reach them to bring it down.
+        long long removed_cost = remove_count == array->size
+                                     ? array->resident
+                                     : editor_lines_resident_cost(&array->elements[index], remove_count);
+        editor_swap_account(insert, -insert->resident);
+        editor_swap_account(array, editor_lines_resident_cost(insert->elements, insert->size) - removed_cost);
+    }
+    if (removed && (removed->size > 0 || remove_count < array->size)) {
+        // Handed over as they are, still swapped out.
+        editor_lines_array_reserve(removed, removed->size + remove_count);
+        memcpy(&removed->elements[removed->size], &array->elements[index], remove_count * sizeof(EditorLine));
+        removed->size += remove_count;
+    } else if (removed == NULL) {
+        for (long long i = index; i < index + remove_count; i++) {
+            EditorLine *line = &array->elements[i];
+            editor_swap_release(line, line->len);
+            editor_line_free_text(line);
+            free(line->hl);
+            free(line->render);
         }
-        array->elements = new_elements;
-        array->capacity = new_capacity;
     }
+
+    if (remove_count == array->size) {
+        // Everything goes: trade whole element arrays instead of copying.
+        EditorLinesArray old = *array;
+        *array = *insert;
+        array->resident = old.resident;
+        if (removed && removed->size == 0) {
+            *insert = *removed;
+            *removed = old;
+            removed->resident = 0;
+        } else {
+            *insert = old;
+        }
+        insert->size = 0;
+        insert->resident = 0;
+        array->swap_hand = 0;
+        return;
+    }
+    long long size = array->size - remove_count + insert->size;
+    editor_lines_array_reserve(array, size);
+    memmove(&array->elements[index + insert->size], &array->elements[index + remove_count],
+            (array->size - index - remove_count) * sizeof(EditorLine));
+    if (insert->size > 0) memcpy(&array->elements[index], insert->elements, insert->size * sizeof(EditorLine));
+    array->size = size;
+    insert->size = 0;
+}
+
+void editor_lines_array_reserve(EditorLinesArray *array, long long capacity) {
+    if (capacity <= array->capacity) return;
+    editor_lines_array_resize(array, capacity, "reserve");
+}
+
+// Bulk loading: each buffer is cut into chunks that are scanned for newlines
+// concurrently (memchr is vectorized by libc), a short sequential pass turns
+// the per-chunk counts into line numbers, and a second concurrent pass copies
+// every line straight into its final slot in its array. Buffers loaded
+// together share both passes, so a batch of small files keeps every worker
+// busy as well as one large file does.
+
+#define LINE_SCAN_MIN_CHUNK (1 << 20)
+#define LINE_SCAN_CHUNKS_PER_WORKER 4
+
+typedef struct {
+    const EditorLinesSource *source;
+    EditorLine *dest;
+    unsigned long long first_version;
+    size_t lines;           // terminated lines
+    size_t tail_start;      // where an unterminated last line begins
+} LineScanJob;
+
+typedef struct {
+    LineScanJob *job;
+    size_t start, end;
+    size_t newlines;
+    size_t first_newline, last_newline;
+    size_t first_line;      // index of the line terminated by first_newline
+    size_t line_start;      // byte offset where that line begins
+    int failed;
+} LineScanChunk;
+
+static void line_scan_count(void *ctx, int task) {
+    LineScanChunk *chunk = &((LineScanChunk *)ctx)[task];
+    const char *data = chunk->job->source->data;
+    const char *p = data + chunk->start;
+    const char *end = data + chunk->end;
+
+    chunk->newlines = 0;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        size_t offset = p - data;
+        if (chunk->newlines == 0) chunk->first_newline = offset;
+        chunk->last_newline = offset;
+        chunk->newlines++;
+        p++;
+    }
+}
+
+static int line_scan_make(LineScanJob *job, EditorLine *line, size_t start, size_t len, int terminated) {
+    const char *text = job->source->data + start;
+    size_t raw_len = len;
+    // Same trimming as the old getline loop: any trailing CRs are dropped.
+    while (len > 0 && text[len - 1] == '\r') len--;
+    line->interned = editor_intern_enabled();
+    if (line->interned) {
+        line->text = editor_intern(text, len);
+        if (line->text == NULL) return -1;
+    } else {
+        line->text = malloc(len + 1);
+        if (line->text == NULL) return -1;
+        memcpy(line->text, text, len);
+        line->text[len] = '\0';
+    }
+    line->len = len;
+    line->hl = NULL;
+    line->hl_open_comment = 0;
+    line->version = job->first_version + (line - job->dest);
+    line->hl_stale = 0;
+    line->render = NULL;
+    line->render_len = 0;
+    line->render_valid = 0;
+    line->swapped = 0;
+    line->swap_valid = 0;
+    line->referenced = 0;
+    line->swap_offset = 0;
+    // Only lines that save back byte-for-byte as "text\n" can be copied
+    // from the original file instead of being rewritten.
+    line->disk_offset = job->source->disk_offset + (off_t)start;
+    line->disk_clean = job->source->disk_offset >= 0 && terminated && len == raw_len;
+    return 0;
+}
+
+static void line_scan_copy(void *ctx, int task) {
+    LineScanChunk *chunk = &((LineScanChunk *)ctx)[task];
+    LineScanJob *job = chunk->job;
+    const char *data = job->source->data;
+    const char *p = data + chunk->first_newline;
+    const char *end = data + chunk->end;
+    size_t line_start = chunk->line_start;
+    EditorLine *dest = job->dest + chunk->first_line;
+
+    for (size_t i = 0; i < chunk->newlines; i++) {
+        p = memchr(p, '\n', end - p);
+        size_t offset = p - data;
+        if (line_scan_make(job, &dest[i], line_start, offset - line_start, 1) != 0) {
+            chunk->failed = 1;
+            for (size_t j = i; j < chunk->newlines; j++) dest[j].text = NULL;
+            return;
+        }
+        line_start = offset + 1;
+        p++;
+    }
+}
+
+void editor_lines_array_append_buffer(EditorLinesArray *array, const char *data, size_t size, off_t disk_offset) {
+    EditorLinesSource source = { .array = array, .data = data, .size = size, .disk_offset = disk_offset };
+    editor_lines_array_append_buffers(&source, 1);
+}
+
+void editor_lines_array_append_buffers(const EditorLinesSource *sources, int count) {
+    size_t total_size = 0;
+    for (int i = 0; i < count; i++) total_size += sources[i].size;
+    if (total_size == 0) return;
+
+    size_t chunk_size = total_size / ((size_t)parallel_worker_count() * LINE_SCAN_CHUNKS_PER_WORKER);
+    if (chunk_size < LINE_SCAN_MIN_CHUNK) chunk_size = LINE_SCAN_MIN_CHUNK;
+    int chunk_count = 0;
+    for (int i = 0; i < count; i++) chunk_count += (int)((sources[i].size + chunk_size - 1) / chunk_size);
+
+    LineScanJob *jobs = calloc(count, sizeof(LineScanJob));
+    LineScanChunk *chunks = calloc(chunk_count, sizeof(LineScanChunk));
+    if (jobs == NULL || chunks == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (line scan chunks).");
+    }
+    int c = 0;
+    for (int i = 0; i < count; i++) {
+        jobs[i].source = &sources[i];
+        for (size_t start = 0; start < sources[i].size; start += chunk_size) {
+            chunks[c].job = &jobs[i];
+            chunks[c].start = start;
+            chunks[c].end = sources[i].size - start > chunk_size ? start + chunk_size : sources[i].size;
+            c++;
+        }
+    }
+    parallel_run(chunk_count, line_scan_count, chunks);
+
+    c = 0;
+    for (int i = 0; i < count; i++) {
+        LineScanJob *job = &jobs[i];
+        EditorLinesArray *array = sources[i].array;
+        size_t lines = 0;
+        size_t line_start = 0;
+        for (; c < chunk_count && chunks[c].job == job; c++) {
+            chunks[c].first_line = lines;
+            chunks[c].line_start = line_start;
+            if (chunks[c].newlines > 0) {
+                lines += chunks[c].newlines;
+                line_start = chunks[c].last_newline + 1;
+            }
+        }
+        job->lines = lines;
+        job->tail_start = line_start;
+        size_t total = (size_t)array->size + lines + (line_start < sources[i].size ? 1 : 0);
+        if (total > LLONG_MAX) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "File has too many lines (%zu).", total);
+            return;
+        }
+        editor_lines_array_reserve(array, (long long)total);
+        job->dest = &array->elements[array->size];
+        // The tail is made last, if at all; until then the cleanup below
+        // must see an empty slot, not whatever the reserve left there.
+        if (line_start < sources[i].size) job->dest[lines].text = NULL;
+        job->first_version = editor_line_reserve_versions(total - (size_t)array->size);
+    }
+    parallel_run(chunk_count, line_scan_copy, chunks);
+
+    int failed = 0;
+    for (c = 0; c < chunk_count; c++) failed |= chunks[c].failed;
+    for (int i = 0; i < count; i++) {
+        LineScanJob *job = &jobs[i];
+        if (job->tail_start < sources[i].size) {
+            EditorLine *tail = &job->dest[job->lines];
+            if (!failed && line_scan_make(job, tail, job->tail_start, sources[i].size - job->tail_start, 0) != 0) {
+                failed = 1;
+            }
+        }
+    }
+    free(chunks);
+
+    if (failed) {
+        for (int i = 0; i < count; i++) {
+            size_t made = jobs[i].lines + (jobs[i].tail_start < sources[i].size ? 1 : 0);
+            for (size_t j = 0; j < made; j++) editor_line_free_text(&jobs[i].dest[j]);
+        }
+        free(jobs);
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (line text).");
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        EditorLinesArray *array = sources[i].array;
+        long long made = (long long)(jobs[i].lines + (jobs[i].tail_start < sources[i].size ? 1 : 0));
+        if (editor_swap_enabled()) editor_swap_account(array, editor_lines_resident_cost(&array->elements[array->size], made));
+        array->size += made;
+    }
+    free(jobs);
+}
+
+void editor_line_mark_modified(EditorLine *line, size_t old_len) {
+    editor_swap_account_line(line, ((long long)line->len - (long long)old_len) * 2);
+    line->disk_clean = 0;
+    editor_swap_release(line, old_len);
+    line->swap_valid = 0;
+    line->version = editor_line_reserve_versions(1);
+    editor_line_invalidate_render(line);
+}
+
+void editor_line_make_writable(EditorLine *line) {
+    editor_line_page_in(line);
+    if (!line->interned) return;
+
+    char *text = malloc(line->len + 1);
+    if (text == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (copying shared line).");
+        return;
+    }
+    memcpy(text, line->text, line->len + 1);
+    editor_intern_release(line->text);
+    line->text = text;
+    line->interned = 0;
+}
+
+char *editor_line_replace_text(EditorLine *line, char *text, size_t len) {
+    editor_line_make_writable(line);
+    char *old_text = line->text;
+    size_t old_len = line->len;
+    line->text = text;
+    line->len = len;
+    editor_line_mark_modified(line, old_len);
+    return old_text;
+}
+
+void editor_line_free_text(EditorLine *line) {
+    if (line->text == NULL) return;
+    if (line->interned) editor_intern_release(line->text);
+    else free(line->text);
+    line->text = NULL;
+    line->interned = 0;
+}
+
+void editor_line_invalidate_render(EditorLine *line) {
+    line->render_valid = 0;
 }
@@ -1,25 +1,71 @@
 #ifndef EDITOR_LINES_ARRAY_H
 #define EDITOR_LINES_ARRAY_H
 
+#include <ncurses.h> // For chtype
 #include <stddef.h> // For size_t
+#include <sys/types.h> // For off_t
 
 typedef struct {
     char *text;
     size_t len;
     char *hl;
     int hl_open_comment;
+    off_t disk_offset; // where text starts in the file it was loaded from
+    int disk_clean;    // text is still byte-identical to disk and ends in '\n' there
+    unsigned long long version; // unique per line content; changes on every edit
+    int hl_stale;      // hl waits on the background highlighter
+    chtype *render;    // text with tabs expanded and colors applied, for drawing
+    long long render_len;
+    int render_valid;  // cleared whenever text or hl changes
+    int render_colored;
+    int swapped;       // text and hl are only in the swap file (see swap.h)
+    int swap_valid;    // swap_offset holds a copy of the current text
+    int referenced;    // read since the swap CLOCK hand last passed
+    off_t swap_offset;
+    int interned;      // text is shared through intern.h and must not be written
 } EditorLine;
 
 typedef struct {
     EditorLine *elements;
-    int size;
-    int capacity;
+    long long size;
+    long long capacity;
+    long long resident; // bytes its lines count against the memory limit (see swap.h)
+    long long swap_hand; // where the swap CLOCK hand stopped in this array
 } EditorLinesArray;
 
 void init_editor_lines_array(EditorLinesArray *array);
 void free_editor_lines_array(EditorLinesArray *array);
 void editor_lines_array_append(EditorLinesArray *array, EditorLine line);
-void editor_lines_array_insert(EditorLinesArray *array, int index, EditorLine line);
-void editor_lines_array_delete(EditorLinesArray *array, int index);
+void editor_lines_array_insert(EditorLinesArray *array, long long index, EditorLine line);
+void editor_lines_array_delete(EditorLinesArray *array, long long index);
+// Replaces remove_count lines at index with every line of insert, which is
+// left empty, moving the lines after them only once. The lines taken out
+// are appended to removed, or freed if it is NULL; either way they stop
+// counting against the memory limit.
+void editor_lines_array_splice(EditorLinesArray *array, long long index, long long remove_count,
+                               EditorLinesArray *insert, EditorLinesArray *removed);
+void editor_lines_array_reserve(EditorLinesArray *array, long long capacity);
+void editor_lines_array_append_buffer(EditorLinesArray *array, const char *data, size_t size, off_t disk_offset);
+// One buffer to append to an array; disk_offset is -1 if data is not the
+// file on disk.
+typedef struct {
+    EditorLinesArray *array;
+    const char *data;
+    size_t size;
+    off_t disk_offset;
+} EditorLinesSource;
+// Appends each source to its own array (all distinct) in one parallel pass.
+void editor_lines_array_append_buffers(const EditorLinesSource *sources, int count);
+// Call after every change to a line's text; old_len is its length before,
+// so the memory limit sees the line grow or shrink.
+void editor_line_mark_modified(EditorLine *line, size_t old_len);
+// Pages the line in and gives it a private copy of its text; call before
+// writing to line->text.
+void editor_line_make_writable(EditorLine *line);
+void editor_line_free_text(EditorLine *line);
+// Installs text (malloc'd, NUL-terminated, len bytes) as the line's contents
+// and returns the previous text, which the caller now owns.
+char *editor_line_replace_text(EditorLine *line, char *text, size_t len);
+void editor_line_invalidate_render(EditorLine *line);
 
 #endif // EDITOR_LINES_ARRAY_H
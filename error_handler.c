@@ -6,16 +6,21 @@
 #include <stdarg.h>
 #include <string.h>
 
+_Thread_local EditorErrorTrap *editor_error_trap;
+
 void editor_handle_error(EditorErrorCode code, const char *fmt, ...) {
     va_list ap;
-    va_start(ap, fmt);
-
-    // 1. Print to stderr (for developers/debugging)
-    fprintf(stderr, "Error [%d]: ", code);
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
+    int fatal = code == ERR_OUT_OF_MEMORY || code == ERR_FILE_OPERATION;
 
-    va_end(ap);
+    // 1. Print to stderr (for developers/debugging), unless whoever set the
+    // trap reports it
+    if (!fatal || editor_error_trap == NULL) {
+        va_start(ap, fmt);
+        fprintf(stderr, "Error [%d]: ", code);
+        vfprintf(stderr, fmt, ap);
+        fprintf(stderr, "\n");
+        va_end(ap);
+    }
 
     // 2. Set editor status message (for user feedback)
     // Re-initialize va_list for vsnprintf
@@ -26,7 +31,13 @@ void editor_handle_error(EditorErrorCode code, const char *fmt, ...) {
     va_end(ap);
 
     // 3. Decide on termination based on error code or severity
-    if (code == ERR_OUT_OF_MEMORY || code == ERR_FILE_OPERATION) { // Fatal errors
+    if (fatal) {
+        if (editor_error_trap != NULL) {
+            EditorErrorTrap *trap = editor_error_trap;
+            editor_error_trap = NULL;
+            snprintf(trap->message, sizeof(trap->message), "%s", user_message);
+            longjmp(trap->jump, 1);
+        }
         cleanup_editor(); // Ensure resources are freed
         exit(1);
     }
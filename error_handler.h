@@ -3,6 +3,18 @@
 
 #include "error_codes.h"
 
+#include <setjmp.h>
+
 void editor_handle_error(EditorErrorCode code, const char *fmt, ...);
 
+// A thread that can give up on its current piece of work instead of the
+// whole process points editor_error_trap at one of these. A fatal error
+// then stores its message and longjmps to jump rather than exiting.
+typedef struct {
+    jmp_buf jump;
+    char message[256];
+} EditorErrorTrap;
+
+extern _Thread_local EditorErrorTrap *editor_error_trap;
+
 #endif // ERROR_HANDLER_H
@@ -0,0 +1,139 @@
+#include "event_loop.h"
+#include "editor.h"
+#include "ui.h"
+#include "ui_constants.h"
+
+#include "error_handler.h"
+#include "input.h"
+#include "syntax.h"
+#include "swap.h"
+#include "filesearch.h"
+#include "macro.h"
+#include "clipboard.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The loop sleeps in poll() until a background thread (input, highlighting)
+// signals through the wakeup pipe or a timer is due, drains every queued
+// key and worker result, and only then renders -
+// at most once per MIN_FRAME_INTERVAL_MS. During key auto-repeat or a fast
+// paste this turns hundreds of keys into a handful of frames.
+
+#define MIN_FRAME_INTERVAL_MS 16
+
+// Atomic because editing code shared with batch workers requests redraws.
+static atomic_int redraw_pending = 1;
+static int wake_pipe[2] = { -1, -1 };
+
+void editor_event_loop_init() {
+    if (pipe(wake_pipe) == -1) {
+        editor_handle_error(ERR_FILE_OPERATION, "Failed to create wakeup pipe: %s", strerror(errno));
+        return;
+    }
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+}
+
+// Async-signal-safe; may be called from any thread.
+void editor_wake() {
+    char byte = 0;
+    // A full pipe already guarantees a wakeup, so EAGAIN is fine.
+    (void)!write(wake_pipe[1], &byte, 1);
+}
+
+void editor_request_redraw() {
+    redraw_pending = 1;
+}
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Milliseconds until something on screen changes by itself: the clock
+// rolling over to the next minute, or the status message expiring.
+static long long next_timer_ms() {
+    time_t now = time(NULL);
+    long long wait = (60 - now % 60) * 1000LL;
+    time_t expires = status_message_time + STATUS_MESSAGE_TIMEOUT_SECONDS;
+    if (expires > now && (expires - now) * 1000LL < wait) {
+        wait = (expires - now) * 1000LL;
+    }
+    return wait;
+}
+
+// Returns 0 if the timeout expired without input.
+static int wait_for_input(int timeout_ms) {
+    struct pollfd pfd = { .fd = wake_pipe[0], .events = POLLIN };
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR) {
+    }
+    if (ready > 0) {
+        char buf[256];
+        while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {
+        }
+    }
+    return ready;
+}
+
+// Blocking read for modal code (prompts, confirmations) that needs the next
+// key before it can continue.
+int editor_read_key() {
+    while (1) {
+        int c;
+        if (editor_macro_next_key(&c)) return c;
+        if (editor_input_pop(&c)) {
+            editor_macro_record_key(c);
+            return c;
+        }
+        if (editor_input_take_resize()) {
+            editor_handle_resize();
+            editor_refresh_screen();
+        }
+        wait_for_input(-1);
+    }
+}
+
+void editor_event_loop() {
+    long long last_frame = 0;
+
+    while (1) {
+        int c;
+        while (editor_input_pop(&c)) {
+            editor_macro_record_key(c);
+            editor_process_keypress(c);
+        }
+        if (editor_input_take_resize()) {
+            editor_handle_resize();
+        }
+        editor_syntax_worker_poll();
+        editor_file_search_poll();
+        editor_clipboard_poll();
+
+        long long now = now_ms();
+        long long timer = next_timer_ms();
+        if (redraw_pending) {
+            long long frame_due = last_frame + MIN_FRAME_INTERVAL_MS;
+            if (now >= frame_due) {
+                editor_refresh_screen();
+                redraw_pending = 0;
+                last_frame = now;
+                // The frame marked what is on screen as recently used.
+                editor_swap_trim(&get_editor_config()->lines);
+            } else if (frame_due - now < timer) {
+                timer = frame_due - now;
+            }
+        }
+
+        if (wait_for_input((int)timer) == 0) {
+            redraw_pending = 1;
+        }
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+void editor_event_loop_init();
+void editor_event_loop();
+void editor_wake();
+void editor_request_redraw();
+int editor_read_key();
+
+#endif // EVENT_LOOP_H
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // realpath, copy_file_range
+
 #include "editor.h"
 #include "file.h"
 #include "syntax.h"
@@ -14,64 +16,621 @@
 #include <unistd.h>
 #include "error_handler.h"
 #include "editor_lines_array.h"
+#include "journal.h"
+#include "parallel.h"
+#include "swap.h"
+#include "cursors.h"
 
-void editor_read_file(const char *filename) {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <libgen.h>
+
+#define READ_FD_CHUNK (1 << 16)
+
+static char *editor_read_fd(int fd, size_t *size_out) {
+    size_t size = 0;
+    size_t cap = READ_FD_CHUNK;
+    char *data = malloc(cap);
+    if (data == NULL) return NULL;
+
+    while (1) {
+        if (size == cap) {
+            char *grown = realloc(data, cap * 2);
+            if (grown == NULL) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, data + size, cap - size);
+        if (n == 0) break;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            free(data);
+            return NULL;
+        }
+        size += n;
+    }
+    *size_out = size;
+    return data;
+}
+
+// Saving goes through a temporary file in the target's directory that is
+// filled with large writev batches, fsynced and then renamed over the
+// target, so a crash mid-save leaves either the old or the new contents.
+// A target with other hard links, or one whose owner the copy cannot be
+// given, is overwritten with the finished copy instead.
+
+#define SAVE_IOV_BATCH 1024
+
+static int editor_writev_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Spans of unmodified lines are copied from the file they were loaded from.
+// copy_file_range lets the kernel (or a reflink-capable filesystem) move the
+// bytes without a trip through userspace; short spans are not worth a
+// syscall of their own and are written from memory like edited lines.
+
+#define SAVE_COPY_MIN (64 * 1024)
+#define SAVE_COPY_BUFFER (1 << 20)
+
+static int editor_copy_range(int src_fd, off_t offset, int dst_fd, size_t len, int *use_copy_range) {
+#ifdef __linux__
+    while (len > 0 && *use_copy_range) {
+        ssize_t n = copy_file_range(src_fd, &offset, dst_fd, NULL, len, 0);
+        if (n > 0) {
+            len -= n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+            *use_copy_range = 0;
+            break;
+        }
+        return -1;
+    }
+#else
+    *use_copy_range = 0;
+#endif
+    if (len == 0) return 0;
+
+    char *buffer = malloc(SAVE_COPY_BUFFER);
+    if (buffer == NULL) return -1;
+    while (len > 0) {
+        size_t want = len < SAVE_COPY_BUFFER ? len : SAVE_COPY_BUFFER;
+        ssize_t n = pread(src_fd, buffer, want, offset);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO; // source shrank underneath us
+            free(buffer);
+            return -1;
+        }
+        struct iovec iov = { .iov_base = buffer, .iov_len = n };
+        if (editor_writev_all(dst_fd, &iov, 1) == -1) {
+            free(buffer);
+            return -1;
+        }
+        offset += n;
+        len -= n;
+    }
+    free(buffer);
+    return 0;
+}
+
+// Compressed swap blocks are decompressed one at a time, straight out of the
+// swap cache.
+static int editor_write_compressed_range(int fd, off_t offset, size_t len) {
+    while (len > 0) {
+        size_t available;
+        const char *text = editor_swap_peek(offset, &available);
+        if (text == NULL) return -1;
+        struct iovec iov = { .iov_base = (char *)text, .iov_len = available < len ? available : len };
+        if (editor_writev_all(fd, &iov, 1) == -1) return -1;
+        offset += iov.iov_len;
+        len -= iov.iov_len;
+    }
+    return 0;
+}
+
+static int editor_write_lines(int fd, EditorLinesArray *lines, int source_fd, EditorSaveStats *stats) {
+    static char newline[] = "\n";
+    struct iovec iov[SAVE_IOV_BATCH];
+    int count = 0;
+    int use_copy_range = 1;
+    int use_copy_range_swap = 1;
+
+    long long i = 0;
+    while (i < lines->size) {
+        long long run_end_line = i;
+        if (source_fd != -1 && lines->elements[i].disk_clean) {
+            off_t run_start = lines->elements[i].disk_offset;
+            off_t run_end = run_start;
+            while (run_end_line < lines->size &&
+                   lines->elements[run_end_line].disk_clean &&
+                   lines->elements[run_end_line].disk_offset == run_end) {
+                run_end += lines->elements[run_end_line].len + 1;
+                run_end_line++;
+            }
+            if (run_end - run_start >= SAVE_COPY_MIN) {
+                if (count > 0 && editor_writev_all(fd, iov, count) == -1) return -1;
+                count = 0;
+                if (editor_copy_range(source_fd, run_start, fd, run_end - run_start, &use_copy_range) == -1) return -1;
+                stats->bytes_copied += run_end - run_start;
+                i = run_end_line;
+                continue;
+            }
+        }
+        if (lines->elements[i].swapped) {
+            // Swapped-out lines are stored as "text\n" records, so a run of
+            // them that sits together in the swap file is copied in one go.
+            off_t run_start = lines->elements[i].swap_offset;
+            off_t run_end = run_start;
+            while (i < lines->size && lines->elements[i].swapped &&
+                   lines->elements[i].swap_offset == run_end) {
+                run_end += lines->elements[i].len + 1;
+                i++;
+            }
+            if (count > 0 && editor_writev_all(fd, iov, count) == -1) return -1;
+            count = 0;
+            if (editor_swap_fd() != -1) {
+                if (editor_copy_range(editor_swap_fd(), run_start, fd, run_end - run_start, &use_copy_range_swap) == -1) return -1;
+            } else if (editor_write_compressed_range(fd, run_start, run_end - run_start) == -1) {
+                return -1;
+            }
+            stats->bytes_written += run_end - run_start;
+            continue;
+        }
+        if (run_end_line == i) run_end_line = i + 1;
+
+        for (; i < run_end_line && !lines->elements[i].swapped; i++) {
+            iov[count].iov_base = lines->elements[i].text;
+            iov[count].iov_len = lines->elements[i].len;
+            iov[count + 1].iov_base = newline;
+            iov[count + 1].iov_len = 1;
+            count += 2;
+            stats->bytes_written += lines->elements[i].len + 1;
+            if (count == SAVE_IOV_BATCH) {
+                if (editor_writev_all(fd, iov, count) == -1) return -1;
+                count = 0;
+            }
+        }
+    }
+    if (count > 0 && editor_writev_all(fd, iov, count) == -1) return -1;
+    return 0;
+}
+
+static int editor_same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// The lines' disk offsets are only usable if the file they point into is
+// still exactly the one we loaded.
+int editor_open_loaded_file(const char *filename, const struct stat *disk_stat) {
+    if (filename == NULL || disk_stat == NULL || disk_stat->st_nlink == 0) return -1;
+    int fd = open(filename, O_RDONLY);
+    struct stat current;
+    if (fd != -1 && (fstat(fd, &current) == -1 || !editor_same_file(&current, disk_stat))) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int editor_write_lines_snapshot(EditorLinesArray *lines, const char *filename, const struct stat *disk_stat) {
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0') dir = "/tmp";
+    size_t path_len = strlen(dir) + sizeof("/erwintext-copy-XXXXXX");
+    char *path = malloc(path_len);
+    if (path == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(path, path_len, "%s/erwintext-copy-XXXXXX", dir);
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd != -1) unlink(path);
+    free(path);
+    if (fd == -1) return -1;
+
+    int source_fd = editor_open_loaded_file(filename, disk_stat);
+    EditorSaveStats stats = { 0 };
+    int written = editor_write_lines(fd, lines, source_fd, &stats);
+    int saved_errno = errno;
+    if (source_fd != -1) close(source_fd);
+    if (written == -1) {
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+static int editor_fsync_parent_dir(const char *path) {
+    char *copy = strdup(path);
+    if (copy == NULL) return -1;
+    int fd = open(dirname(copy), O_RDONLY);
+    free(copy);
+    if (fd == -1) return -1;
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Copies the finished temporary file over target, keeping its inode, and
+// replaces *saved with what target looks like afterwards. Not atomic: a
+// crash part way leaves target truncated.
+static int editor_rewrite_in_place(int tmp_fd, const char *target, struct stat *saved) {
+    int fd = open(target, O_WRONLY | O_TRUNC);
+    if (fd == -1) return -1;
+    int use_copy_range = 1;
+    if (editor_copy_range(tmp_fd, 0, fd, saved->st_size, &use_copy_range) == -1 ||
+        fsync(fd) == -1 ||
+        fstat(fd, saved) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return close(fd);
+}
+
+int editor_write_file_atomic(EditorLinesArray *lines, const char *filename, struct stat *disk_stat, EditorSaveStats *stats) {
+    // Follow symlinks so the link itself survives the rename.
+    char *target = realpath(filename, NULL);
+    if (target == NULL) {
+        if (errno != ENOENT) return -1;
+        target = strdup(filename);
+        if (target == NULL) return -1;
+    }
+
+    char *dir_copy = strdup(target);
+    char *base_copy = strdup(target);
+    char *tmp_path = NULL;
+    if (dir_copy && base_copy) {
+        const char *dir = dirname(dir_copy);
+        const char *base = basename(base_copy);
+        size_t tmp_len = strlen(dir) + strlen(base) + 16;
+        tmp_path = malloc(tmp_len);
+        if (tmp_path) snprintf(tmp_path, tmp_len, "%s/.%s.XXXXXX", dir, base);
+    }
+    free(dir_copy);
+    free(base_copy);
+    if (tmp_path == NULL) {
+        free(target);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        free(tmp_path);
+        free(target);
+        return -1;
+    }
+
+    // mkstemp creates the file 0600; give it the original's mode, or what a
+    // plain fopen would have produced for a new file.
+    struct stat st;
+    mode_t mode;
+    int exists = stat(target, &st) == 0;
+    if (exists) {
+        mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+
+    int source_fd = editor_open_loaded_file(target, disk_stat);
+
+    stats->bytes_written = 0;
+    stats->bytes_copied = 0;
+    // A rename would cut a hard link off from the new contents, or hand the
+    // file to us if it belongs to someone else. Then the finished copy is
+    // written over the original instead.
+    int in_place = exists && (st.st_nlink > 1 || fchown(fd, st.st_uid, st.st_gid) == -1);
+
+    struct stat saved;
+    if (fchmod(fd, mode) == -1 ||
+        editor_write_lines(fd, lines, source_fd, stats) == -1 ||
+        fsync(fd) == -1 ||
+        fstat(fd, &saved) == -1) {
+        int saved_errno = errno;
+        if (source_fd != -1) close(source_fd);
+        close(fd);
+        unlink(tmp_path);
+        free(tmp_path);
+        free(target);
+        errno = saved_errno;
+        return -1;
+    }
+    if (source_fd != -1) close(source_fd);
+    if (in_place) {
+        int rewritten = editor_rewrite_in_place(fd, target, &saved);
+        int saved_errno = errno;
+        close(fd);
+        unlink(tmp_path);
+        if (rewritten == -1) {
+            free(tmp_path);
+            free(target);
+            errno = saved_errno;
+            return -1;
+        }
+    } else if (close(fd) == -1 || rename(tmp_path, target) == -1) {
+        int saved_errno = errno;
+        unlink(tmp_path);
+        free(tmp_path);
+        free(target);
+        errno = saved_errno;
+        return -1;
+    } else {
+        editor_fsync_parent_dir(target);
+    }
+
+    // Every line now sits at a known offset in the file we just wrote.
+    if (disk_stat != NULL) {
+        off_t offset = 0;
+        for (long long i = 0; i < lines->size; i++) {
+            lines->elements[i].disk_offset = offset;
+            lines->elements[i].disk_clean = 1;
+            offset += lines->elements[i].len + 1;
+        }
+        *disk_stat = saved;
+    }
+
+    free(tmp_path);
+    free(target);
+    return 0;
+}
+
+#define READ_SLICE_MIN (1 << 20)
+#define READ_SLICE_MAX (64 << 20)
+
+// Under a memory limit the mapping is indexed and highlighted a slice at a
+// time, trimming back to the budget in between, so a file larger than the
+// budget is never resident all at once.
+static void editor_read_mapping_in_slices(const char *data, size_t size) {
+    EditorConfig *E = get_editor_config();
+    size_t slice = editor_swap_budget() / 4;
+    if (slice < READ_SLICE_MIN) slice = READ_SLICE_MIN;
+    if (slice > READ_SLICE_MAX) slice = READ_SLICE_MAX;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t pos = 0;
+    while (pos < size) {
+        size_t end = size;
+        if (size - pos > slice) {
+            const char *newline = memchr(data + pos + slice, '\n', size - pos - slice);
+            if (newline) end = newline - data + 1;
+        }
+        long long first_row = E->lines.size;
+        editor_lines_array_append_buffer(&E->lines, data + pos, end - pos, (off_t)pos);
+        editor_update_syntax_rows(first_row, E->lines.size);
+        editor_swap_trim(&E->lines);
+        // Done with these pages of the mapping.
+        size_t from = pos / page * page;
+        posix_madvise((void *)(data + from), end - from, POSIX_MADV_DONTNEED);
+        pos = end;
+    }
+}
+
+// A file being loaded. Opening and mapping it is safe off the editor
+// thread; everything that touches a buffer happens on it.
+typedef struct {
+    const char *filename;
+    struct stat st;
+    int error;          // errno of the failed step, 0 if loaded
+    const char *failed; // "opening" or "reading"
+    char *data;
+    size_t size;
+    int mapped;         // data is a mapping of the file, not a copy
+} FileLoad;
+
+// Regular files are mapped; pipes and other special files are slurped into
+// memory.
+static void editor_load_open(FileLoad *load) {
+    int fd = open(load->filename, O_RDONLY);
+    if (fd == -1) {
+        load->error = errno;
+        load->failed = "opening";
+        return;
+    }
+    if (fstat(fd, &load->st) == -1) {
+        load->error = errno;
+        load->failed = "reading";
+        close(fd);
+        return;
+    }
+    if (S_ISREG(load->st.st_mode) && load->st.st_size > 0) {
+        void *data = mmap(NULL, load->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            load->data = data;
+            load->size = load->st.st_size;
+            load->mapped = 1;
+            close(fd);
+            return;
+        }
+    }
+    errno = 0;
+    load->data = editor_read_fd(fd, &load->size);
+    if (load->data == NULL) {
+        load->error = errno ? errno : ENOMEM;
+        load->failed = "reading";
+    }
+    close(fd);
+}
+
+static void editor_load_open_task(void *ctx, int task) {
+    editor_load_open(&((FileLoad *)ctx)[task]);
+}
+
+// Points the current buffer at the file. Returns 0 if there are lines to
+// read in, -1 for a file that does not exist yet, which gets one empty line.
+static int editor_load_begin(FileLoad *load) {
     EditorConfig *E = get_editor_config();
     if (E->filename) free(E->filename);
-    E->filename = strdup(filename);
+    E->filename = strdup(load->filename);
     if (E->filename == NULL) {
         editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (filename).");
     }
 
     editor_select_syntax_highlight();
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        if (errno == ENOENT) {
-            init_editor_lines_array(&E->lines);
-            EditorLine new_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
-            if (new_line.text == NULL) {
-                editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (initial line text).");
-            }
-            editor_lines_array_append(&E->lines, new_line);
-            editor_set_status_message("New file: %s", filename);
-        } else {
-            editor_handle_error(ERR_FILE_OPERATION, "Error opening file '%s': %s", filename, strerror(errno));
+    if (load->error == ENOENT && strcmp(load->failed, "opening") == 0) {
+        EditorLine new_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
+        if (new_line.text == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (initial line text).");
         }
-        return;
+        editor_lines_array_append(&E->lines, new_line);
+        editor_set_status_message("New file: %s", load->filename);
+        return -1;
     }
+    if (load->error) {
+        editor_handle_error(ERR_FILE_OPERATION, "Error %s file '%s': %s", load->failed, load->filename, strerror(load->error));
+        return -1;
+    }
+    if (S_ISREG(load->st.st_mode)) E->disk_stat = load->st;
+    return 0;
+}
 
-    char *line_buffer = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+static void editor_load_end(FileLoad *load) {
+    EditorConfig *E = get_editor_config();
+    if (load->mapped) {
+        munmap(load->data, load->size);
+    } else {
+        free(load->data);
+    }
+    load->data = NULL;
+    E->dirty = 0;
+    editor_set_status_message("Opened file: %s (%lld lines)", load->filename, E->lines.size);
+}
 
-    while ((linelen = getline(&line_buffer, &linecap, fp)) != -1) {
-        while (linelen > 0 && (line_buffer[linelen - 1] == '\n' || line_buffer[linelen - 1] == '\r')) {
-            linelen--;
-        }
+const char *editor_file_unreadable(const char *filename, int missing_ok) {
+    struct stat st;
+    if (stat(filename, &st) == -1) {
+        return errno == ENOENT && missing_ok ? NULL : strerror(errno);
+    }
+    if (S_ISDIR(st.st_mode)) return "it is a directory";
+    if (access(filename, R_OK) != 0) return strerror(errno);
+    return NULL;
+}
 
-        EditorLine new_line = { .text = malloc(linelen + 1), .len = linelen, .hl = NULL, .hl_open_comment = 0 };
-        if (new_line.text == NULL) {
-            free(line_buffer);
-            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (line text).");
+void editor_read_file(const char *filename) {
+    EditorConfig *E = get_editor_config();
+    FileLoad load = { .filename = filename };
+    editor_load_open(&load);
+    if (editor_load_begin(&load) == -1) return;
+
+    if (load.mapped && editor_swap_enabled()) {
+        editor_read_mapping_in_slices(load.data, load.size);
+    } else {
+        editor_lines_array_append_buffer(&E->lines, load.data, load.size, load.mapped ? 0 : -1);
+        editor_update_syntax_all();
+    }
+    editor_load_end(&load);
+}
+
+void editor_read_files(EditorConfig **buffers, char **filenames, int count) {
+    EditorConfig *current = get_editor_config();
+    // Under a memory limit each file is read a slice at a time instead.
+    if (editor_swap_enabled()) {
+        for (int i = 0; i < count; i++) {
+            editor_set_config(buffers[i]);
+            editor_read_file(filenames[i]);
         }
-        memcpy(new_line.text, line_buffer, linelen);
-        new_line.text[linelen] = '\0';
-        editor_lines_array_append(&E->lines, new_line);
+        editor_set_config(current);
+        return;
     }
-    free(line_buffer);
-    fclose(fp);
 
-    for (int i = 0; i < E->lines.size; i++) {
-        editor_update_syntax(i);
+    FileLoad *loads = calloc(count, sizeof(FileLoad));
+    EditorLinesSource *sources = calloc(count, sizeof(EditorLinesSource));
+    EditorConfig **read = calloc(count, sizeof(EditorConfig *));
+    if (loads == NULL || sources == NULL || read == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (loading files).");
     }
+    for (int i = 0; i < count; i++) loads[i].filename = filenames[i];
+    parallel_run(count, editor_load_open_task, loads);
 
-    E->dirty = 0;
-    editor_set_status_message("Opened file: %s (%d lines)", filename, E->lines.size);
+    int source_count = 0;
+    for (int i = 0; i < count; i++) {
+        editor_set_config(buffers[i]);
+        if (editor_load_begin(&loads[i]) == -1) continue;
+        read[source_count] = buffers[i];
+        sources[source_count++] = (EditorLinesSource){
+            .array = &buffers[i]->lines,
+            .data = loads[i].data,
+            .size = loads[i].size,
+            .disk_offset = loads[i].mapped ? 0 : -1,
+        };
+    }
+    editor_lines_array_append_buffers(sources, source_count);
+    editor_update_syntax_buffers(read, source_count);
+
+    for (int i = 0; i < count; i++) {
+        if (loads[i].error) continue;
+        editor_set_config(buffers[i]);
+        editor_load_end(&loads[i]);
+    }
+    editor_set_config(current);
+    free(read);
+    free(sources);
+    free(loads);
+}
+
+void editor_start_journal() {
+    EditorConfig *E = get_editor_config();
+    int resume = 0;
+    if (journal_has_records(E->filename)) {
+        char *answer = editor_prompt("Unsaved edits to this file were found. Recover them (y/n)? %s", "");
+        if (answer && (answer[0] == 'y' || answer[0] == 'Y')) {
+            int applied = journal_replay(E->filename, &E->disk_stat);
+            if (applied >= 0) {
+                editor_set_status_message("Recovered %d edits from the journal.", applied);
+                resume = 1;
+            } else {
+                editor_set_status_message("Journal does not match the file on disk; discarded.");
+            }
+        } else {
+            editor_set_status_message("Journal discarded.");
+        }
+        free(answer);
+    }
+    journal_start(E->filename, &E->disk_stat, resume);
+    // A macro replay cut short by the crash leaves its undo group open.
+    // Closing it now also logs the end, so a later recovery groups alike.
+    editor_end_action_group();
+    // Cursors the recovered edits used go away with the recovery.
+    editor_cursors_clear();
+}
+
+void editor_open_file(const char *filename) {
+    editor_read_file(filename);
+    editor_start_journal();
 }
 
 void editor_save_file() {
     EditorConfig *E = get_editor_config();
+    if (editor_check_read_only()) return;
     if (!E->filename) {
         char *new_filename = editor_prompt("Save as: %s (ESC to cancel)", "");
         if (new_filename == NULL) {
@@ -83,16 +642,25 @@ void editor_save_file() {
         editor_select_syntax_highlight();
     }
 
-    FILE *fp = fopen(E->filename, "w");
-    if (!fp) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    EditorSaveStats stats;
+    if (editor_write_file_atomic(&E->lines, E->filename, &E->disk_stat, &stats) == -1) {
         editor_set_status_message("Error saving file: %s", strerror(errno));
         return;
     }
 
-    for (int i = 0; i < E->lines.size; ++i) {
-        fprintf(fp, "%s\n", E->lines.elements[i].text);
-    }
-    fclose(fp);
+    journal_checkpoint(E->filename, &E->disk_stat);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    double megabytes = (stats.bytes_written + stats.bytes_copied) / (1024.0 * 1024.0);
+    double reused = stats.bytes_copied / (1024.0 * 1024.0);
     E->dirty = 0;
-    editor_set_status_message("File saved: %s", E->filename);
+    if (seconds > 0) {
+        editor_set_status_message("File saved: %s (%.1f MB, %.1f MB reused, %.0f MB/s)", E->filename, megabytes, reused, megabytes / seconds);
+    } else {
+        editor_set_status_message("File saved: %s (%.1f MB, %.1f MB reused)", E->filename, megabytes, reused);
+    }
 }
@@ -1,7 +1,41 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include <stddef.h>
+#include <sys/stat.h>
+#include "editor_lines_array.h"
+
+struct EditorConfig;
+
+typedef struct {
+    size_t bytes_written; // serialized from memory
+    size_t bytes_copied;  // reused from the previous version of the file
+} EditorSaveStats;
+
+// Says why editor_read_file would fail on filename, or returns NULL if it
+// can be read. A file that does not exist is only a problem unless
+// missing_ok is set, in which case it will be created on save.
+// editor_read_file treats a file it cannot read as fatal, so anything that
+// opens a file the user named checks it here first.
+const char *editor_file_unreadable(const char *filename, int missing_ok);
 void editor_read_file(const char *filename);
+// Reads each file into its own (empty) buffer. The files are opened
+// concurrently, and all of them are indexed and then highlighted in one
+// parallel pass each.
+void editor_read_files(struct EditorConfig **buffers, char **filenames, int count);
+// Offers to replay any journal a crash left for the current buffer's file,
+// then starts journaling it.
+void editor_start_journal();
+// Reads filename into the (empty) current buffer and starts its journal.
+void editor_open_file(const char *filename);
 void editor_save_file();
+// Opens the file lines were loaded from for reading at their disk offsets,
+// or returns -1 if it is no longer the file described by disk_stat.
+int editor_open_loaded_file(const char *filename, const struct stat *disk_stat);
+int editor_write_file_atomic(EditorLinesArray *lines, const char *filename, struct stat *disk_stat, EditorSaveStats *stats);
+// Writes lines, as a save would, to an unlinked temporary file and returns
+// it, or -1 with errno set. filename and disk_stat are those of the buffer
+// the lines belong to, so unmodified lines are copied from the file.
+int editor_write_lines_snapshot(EditorLinesArray *lines, const char *filename, const struct stat *disk_stat);
 
 #endif // FILE_H
@@ -0,0 +1,573 @@
+#define _GNU_SOURCE // d_type
+
+#include "filesearch.h"
+#include "buffer.h"
+#include "editor.h"
+#include "error_handler.h"
+#include "event_loop.h"
+#include "file.h"
+#include "parallel.h"
+#include "swap.h"
+#include "ui.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Worker threads walk the tree from the chosen directory. Each keeps its own
+// stack of paths still to visit and, when that runs dry, steals the oldest
+// entry from another worker's stack, which is usually a whole subtree near
+// the root. Every file is mapped and searched with the editor's search
+// kernel in one pass, and its matching lines are queued for the editor
+// thread, which appends them to the results buffer as they arrive. Hidden
+// entries and files that look binary are skipped, and symlinks are not
+// followed.
+
+#define FILE_SEARCH_MAX_WORKERS 64
+#define FILE_SEARCH_MAX_HITS 1000000
+#define FILE_SEARCH_CONTEXT 200        // bytes of the matching line shown
+#define FILE_SEARCH_BINARY_PROBE 4096  // a NUL in this much means binary
+
+typedef struct {
+    char *path;
+    int is_dir;
+} FileSearchItem;
+
+typedef struct {
+    pthread_mutex_t lock;
+    FileSearchItem *items;
+    size_t bottom, top, capacity; // live items are [bottom, top)
+} FileSearchDeque;
+
+// Where a results row points. The row's text starts with the path.
+typedef struct {
+    size_t path_len;
+    long long row, col;
+} FileSearchHit;
+
+typedef struct {
+    char *text;
+    size_t len;
+    FileSearchHit hit;
+} FileSearchOutput;
+
+typedef struct {
+    FileSearchOutput *items;
+    size_t count, capacity;
+} FileSearchOutputList;
+
+static struct {
+    EditorConfig *results; // the buffer listing the results; NULL if none
+    int running;      // workers have not all been joined yet
+    int interrupted;  // stopped with ESC before the walk was done
+    char *query;
+    int worker_count;
+    int thread_count;            // workers actually started
+    pthread_t threads[FILE_SEARCH_MAX_WORKERS];
+    FileSearchDeque deques[FILE_SEARCH_MAX_WORKERS];
+    SearchPattern *patterns[FILE_SEARCH_MAX_WORKERS]; // one per worker
+
+    pthread_mutex_t lock;        // guards pending, generation, finished
+    pthread_cond_t work;
+    long long pending;           // items pushed and not yet finished
+    unsigned long long generation;
+    int finished;                // workers that have exited
+    atomic_int cancelled;
+    atomic_llong files_searched;
+
+    pthread_mutex_t out_lock;    // guards out, files_matched, hit_total, truncated
+    FileSearchOutputList out;
+    long long files_matched;
+    long long hit_total;
+    int truncated;
+
+    FileSearchHit *hits;         // editor thread only: one per results row
+    long long hit_count, hit_capacity;
+} S = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .out_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int file_search_push_output(FileSearchOutputList *list, FileSearchOutput output) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        FileSearchOutput *grown = realloc(list->items, capacity * sizeof(FileSearchOutput));
+        if (grown == NULL) return -1;
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = output;
+    return 0;
+}
+
+// --- Work-stealing walk ---
+
+static void file_search_push(int worker, char *path, int is_dir) {
+    FileSearchDeque *deque = &S.deques[worker];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > 0 && deque->bottom == deque->top) deque->bottom = deque->top = 0;
+    if (deque->top == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 256;
+        FileSearchItem *grown = realloc(deque->items, capacity * sizeof(FileSearchItem));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            free(path);
+            return;
+        }
+        deque->items = grown;
+        deque->capacity = capacity;
+    }
+    deque->items[deque->top++] = (FileSearchItem){ .path = path, .is_dir = is_dir };
+    pthread_mutex_unlock(&deque->lock);
+
+    pthread_mutex_lock(&S.lock);
+    S.pending++;
+    S.generation++;
+    pthread_cond_signal(&S.work);
+    pthread_mutex_unlock(&S.lock);
+}
+
+// The owner works depth-first from the top; thieves take from the bottom.
+static int file_search_pop(int worker, int steal, FileSearchItem *item) {
+    FileSearchDeque *deque = &S.deques[worker];
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->bottom < deque->top;
+    if (found) *item = steal ? deque->items[deque->bottom++] : deque->items[--deque->top];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Returns 0 once every item pushed by anyone has been finished.
+static int file_search_take(int self, FileSearchItem *item) {
+    while (1) {
+        pthread_mutex_lock(&S.lock);
+        unsigned long long generation = S.generation;
+        long long pending = S.pending;
+        pthread_mutex_unlock(&S.lock);
+        if (pending == 0) return 0;
+
+        if (file_search_pop(self, 0, item)) return 1;
+        for (int i = 1; i < S.worker_count; i++) {
+            if (file_search_pop((self + i) % S.worker_count, 1, item)) return 1;
+        }
+
+        // Everything left is in progress elsewhere; wait for it to finish
+        // or to turn up more work.
+        pthread_mutex_lock(&S.lock);
+        while (S.generation == generation && S.pending > 0) {
+            pthread_cond_wait(&S.work, &S.lock);
+        }
+        pthread_mutex_unlock(&S.lock);
+    }
+}
+
+static void file_search_finish_item() {
+    pthread_mutex_lock(&S.lock);
+    if (--S.pending == 0) pthread_cond_broadcast(&S.work);
+    pthread_mutex_unlock(&S.lock);
+}
+
+static char *file_search_join(const char *dir, const char *name) {
+    if (strcmp(dir, ".") == 0) return strdup(name);
+    size_t dir_len = strlen(dir);
+    int slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char *path = malloc(dir_len + slash + strlen(name) + 1);
+    if (path == NULL) return NULL;
+    memcpy(path, dir, dir_len);
+    if (slash) path[dir_len] = '/';
+    strcpy(path + dir_len + slash, name);
+    return path;
+}
+
+static void file_search_walk(int self, const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL && !atomic_load(&S.cancelled)) {
+        if (entry->d_name[0] == '.') continue;
+        int type = entry->d_type;
+        char *path = file_search_join(dir, entry->d_name);
+        if (path == NULL) continue;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path, &st) == 0) type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR || type == DT_REG) {
+            file_search_push(self, path, type == DT_DIR);
+        } else {
+            free(path);
+        }
+    }
+    closedir(d);
+}
+
+// --- Searching one file ---
+
+typedef struct {
+    const char *path;
+    size_t path_len;
+    FileSearchOutputList found;
+    int failed;
+} FileSearchScan;
+
+static void file_search_emit(FileSearchScan *scan, long long row, long long col, const char *line, size_t line_len) {
+    if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+    if (line_len > FILE_SEARCH_CONTEXT) line_len = FILE_SEARCH_CONTEXT;
+
+    char prefix[64];
+    int prefix_len = snprintf(prefix, sizeof(prefix), ":%lld:%lld: ", row + 1, col + 1);
+    size_t len = scan->path_len + prefix_len + line_len;
+    char *text = malloc(len + 1);
+    if (text == NULL) {
+        scan->failed = 1;
+        return;
+    }
+    memcpy(text, scan->path, scan->path_len);
+    memcpy(text + scan->path_len, prefix, prefix_len);
+    char *out = text + scan->path_len + prefix_len;
+    for (size_t i = 0; i < line_len; i++) {
+        unsigned char c = line[i];
+        out[i] = c < 32 && c != '\t' ? ' ' : c;
+    }
+    text[len] = '\0';
+
+    FileSearchOutput output = {
+        .text = text,
+        .len = len,
+        .hit = { .path_len = scan->path_len, .row = row, .col = col },
+    };
+    if (file_search_push_output(&scan->found, output) == -1) {
+        free(text);
+        scan->failed = 1;
+    }
+}
+
+// Lines are only counted up to each hit, so files without hits never pay
+// for it.
+static void file_search_scan(SearchPattern *pattern, FileSearchScan *scan, const char *data, size_t size) {
+    long long row = 0;
+    size_t counted = 0;
+    size_t from = 0;
+    size_t line_start, start, end;
+    while (!scan->failed && search_next_line(pattern, data, size, from, &line_start, &start, &end)) {
+        while (counted < line_start) {
+            const char *nl = memchr(data + counted, '\n', line_start - counted);
+            if (nl == NULL) break;
+            row++;
+            counted = nl - data + 1;
+        }
+        const char *line_end = memchr(data + start, '\n', size - start);
+        size_t line_len = (line_end ? (size_t)(line_end - data) : size) - line_start;
+        file_search_emit(scan, row, start - line_start, data + line_start, line_len);
+        if (line_end == NULL || atomic_load(&S.cancelled)) break;
+        from = line_end - data + 1;
+    }
+}
+
+static void file_search_file(int self, const char *path) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return;
+    atomic_fetch_add(&S.files_searched, 1);
+
+    if (memchr(data, '\0', size < FILE_SEARCH_BINARY_PROBE ? size : FILE_SEARCH_BINARY_PROBE) == NULL) {
+        FileSearchScan scan = { .path = path, .path_len = strlen(path) };
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+        file_search_scan(S.patterns[self], &scan, data, size);
+        if (scan.found.count > 0) {
+            size_t taken = 0;
+            pthread_mutex_lock(&S.out_lock);
+            for (; taken < scan.found.count && S.hit_total < FILE_SEARCH_MAX_HITS; taken++) {
+                if (file_search_push_output(&S.out, scan.found.items[taken]) == -1) break;
+                S.hit_total++;
+            }
+            S.files_matched++;
+            if (taken < scan.found.count) {
+                S.truncated = 1;
+                atomic_store(&S.cancelled, 1);
+            }
+            pthread_mutex_unlock(&S.out_lock);
+            for (size_t i = taken; i < scan.found.count; i++) free(scan.found.items[i].text);
+            editor_wake();
+        }
+        free(scan.found.items);
+    }
+    munmap((void *)data, size);
+}
+
+static void *file_search_worker(void *arg) {
+    int self = (int)(intptr_t)arg;
+    FileSearchItem item;
+    while (file_search_take(self, &item)) {
+        if (!atomic_load(&S.cancelled)) {
+            if (item.is_dir) {
+                file_search_walk(self, item.path);
+            } else {
+                file_search_file(self, item.path);
+            }
+        }
+        free(item.path);
+        file_search_finish_item();
+    }
+
+    pthread_mutex_lock(&S.lock);
+    S.finished++;
+    pthread_mutex_unlock(&S.lock);
+    editor_wake();
+    return NULL;
+}
+
+// --- Editor side ---
+
+static void file_search_report() {
+    long long files = atomic_load(&S.files_searched);
+    pthread_mutex_lock(&S.out_lock);
+    long long matched = S.files_matched;
+    int truncated = S.truncated;
+    pthread_mutex_unlock(&S.out_lock);
+
+    if (S.running) {
+        editor_set_status_message("Searching for '%s'... %lld matches in %lld of %lld files",
+                                  S.query, S.hit_count, matched, files);
+    } else if (S.hit_count == 0) {
+        editor_set_status_message("No matches for '%s' in %lld files.", S.query, files);
+    } else {
+        editor_set_status_message("'%s': %lld matches in %lld of %lld files%s. Enter opens a match.",
+                                  S.query, S.hit_count, matched, files,
+                                  truncated ? " (stopped at the limit)" : S.interrupted ? " (stopped)" : "");
+    }
+}
+
+// Cancels the walk and waits for the workers; the results stay listed.
+static void file_search_stop_workers() {
+    if (!S.running) return;
+    atomic_store(&S.cancelled, 1);
+    for (int i = 0; i < S.thread_count; i++) {
+        pthread_join(S.threads[i], NULL);
+    }
+    for (int i = 0; i < S.worker_count; i++) {
+        search_free(S.patterns[i]);
+        S.patterns[i] = NULL;
+        free(S.deques[i].items);
+        pthread_mutex_destroy(&S.deques[i].lock);
+    }
+    S.running = 0;
+}
+
+static void file_search_close() {
+    file_search_stop_workers();
+    for (size_t i = 0; i < S.out.count; i++) free(S.out.items[i].text);
+    free(S.out.items);
+    S.out = (FileSearchOutputList){ 0 };
+    free(S.hits);
+    S.hits = NULL;
+    S.hit_count = S.hit_capacity = 0;
+    free(S.query);
+    S.query = NULL;
+}
+
+void editor_file_search_buffer_closed(EditorConfig *config) {
+    if (config != S.results) return;
+    file_search_close();
+    S.results = NULL;
+}
+
+// Moves queued lines into the results buffer; returns how many.
+static size_t file_search_drain() {
+    EditorConfig *E = S.results;
+    pthread_mutex_lock(&S.out_lock);
+    FileSearchOutputList out = S.out;
+    S.out = (FileSearchOutputList){ 0 };
+    pthread_mutex_unlock(&S.out_lock);
+
+    if (out.count > 0 && S.hit_count + (long long)out.count > S.hit_capacity) {
+        long long capacity = S.hit_capacity ? S.hit_capacity : 1024;
+        while (capacity < S.hit_count + (long long)out.count) capacity *= 2;
+        FileSearchHit *grown = realloc(S.hits, capacity * sizeof(FileSearchHit));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (search results).");
+            return 0;
+        }
+        S.hits = grown;
+        S.hit_capacity = capacity;
+    }
+    for (size_t i = 0; i < out.count; i++) {
+        EditorLine line = { .text = out.items[i].text, .len = out.items[i].len };
+        editor_lines_array_append(&E->lines, line);
+        S.hits[S.hit_count++] = out.items[i].hit;
+    }
+    free(out.items);
+    return out.count;
+}
+
+void editor_file_search_poll() {
+    if (!S.running) return;
+
+    pthread_mutex_lock(&S.lock);
+    int finished = S.finished == S.worker_count;
+    pthread_mutex_unlock(&S.lock);
+
+    size_t drained = file_search_drain();
+    if (finished) {
+        file_search_stop_workers();
+        file_search_drain();
+    }
+    if ((finished || drained > 0) && get_editor_config() == S.results) {
+        file_search_report();
+        editor_request_redraw();
+    }
+}
+
+static void file_search_open(long long row) {
+    EditorConfig *E = get_editor_config();
+    FileSearchHit hit = S.hits[row];
+    EditorLine *line = &E->lines.elements[row];
+    editor_line_page_in(line);
+    char *path = strndup(line->text, hit.path_len);
+    if (path == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (search result path).");
+        return;
+    }
+    const char *problem = editor_file_unreadable(path, 0);
+    if (problem) {
+        editor_set_status_message("Cannot open %s: %s", path, problem);
+        free(path);
+        return;
+    }
+
+    // The results stay in their buffer for the next match.
+    int index = editor_buffer_find(path);
+    if (index != -1) {
+        editor_buffer_switch(index);
+    } else {
+        editor_buffer_new();
+        editor_open_file(path);
+    }
+    free(path);
+    E = get_editor_config();
+    if (hit.row < E->lines.size) {
+        E->cy = hit.row;
+        E->cx = hit.col;
+    }
+    editor_request_redraw();
+}
+
+int editor_file_search_handle_key(int c) {
+    EditorConfig *E = get_editor_config();
+    if (E != S.results) return 0;
+
+    switch (c) {
+        case '\r':
+        case '\n':
+            if (E->cy < S.hit_count) file_search_open(E->cy);
+            return 1;
+        case 27:
+            if (S.running) {
+                S.interrupted = 1;
+                file_search_stop_workers();
+                file_search_drain();
+                file_search_report();
+            }
+            return 1;
+    }
+    // Anything else that would change the results is refused by the
+    // editing paths, which check the buffer's read_only.
+    return 0;
+}
+
+// Starts the workers on root; takes ownership of query and root.
+static void file_search_start(char *query, char *root, int root_is_dir) {
+    const char *error = NULL;
+    S.results = get_editor_config();
+    S.results->read_only = "Search results are read-only. Enter opens a match, Ctrl+P searches again.";
+    S.query = query;
+    S.worker_count = parallel_worker_count();
+    S.pending = 0;
+    S.finished = 0;
+    S.files_matched = 0;
+    S.hit_total = 0;
+    S.truncated = 0;
+    S.interrupted = 0;
+    atomic_store(&S.cancelled, 0);
+    atomic_store(&S.files_searched, 0);
+    for (int i = 0; i < S.worker_count; i++) {
+        S.patterns[i] = editor_compile_query(query, &error);
+        S.deques[i] = (FileSearchDeque){ 0 };
+        pthread_mutex_init(&S.deques[i].lock, NULL);
+    }
+    file_search_push(0, root, root_is_dir);
+
+    // A worker that cannot be started leaves its share to the others.
+    S.running = 1;
+    S.thread_count = 0;
+    for (int i = 0; i < S.worker_count; i++) {
+        if (pthread_create(&S.threads[S.thread_count], NULL, file_search_worker, (void *)(intptr_t)i) == 0) S.thread_count++;
+    }
+    if (S.thread_count == 0) {
+        editor_handle_error(ERR_FILE_OPERATION, "Failed to start search threads.");
+        return;
+    }
+    pthread_mutex_lock(&S.lock);
+    S.finished += S.worker_count - S.thread_count;
+    pthread_mutex_unlock(&S.lock);
+    file_search_report();
+}
+
+void editor_file_search() {
+    char *query = editor_prompt("Search in files (/regex/iw for patterns, ESC to cancel): %s");
+    if (query == NULL) return;
+    const char *error = NULL;
+    SearchPattern *pattern = editor_compile_query(query, &error);
+    if (pattern == NULL) {
+        editor_set_status_message("Invalid pattern: %s", error ? error : "empty");
+        free(query);
+        return;
+    }
+    search_free(pattern);
+
+    char *dir = editor_prompt_allow_empty("In directory (Enter for the current one): %s");
+    if (dir == NULL) {
+        free(query);
+        return;
+    }
+    if (*dir == '\0') {
+        free(dir);
+        dir = strdup(".");
+        if (dir == NULL) editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (search directory).");
+    }
+    struct stat st;
+    if (stat(dir, &st) == -1) {
+        editor_set_status_message("Cannot search %s: %s", dir, strerror(errno));
+        free(query);
+        free(dir);
+        return;
+    }
+
+    // A new search reuses the buffer of the last one.
+    if (S.results != NULL) {
+        editor_buffer_switch(editor_buffer_index_of(S.results));
+        file_search_close();
+        editor_reset_buffer();
+    } else {
+        editor_buffer_new();
+    }
+    file_search_start(query, dir, S_ISDIR(st.st_mode));
+}
@@ -0,0 +1,19 @@
+#ifndef FILESEARCH_H
+#define FILESEARCH_H
+
+// Search in files (Ctrl+P). The matching lines of every file under a
+// directory are listed in a read-only buffer of their own as they are
+// found; Enter on one opens that file at the match.
+
+struct EditorConfig;
+
+void editor_file_search();
+// Called from the event loop: appends lines found since the last call.
+void editor_file_search_poll();
+// Handles keys that mean something else in the results buffer. Returns 1
+// if the key was used.
+int editor_file_search_handle_key(int c);
+// Stops the search whose results are in config, which is being closed.
+void editor_file_search_buffer_closed(struct EditorConfig *config);
+
+#endif // FILESEARCH_H
@@ -0,0 +1,412 @@
+#define _GNU_SOURCE // splice, pipe2, F_SETPIPE_SZ
+
+#include "filter.h"
+#include "editor.h"
+#include "event_loop.h"
+#include "file.h"
+#include "input.h"
+#include "swap.h"
+#include "ui.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+// The range goes to the command's stdin and its stdout is read back at the
+// same time from one poll loop, so neither side can fill a pipe and wait on
+// the other. Input is streamed the way a save writes the file: unmodified
+// lines are spliced straight from the file they were loaded from and
+// swapped-out lines from the swap file, without passing through the editor,
+// and the rest goes out as large writev batches pointing at the line text.
+// The output is cut into lines in one parallel pass and spliced into the
+// buffer in place of the range.
+
+#define FILTER_IOV_BATCH 1024
+#define FILTER_SPLICE_MIN (64 * 1024)
+#define FILTER_BOUNCE_SIZE (1 << 20)
+#define FILTER_READ_MIN (1 << 20)
+#define FILTER_PIPE_SIZE (1 << 20)
+#define FILTER_ERROR_MAX 256
+#define FILTER_PROGRESS_MS 250
+
+typedef struct {
+    EditorLinesArray *lines;
+    long long row, end;         // next row to stream; end of the range
+    int source_fd;              // file the lines were loaded from, or -1
+    int use_splice;
+    // The span being streamed: bytes at span_offset in span_fd (-1 for the
+    // compressed swap), or lines gathered in iov.
+    int span_fd;
+    off_t span_offset;
+    size_t span_left;
+    struct iovec iov[FILTER_IOV_BATCH];
+    int iov_pos, iov_count;
+    char *bounce;               // span bytes that cannot be spliced
+    size_t bounce_pos, bounce_len;
+    size_t bytes;
+} FilterInput;
+
+typedef struct {
+    char *data;
+    size_t len, capacity;
+} FilterOutput;
+
+static void filter_next_span(FilterInput *in) {
+    static char newline[] = "\n";
+    EditorLine *lines = in->lines->elements;
+    long long i = in->row;
+    long long run_end_line = i;
+
+    if (in->source_fd != -1 && lines[i].disk_clean) {
+        off_t run_start = lines[i].disk_offset;
+        off_t run_end = run_start;
+        while (run_end_line < in->end && lines[run_end_line].disk_clean &&
+               lines[run_end_line].disk_offset == run_end) {
+            run_end += lines[run_end_line].len + 1;
+            run_end_line++;
+        }
+        if (run_end - run_start >= FILTER_SPLICE_MIN) {
+            in->span_fd = in->source_fd;
+            in->span_offset = run_start;
+            in->span_left = run_end - run_start;
+            in->row = run_end_line;
+            return;
+        }
+    }
+    if (lines[i].swapped) {
+        off_t run_start = lines[i].swap_offset;
+        off_t run_end = run_start;
+        while (i < in->end && lines[i].swapped && lines[i].swap_offset == run_end) {
+            run_end += lines[i].len + 1;
+            i++;
+        }
+        in->span_fd = editor_swap_fd();
+        in->span_offset = run_start;
+        in->span_left = run_end - run_start;
+        in->row = i;
+        return;
+    }
+
+    // A clean line past the short run just measured may start a long one.
+    int count = 0;
+    for (; i < in->end && !lines[i].swapped && count < FILTER_IOV_BATCH; i++) {
+        if (i > in->row && i >= run_end_line && in->source_fd != -1 && lines[i].disk_clean) break;
+        in->iov[count].iov_base = lines[i].text;
+        in->iov[count].iov_len = lines[i].len;
+        in->iov[count + 1].iov_base = newline;
+        in->iov[count + 1].iov_len = 1;
+        count += 2;
+    }
+    in->iov_pos = 0;
+    in->iov_count = count;
+    in->row = i;
+}
+
+// Writes to the command's stdin until the pipe is full. Returns 1 once the
+// whole range is out, 0 if the pipe is full, -1 on error.
+static int filter_feed(FilterInput *in, int fd) {
+    while (1) {
+        if (in->bounce_pos < in->bounce_len) {
+            ssize_t n = write(fd, in->bounce + in->bounce_pos, in->bounce_len - in->bounce_pos);
+            if (n == -1) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+            in->bounce_pos += n;
+            in->bytes += n;
+            continue;
+        }
+        if (in->iov_pos < in->iov_count) {
+            ssize_t n = writev(fd, in->iov + in->iov_pos, in->iov_count - in->iov_pos);
+            if (n == -1) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+            in->bytes += n;
+            while (in->iov_pos < in->iov_count && (size_t)n >= in->iov[in->iov_pos].iov_len) {
+                n -= in->iov[in->iov_pos].iov_len;
+                in->iov_pos++;
+            }
+            if (in->iov_pos < in->iov_count) {
+                in->iov[in->iov_pos].iov_base = (char *)in->iov[in->iov_pos].iov_base + n;
+                in->iov[in->iov_pos].iov_len -= n;
+            }
+            continue;
+        }
+        if (in->span_left > 0) {
+            if (in->span_fd != -1 && in->use_splice) {
+                ssize_t n = splice(in->span_fd, &in->span_offset, fd, NULL, in->span_left, SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+                if (n > 0) {
+                    in->span_left -= n;
+                    in->bytes += n;
+                    continue;
+                }
+                if (n == -1 && (errno == EAGAIN || errno == EINTR)) return 0;
+                if (n == 0) {
+                    errno = EIO; // the file shrank underneath us
+                    return -1;
+                }
+                if (errno != EINVAL && errno != ENOSYS) return -1;
+                in->use_splice = 0;
+            }
+            size_t want = in->span_left < FILTER_BOUNCE_SIZE ? in->span_left : FILTER_BOUNCE_SIZE;
+            if (in->span_fd == -1) {
+                size_t available;
+                const char *text = editor_swap_peek(in->span_offset, &available);
+                if (text == NULL) return -1;
+                if (available < want) want = available;
+                memcpy(in->bounce, text, want);
+            } else {
+                ssize_t n = pread(in->span_fd, in->bounce, want, in->span_offset);
+                if (n == -1 && errno == EINTR) continue;
+                if (n <= 0) {
+                    if (n == 0) errno = EIO;
+                    return -1;
+                }
+                want = n;
+            }
+            in->span_offset += want;
+            in->span_left -= want;
+            in->bounce_pos = 0;
+            in->bounce_len = want;
+            continue;
+        }
+        if (in->row >= in->end) return 1;
+        filter_next_span(in);
+    }
+}
+
+// Reads what the command has printed so far. Returns 1 at end of file, 0 if
+// there is nothing more yet, -1 on error.
+static int filter_drain(FilterOutput *out, int fd) {
+    while (1) {
+        if (out->capacity - out->len < FILTER_READ_MIN) {
+            size_t capacity = out->capacity ? out->capacity * 2 : 4 * FILTER_READ_MIN;
+            char *grown = realloc(out->data, capacity);
+            if (grown == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            out->data = grown;
+            out->capacity = capacity;
+        }
+        ssize_t n = read(fd, out->data + out->len, out->capacity - out->len);
+        if (n == 0) return 1;
+        if (n == -1) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        out->len += n;
+    }
+}
+
+static long long filter_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Starts /bin/sh -c command with its stdin, stdout and stderr on pipes whose
+// editor ends are returned non-blocking in fds.
+static pid_t filter_spawn(const char *command, int fds[3]) {
+    int pipes[3][2];
+    for (int i = 0; i < 3; i++) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            return -1;
+        }
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGPIPE, SIG_DFL);
+        dup2(pipes[0][0], STDIN_FILENO);
+        dup2(pipes[1][1], STDOUT_FILENO);
+        dup2(pipes[2][1], STDERR_FILENO);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+
+    close(pipes[0][0]);
+    close(pipes[1][1]);
+    close(pipes[2][1]);
+    fds[0] = pipes[0][1];
+    fds[1] = pipes[1][0];
+    fds[2] = pipes[2][0];
+    if (pid == -1) {
+        for (int i = 0; i < 3; i++) close(fds[i]);
+        return -1;
+    }
+    for (int i = 0; i < 3; i++) fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    // Fewer, larger transfers; the default 64 KB is fine if this fails.
+    fcntl(fds[0], F_SETPIPE_SZ, FILTER_PIPE_SIZE);
+    fcntl(fds[1], F_SETPIPE_SZ, FILTER_PIPE_SIZE);
+    return pid;
+}
+
+// Asks which lines to filter: "N-M", "N", or Enter for the whole buffer.
+// Returns -1 if the answer is not a range of the buffer.
+static int filter_ask_range(EditorConfig *E, long long *first, long long *end) {
+    char *answer = editor_prompt_allow_empty("Lines to filter (N-M; Enter: whole buffer): %s");
+    if (answer == NULL) return -1;
+    *first = 0;
+    *end = E->lines.size;
+    if (answer[0] != '\0') {
+        char *p;
+        errno = 0;
+        long long from = strtoll(answer, &p, 10);
+        long long to = from;
+        if (*p == '-') to = strtoll(p + 1, &p, 10);
+        if (errno || *p != '\0' || from < 1 || from > E->lines.size || to < from) {
+            editor_set_status_message("Invalid range: %s", answer);
+            free(answer);
+            return -1;
+        }
+        *first = from - 1;
+        *end = to < E->lines.size ? to : E->lines.size;
+    }
+    free(answer);
+    return 0;
+}
+
+void editor_filter() {
+    EditorConfig *E = get_editor_config();
+    if (editor_check_read_only()) return;
+    char *command = editor_prompt("Filter through command (ESC to cancel): %s");
+    if (command == NULL) return;
+    long long first, end;
+    if (filter_ask_range(E, &first, &end) == -1) {
+        free(command);
+        return;
+    }
+
+    // A command that stops reading early must not take the editor down
+    // with SIGPIPE; writing just fails with EPIPE instead.
+    struct sigaction ignore = { .sa_handler = SIG_IGN }, saved;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, &saved);
+
+    int fds[3];
+    pid_t pid = filter_spawn(command, fds);
+    if (pid == -1) {
+        sigaction(SIGPIPE, &saved, NULL);
+        editor_set_status_message("Filter error: cannot run command: %s", strerror(errno));
+        free(command);
+        return;
+    }
+
+    FilterInput in = {
+        .lines = &E->lines,
+        .row = first,
+        .end = end,
+        .source_fd = editor_open_loaded_file(E->filename, &E->disk_stat),
+        .use_splice = 1,
+        .bounce = malloc(FILTER_BOUNCE_SIZE),
+    };
+    FilterOutput out = { 0 };
+    char error[FILTER_ERROR_MAX];
+    size_t error_len = 0;
+    const char *failure = NULL;
+    int failure_errno = 0;
+    long long started = filter_now_ms();
+    long long progress_at = started + FILTER_PROGRESS_MS;
+
+    if (in.bounce == NULL) {
+        failure = "out of memory";
+        failure_errno = ENOMEM;
+    }
+    while (failure == NULL && (fds[0] != -1 || fds[1] != -1 || fds[2] != -1)) {
+        struct pollfd polls[3];
+        for (int i = 0; i < 3; i++) {
+            polls[i].fd = fds[i];
+            polls[i].events = i == 0 ? POLLOUT : POLLIN;
+            polls[i].revents = 0;
+        }
+        if (poll(polls, 3, FILTER_PROGRESS_MS) == -1 && errno != EINTR) {
+            failure = "poll failed";
+            failure_errno = errno;
+            break;
+        }
+
+        if (fds[0] != -1 && polls[0].revents) {
+            int result = filter_feed(&in, fds[0]);
+            // EPIPE: the command has read all it wants.
+            if (result == -1 && errno != EPIPE) {
+                failure = "cannot send the lines";
+                failure_errno = errno;
+            }
+            if (result != 0) {
+                close(fds[0]);
+                fds[0] = -1;
+            }
+        }
+        if (fds[1] != -1 && polls[1].revents) {
+            int result = filter_drain(&out, fds[1]);
+            if (result == -1) {
+                failure = "cannot read the output";
+                failure_errno = errno;
+            }
+            if (result != 0) {
+                close(fds[1]);
+                fds[1] = -1;
+            }
+        }
+        if (fds[2] != -1 && polls[2].revents) {
+            char discard[4096];
+            ssize_t n = read(fds[2], discard, sizeof(discard));
+            if (n > 0 && error_len < sizeof(error) - 1) {
+                size_t keep = (size_t)n < sizeof(error) - 1 - error_len ? (size_t)n : sizeof(error) - 1 - error_len;
+                memcpy(error + error_len, discard, keep);
+                error_len += keep;
+            }
+            if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+                close(fds[2]);
+                fds[2] = -1;
+            }
+        }
+
+        if (editor_input_cancel_requested()) {
+            failure = "cancelled";
+            break;
+        }
+        if (filter_now_ms() >= progress_at) {
+            editor_set_status_message("Filtering through '%s': %.1f MB in, %.1f MB out (ESC cancels)",
+                                      command, in.bytes / (1024.0 * 1024.0), out.len / (1024.0 * 1024.0));
+            editor_refresh_screen();
+            progress_at = filter_now_ms() + FILTER_PROGRESS_MS;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1) close(fds[i]);
+    }
+    if (failure) kill(pid, SIGTERM);
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    sigaction(SIGPIPE, &saved, NULL);
+    if (in.source_fd != -1) close(in.source_fd);
+    free(in.bounce);
+
+    error[error_len] = '\0';
+    char *newline = strchr(error, '\n');
+    if (newline) *newline = '\0';
+
+    if (failure && failure_errno) {
+        editor_set_status_message("Filter error: %s: %s", failure, strerror(failure_errno));
+    } else if (failure) {
+        editor_set_status_message("Filter %s; the buffer is unchanged.", failure);
+    } else if (WIFSIGNALED(status)) {
+        editor_set_status_message("Filter killed by signal %d; the buffer is unchanged. %s", WTERMSIG(status), error);
+    } else if (WEXITSTATUS(status) != 0) {
+        editor_set_status_message("Filter exited with status %d; the buffer is unchanged. %s", WEXITSTATUS(status), error);
+    } else {
+        long long lines = editor_splice_rows(first, end - first, out.data ? out.data : "", out.len);
+        editor_set_status_message("Filtered %lld line%s into %lld in %.1fs (%.1f MB): %s",
+                                  end - first, end - first == 1 ? "" : "s", lines,
+                                  (filter_now_ms() - started) / 1000.0, out.len / (1024.0 * 1024.0), command);
+    }
+    editor_request_redraw();
+    free(out.data);
+    free(command);
+}
@@ -0,0 +1,10 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+// Ctrl+X pipes a range of lines, or the whole buffer, through a shell
+// command and replaces them with what it prints, as one undo step. The
+// buffer is left alone if the command fails or is cancelled with ESC.
+
+void editor_filter();
+
+#endif // FILTER_H
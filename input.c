@@ -0,0 +1,250 @@
+#include "input.h"
+#include "editor.h"
+#include "event_loop.h"
+#include "vt100.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INPUT_RING_SIZE 4096 // power of two
+#define INPUT_ESC_TIMEOUT_MS 25
+
+typedef struct {
+    int key;
+    MEVENT mouse;
+} InputEvent;
+
+// head is only written by the editor thread, tail only by the input thread;
+// each side publishes its index with release and reads the other's with
+// acquire, which is all the ordering a single-producer ring needs.
+static InputEvent ring[INPUT_RING_SIZE];
+static atomic_size_t ring_head;
+static atomic_size_t ring_tail;
+
+static volatile sig_atomic_t resize_pending;
+static MEVENT last_mouse;
+
+static void handle_winch(int sig) {
+    (void)sig;
+    resize_pending = 1;
+    editor_wake();
+}
+
+static void input_push(int key, const MEVENT *mouse) {
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    // Never drop keys: if the editor is this far behind, wait for it.
+    while (tail - atomic_load_explicit(&ring_head, memory_order_acquire) == INPUT_RING_SIZE) {
+        struct timespec pause = { 0, 1000000 };
+        nanosleep(&pause, NULL);
+    }
+    InputEvent *ev = &ring[tail & (INPUT_RING_SIZE - 1)];
+    ev->key = key;
+    if (mouse) ev->mouse = *mouse;
+    atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+}
+
+int editor_input_pop(int *key) {
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring_tail, memory_order_acquire)) return 0;
+    InputEvent *ev = &ring[head & (INPUT_RING_SIZE - 1)];
+    *key = ev->key;
+    if (ev->key == KEY_MOUSE) last_mouse = ev->mouse;
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+    return 1;
+}
+
+int editor_input_pending() {
+    return atomic_load_explicit(&ring_head, memory_order_relaxed) !=
+           atomic_load_explicit(&ring_tail, memory_order_acquire);
+}
+
+// Lets long-running work notice an ESC or Ctrl+C typed while it runs. The
+// key stays queued so it is still processed normally afterwards.
+int editor_input_cancel_requested() {
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+    for (size_t i = head; i != tail; i++) {
+        int key = ring[i & (INPUT_RING_SIZE - 1)].key;
+        if (key == 27 || key == CTRL('c')) return 1;
+    }
+    return 0;
+}
+
+int editor_get_mouse(MEVENT *event) {
+    *event = last_mouse;
+    return OK;
+}
+
+int editor_input_take_resize() {
+    if (!resize_pending) return 0;
+    resize_pending = 0;
+    return 1;
+}
+
+// Decoder. Reads bytes from the terminal; escape sequences are resolved
+// here into ncurses key codes so the editor thread never touches stdin.
+
+typedef struct {
+    unsigned char buf[4096];
+    size_t len, pos;
+} InputReader;
+
+// Returns the next byte, or -1 if none arrives within timeout_ms (-1 waits
+// forever).
+static int input_next_byte(InputReader *r, int timeout_ms) {
+    if (r->pos < r->len) return r->buf[r->pos++];
+    if (timeout_ms >= 0) {
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+    }
+    while (1) {
+        ssize_t n = read(STDIN_FILENO, r->buf, sizeof(r->buf));
+        if (n > 0) {
+            r->len = n;
+            r->pos = 0;
+            return r->buf[r->pos++];
+        }
+        if (n == 0) return -1;
+        if (errno != EINTR) return -1;
+    }
+}
+
+static int input_csi_tilde(int code) {
+    switch (code) {
+        case 1: case 7: return KEY_HOME;
+        case 2: return KEY_IC;
+        case 3: return KEY_DC;
+        case 4: case 8: return KEY_END;
+        case 5: return KEY_PPAGE;
+        case 6: return KEY_NPAGE;
+        default: return -1;
+    }
+}
+
+static int input_final_key(int final) {
+    switch (final) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        default: return -1;
+    }
+}
+
+static void input_mouse(int button, int x, int y, int release) {
+    MEVENT event;
+    memset(&event, 0, sizeof(event));
+    event.x = x;
+    event.y = y;
+    if (button & 32) return; // motion report
+    if ((button & 64) == 0) {
+        if ((button & 3) != 0 || release) return;
+        event.bstate = BUTTON1_CLICKED;
+    } else {
+        event.bstate = (button & 1) ? BUTTON5_PRESSED : BUTTON4_PRESSED;
+    }
+    input_push(KEY_MOUSE, &event);
+}
+
+static void input_decode_escape(InputReader *r) {
+    int c = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+    if (c == -1) {
+        input_push(27, NULL);
+        return;
+    }
+    if (c == 'O') {
+        int final = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+        int key = input_final_key(final);
+        if (key != -1) input_push(key, NULL);
+        return;
+    }
+    if (c != '[') {
+        input_push(27, NULL);
+        input_push(c, NULL);
+        return;
+    }
+
+    c = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+    if (c == 'M') {
+        // X10 mouse report: three bytes offset by 32, 1-based coordinates.
+        int b = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+        int x = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+        int y = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+        if (b == -1 || x == -1 || y == -1) return;
+        input_mouse(b - 32, x - 33, y - 33, (b - 32) == 3);
+        return;
+    }
+
+    int sgr_mouse = (c == '<');
+    if (sgr_mouse) c = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+
+    int params[4] = { 0, 0, 0, 0 };
+    int nparams = 0;
+    while (c != -1 && ((c >= '0' && c <= '9') || c == ';')) {
+        if (c == ';') {
+            if (nparams < 3) nparams++;
+        } else {
+            params[nparams] = params[nparams] * 10 + (c - '0');
+        }
+        c = input_next_byte(r, INPUT_ESC_TIMEOUT_MS);
+    }
+    if (c == -1) return;
+
+    if (sgr_mouse) {
+        // SGR mouse report: ESC [ < button ; x ; y (M|m), 1-based.
+        input_mouse(params[0], params[1] - 1, params[2] - 1, c == 'm');
+        return;
+    }
+    int key = (c == '~') ? input_csi_tilde(params[0]) : input_final_key(c);
+    if (key != -1) input_push(key, NULL);
+}
+
+static void *input_thread(void *arg) {
+    (void)arg;
+    InputReader reader = { .len = 0, .pos = 0 };
+    while (1) {
+        int c = input_next_byte(&reader, -1);
+        if (c == -1) {
+            // stdin is gone (hangup); sleep rather than spin.
+            struct timespec pause = { 0, 100000000 };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        if (c == 27) {
+            input_decode_escape(&reader);
+        } else if (c == 127) {
+            input_push(KEY_BACKSPACE, NULL);
+        } else {
+            input_push(c, NULL);
+        }
+        // Only wake the editor once per burst of input.
+        if (reader.pos == reader.len) editor_wake();
+    }
+    return NULL;
+}
+
+void editor_input_start() {
+    // ncurses peeks at stdin during refresh to abort on typeahead; stdin
+    // belongs to the input thread now.
+    if (!vt100_backend_active) typeahead(-1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_winch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, input_thread, NULL) == 0) {
+        pthread_detach(thread);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <ncurses.h>
+
+// Terminal input is read and decoded on its own thread and handed to the
+// editor thread through a lock-free single-producer/single-consumer ring.
+// Keys use the same codes getch() would return (KEY_UP, 127, ...).
+
+void editor_input_start();
+int editor_input_pop(int *key);
+int editor_input_pending();
+int editor_input_cancel_requested();
+int editor_input_take_resize();
+int editor_get_mouse(MEVENT *event);
+
+#endif // INPUT_H
@@ -0,0 +1,132 @@
+#include "intern.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The table is split into stripes, each with its own lock and bucket array,
+// so the parallel loader rarely contends. Entries are freed as soon as
+// their last line lets go of them.
+
+#define INTERN_STRIPE_BITS 6
+#define INTERN_STRIPES (1 << INTERN_STRIPE_BITS)
+#define INTERN_INITIAL_BUCKETS 256
+
+typedef struct InternEntry {
+    struct InternEntry *next;
+    uint64_t hash;
+    size_t len;
+    size_t refs;
+    char text[];
+} InternEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    InternEntry **buckets;
+    size_t bucket_count;
+    size_t count;
+} InternStripe;
+
+static InternStripe stripes[INTERN_STRIPES];
+static int intern_enabled;
+
+void editor_intern_init() {
+    const char *intern = getenv("ERWINTEXT_INTERN");
+    if (intern == NULL || *intern == '\0' || strcmp(intern, "0") == 0) return;
+
+    for (int i = 0; i < INTERN_STRIPES; i++) {
+        pthread_mutex_init(&stripes[i].lock, NULL);
+    }
+    intern_enabled = 1;
+}
+
+int editor_intern_enabled() {
+    return intern_enabled;
+}
+
+static uint64_t intern_hash(const char *text, size_t len) {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)text[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static InternStripe *intern_stripe(uint64_t hash) {
+    return &stripes[hash >> (64 - INTERN_STRIPE_BITS)];
+}
+
+// Doubles the stripe's bucket array; the caller holds its lock.
+static int intern_rehash(InternStripe *stripe) {
+    size_t new_count = stripe->bucket_count ? stripe->bucket_count * 2 : INTERN_INITIAL_BUCKETS;
+    InternEntry **buckets = calloc(new_count, sizeof(InternEntry *));
+    if (buckets == NULL) return -1;
+
+    for (size_t i = 0; i < stripe->bucket_count; i++) {
+        InternEntry *entry = stripe->buckets[i];
+        while (entry) {
+            InternEntry *next = entry->next;
+            size_t b = entry->hash & (new_count - 1);
+            entry->next = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    free(stripe->buckets);
+    stripe->buckets = buckets;
+    stripe->bucket_count = new_count;
+    return 0;
+}
+
+char *editor_intern(const char *text, size_t len) {
+    uint64_t hash = intern_hash(text, len);
+    InternStripe *stripe = intern_stripe(hash);
+
+    pthread_mutex_lock(&stripe->lock);
+    if (stripe->count >= stripe->bucket_count && intern_rehash(stripe) == -1) {
+        pthread_mutex_unlock(&stripe->lock);
+        return NULL;
+    }
+
+    InternEntry **bucket = &stripe->buckets[hash & (stripe->bucket_count - 1)];
+    for (InternEntry *entry = *bucket; entry; entry = entry->next) {
+        if (entry->hash == hash && entry->len == len && memcmp(entry->text, text, len) == 0) {
+            entry->refs++;
+            pthread_mutex_unlock(&stripe->lock);
+            return entry->text;
+        }
+    }
+
+    InternEntry *entry = malloc(sizeof(InternEntry) + len + 1);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&stripe->lock);
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->len = len;
+    entry->refs = 1;
+    memcpy(entry->text, text, len);
+    entry->text[len] = '\0';
+    entry->next = *bucket;
+    *bucket = entry;
+    stripe->count++;
+    pthread_mutex_unlock(&stripe->lock);
+    return entry->text;
+}
+
+void editor_intern_release(char *text) {
+    InternEntry *entry = (InternEntry *)(text - offsetof(InternEntry, text));
+    InternStripe *stripe = intern_stripe(entry->hash);
+
+    pthread_mutex_lock(&stripe->lock);
+    if (--entry->refs == 0) {
+        InternEntry **link = &stripe->buckets[entry->hash & (stripe->bucket_count - 1)];
+        while (*link != entry) link = &(*link)->next;
+        *link = entry->next;
+        stripe->count--;
+        free(entry);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+}
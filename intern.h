@@ -0,0 +1,17 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+// Optional line interning, enabled with ERWINTEXT_INTERN. Identical line
+// contents share one reference-counted, read-only copy; a line that is
+// about to be edited takes a private copy first (editor_line_make_writable).
+// Safe to call from the loader's worker threads.
+
+void editor_intern_init();
+int editor_intern_enabled();
+// Returns a shared, NUL-terminated copy of text, or NULL when out of memory.
+char *editor_intern(const char *text, size_t len);
+void editor_intern_release(char *text);
+
+#endif // INTERN_H
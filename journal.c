@@ -0,0 +1,457 @@
+#include "journal.h"
+#include "editor.h"
+#include "syntax.h"
+#include "cursors.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// On-disk layout: a JournalHeader identifying the base file, followed by
+// JournalRecords (each optionally followed by payload_len bytes). Records are
+// checksummed so a torn tail from a crash is detected and dropped on replay.
+//
+// The editor thread only appends to an in-memory batch; a writer thread
+// takes whatever has accumulated, writes it with one write() and one
+// fdatasync(), and goes back to sleep. Records arriving while a sync is in
+// flight ride along with the next batch (group commit).
+//
+// Every buffer has its own journal and writer; the functions below act on
+// the current buffer's.
+
+#define JOURNAL_MAGIC "ERWJ0001"
+#define JOURNAL_RECORD_MAGIC 0x4a524557u
+
+typedef struct {
+    char magic[8];
+    int64_t base_size;    // -1 if the file did not exist yet
+    int64_t base_ino;
+    int64_t base_mtime_sec;
+    int64_t base_mtime_nsec;
+} JournalHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    int64_t row;
+    int64_t col;
+    int32_t arg;
+    uint32_t payload_len;
+    uint32_t checksum;
+    uint32_t reserved;
+} JournalRecord;
+
+struct Journal {
+    int fd;
+    int stopping;
+    char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    unsigned long checkpoints; // a batch taken before a checkpoint is stale
+    pthread_t writer;
+    pthread_mutex_t lock;      // guards pending/stopping/checkpoints
+    pthread_mutex_t io_lock;   // serializes writes to fd with checkpoints
+    pthread_cond_t wake;
+    char *path;
+};
+
+static char *journal_path(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    size_t dir_len = slash ? (size_t)(slash - filename + 1) : 0;
+    const char *base = slash ? slash + 1 : filename;
+    size_t len = dir_len + strlen(base) + 6;
+    char *path = malloc(len);
+    if (path == NULL) return NULL;
+    snprintf(path, len, "%.*s.%s.ewj", (int)dir_len, filename, base);
+    return path;
+}
+
+static uint32_t journal_hash(uint32_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t journal_checksum(const JournalRecord *rec, const char *payload) {
+    JournalRecord copy = *rec;
+    copy.checksum = 0;
+    uint32_t hash = journal_hash(2166136261u, &copy, sizeof(copy));
+    return journal_hash(hash, payload, rec->payload_len);
+}
+
+static void journal_fill_header(JournalHeader *header, const struct stat *base) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+    if (base == NULL || base->st_nlink == 0) {
+        header->base_size = -1;
+        return;
+    }
+    header->base_size = base->st_size;
+    header->base_ino = base->st_ino;
+    header->base_mtime_sec = base->st_mtim.tv_sec;
+    header->base_mtime_nsec = base->st_mtim.tv_nsec;
+}
+
+static int journal_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *journal_writer(void *arg) {
+    Journal *J = arg;
+    char *batch = NULL;
+    size_t batch_cap = 0;
+
+    pthread_mutex_lock(&J->lock);
+    while (1) {
+        while (J->pending_len == 0 && !J->stopping) {
+            pthread_cond_wait(&J->wake, &J->lock);
+        }
+        if (J->pending_len == 0 && J->stopping) break;
+
+        // Swap buffers so the editor can keep appending while we sync.
+        char *tmp = batch;
+        size_t tmp_cap = batch_cap;
+        batch = J->pending;
+        batch_cap = J->pending_cap;
+        size_t batch_len = J->pending_len;
+        J->pending = tmp;
+        J->pending_cap = tmp_cap;
+        J->pending_len = 0;
+        unsigned long checkpoints = J->checkpoints;
+        pthread_mutex_unlock(&J->lock);
+
+        // A checkpoint that got in between has already truncated the log;
+        // appending the batch after its header would replay saved edits.
+        pthread_mutex_lock(&J->io_lock);
+        pthread_mutex_lock(&J->lock);
+        int stale = checkpoints != J->checkpoints;
+        pthread_mutex_unlock(&J->lock);
+        if (!stale && J->fd != -1 && journal_write_all(J->fd, batch, batch_len) == 0) {
+            fdatasync(J->fd);
+        }
+        pthread_mutex_unlock(&J->io_lock);
+
+        pthread_mutex_lock(&J->lock);
+    }
+    pthread_mutex_unlock(&J->lock);
+    free(batch);
+    return NULL;
+}
+
+static int journal_write_header(int fd, const struct stat *base) {
+    JournalHeader header;
+    journal_fill_header(&header, base);
+    if (journal_write_all(fd, (const char *)&header, sizeof(header)) == -1) return -1;
+    return fdatasync(fd);
+}
+
+void journal_start(const char *filename, const struct stat *base, int resume) {
+    EditorConfig *E = get_editor_config();
+    if (E->journal) return;
+
+    Journal *J = calloc(1, sizeof(Journal));
+    if (J == NULL) return;
+    J->fd = -1;
+    J->path = journal_path(filename);
+    if (J->path == NULL) {
+        free(J);
+        return;
+    }
+
+    if (resume) {
+        J->fd = open(J->path, O_WRONLY | O_APPEND);
+    }
+    if (J->fd == -1) {
+        J->fd = open(J->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+        if (J->fd != -1 && journal_write_header(J->fd, base) == -1) {
+            close(J->fd);
+            J->fd = -1;
+        }
+    }
+    if (J->fd == -1) {
+        free(J->path);
+        free(J);
+        return;
+    }
+
+    pthread_mutex_init(&J->lock, NULL);
+    pthread_mutex_init(&J->io_lock, NULL);
+    pthread_cond_init(&J->wake, NULL);
+    if (pthread_create(&J->writer, NULL, journal_writer, J) != 0) {
+        pthread_cond_destroy(&J->wake);
+        pthread_mutex_destroy(&J->io_lock);
+        pthread_mutex_destroy(&J->lock);
+        close(J->fd);
+        free(J->path);
+        free(J);
+        return;
+    }
+    E->journal = J;
+}
+
+// The payload is head followed by body, so a large body is copied only once,
+// straight into the batch.
+static void journal_append(JournalOp op, long long row, long long col, int arg,
+                           const char *head, size_t head_len, const char *body, size_t body_len) {
+    Journal *J = get_editor_config()->journal;
+    if (J == NULL) return;
+
+    size_t payload_len = head_len + body_len;
+    JournalRecord rec = {
+        .magic = JOURNAL_RECORD_MAGIC,
+        .op = op,
+        .row = row,
+        .col = col,
+        .arg = arg,
+        .payload_len = (uint32_t)payload_len,
+    };
+    uint32_t hash = journal_hash(2166136261u, &rec, sizeof(rec));
+    hash = journal_hash(hash, head, head_len);
+    rec.checksum = journal_hash(hash, body, body_len);
+
+    pthread_mutex_lock(&J->lock);
+    size_t needed = J->pending_len + sizeof(rec) + payload_len;
+    if (needed > J->pending_cap) {
+        size_t cap = J->pending_cap ? J->pending_cap : 4096;
+        while (cap < needed) cap *= 2;
+        char *grown = realloc(J->pending, cap);
+        if (grown == NULL) {
+            // Losing durability is better than losing the session.
+            pthread_mutex_unlock(&J->lock);
+            return;
+        }
+        J->pending = grown;
+        J->pending_cap = cap;
+    }
+    char *out = J->pending + J->pending_len;
+    memcpy(out, &rec, sizeof(rec));
+    if (head_len > 0) memcpy(out + sizeof(rec), head, head_len);
+    if (body_len > 0) memcpy(out + sizeof(rec) + head_len, body, body_len);
+    J->pending_len = needed;
+    pthread_cond_signal(&J->wake);
+    pthread_mutex_unlock(&J->lock);
+}
+
+void journal_record(JournalOp op, long long row, long long col, int arg) {
+    journal_append(op, row, col, arg, NULL, 0, NULL, 0);
+}
+
+// A replace carries the end of its range, then the query and the
+// replacement separated by a NUL.
+typedef struct {
+    int64_t to_row;
+    int64_t to_col;
+} JournalReplaceRange;
+
+void journal_record_replace(long long from_row, long long from_col, long long to_row, long long to_col,
+                            const char *query, const char *replacement) {
+    if (get_editor_config()->journal == NULL) return;
+
+    size_t query_len = strlen(query);
+    size_t replacement_len = strlen(replacement);
+    size_t len = sizeof(JournalReplaceRange) + query_len + 1 + replacement_len;
+    char *payload = malloc(len);
+    if (payload == NULL) return;
+    JournalReplaceRange range = { .to_row = to_row, .to_col = to_col };
+    memcpy(payload, &range, sizeof(range));
+    memcpy(payload + sizeof(range), query, query_len + 1);
+    memcpy(payload + sizeof(range) + query_len + 1, replacement, replacement_len);
+    journal_append(JOURNAL_REPLACE, from_row, from_col, 0, NULL, 0, payload, len);
+    free(payload);
+}
+
+// The cursors go out as they are laid out in memory; the primary cursor's
+// index is the record's arg.
+void journal_record_cursors(const EditorCursor *cursors, long long count, long long primary) {
+    if (get_editor_config()->journal == NULL) return;
+    size_t len = (size_t)count * sizeof(EditorCursor);
+    if (len > UINT32_MAX) return;
+    journal_append(JOURNAL_CURSORS, cursors[primary].row, cursors[primary].col, (int)primary, NULL, 0, (const char *)cursors, len);
+}
+
+// A splice carries the number of rows it replaces, then the new text.
+void journal_record_splice(long long first, long long count, const char *text, size_t len) {
+    if (get_editor_config()->journal == NULL) return;
+    int64_t removed = count;
+    if (len > UINT32_MAX - sizeof(removed)) return;
+    journal_append(JOURNAL_SPLICE, first, 0, 0, (const char *)&removed, sizeof(removed), text, len);
+}
+
+void journal_checkpoint(const char *filename, const struct stat *base) {
+    Journal *J = get_editor_config()->journal;
+    if (J == NULL) {
+        journal_start(filename, base, 0);
+        return;
+    }
+
+    // The file on disk now holds everything; start the log over from it.
+    pthread_mutex_lock(&J->lock);
+    J->pending_len = 0;
+    J->checkpoints++;
+    pthread_mutex_unlock(&J->lock);
+
+    pthread_mutex_lock(&J->io_lock);
+    if (ftruncate(J->fd, 0) == 0) {
+        journal_write_header(J->fd, base);
+    }
+    pthread_mutex_unlock(&J->io_lock);
+}
+
+void journal_stop(int discard) {
+    EditorConfig *E = get_editor_config();
+    Journal *J = E->journal;
+    if (J == NULL) return;
+
+    pthread_mutex_lock(&J->lock);
+    J->stopping = 1;
+    pthread_cond_signal(&J->wake);
+    pthread_mutex_unlock(&J->lock);
+    pthread_join(J->writer, NULL);
+
+    close(J->fd);
+    if (discard) unlink(J->path);
+    free(J->path);
+    free(J->pending);
+    pthread_cond_destroy(&J->wake);
+    pthread_mutex_destroy(&J->io_lock);
+    pthread_mutex_destroy(&J->lock);
+    free(J);
+    E->journal = NULL;
+}
+
+static int journal_base_matches(const JournalHeader *header, const struct stat *base) {
+    JournalHeader current;
+    journal_fill_header(&current, base);
+    return current.base_size == header->base_size &&
+           current.base_ino == header->base_ino &&
+           current.base_mtime_sec == header->base_mtime_sec &&
+           current.base_mtime_nsec == header->base_mtime_nsec;
+}
+
+int journal_has_records(const char *filename) {
+    char *path = journal_path(filename);
+    if (path == NULL) return 0;
+    struct stat st;
+    int result = stat(path, &st) == 0 && (size_t)st.st_size > sizeof(JournalHeader);
+    free(path);
+    return result;
+}
+
+static int journal_apply(const JournalRecord *rec, char *payload) {
+    EditorConfig *E = get_editor_config();
+    if (rec->row < 0 || rec->row > E->lines.size || rec->col < 0) return -1;
+    if (rec->row < E->lines.size && (size_t)rec->col > E->lines.elements[rec->row].len) return -1;
+
+    E->cy = rec->row;
+    E->cx = rec->col;
+    switch (rec->op) {
+        case JOURNAL_INSERT_CHAR:
+            editor_insert_char(rec->arg);
+            break;
+        case JOURNAL_INSERT_NEWLINE:
+            editor_insert_newline();
+            break;
+        case JOURNAL_DELETE_CHAR:
+            editor_del_char();
+            break;
+        case JOURNAL_CLEAR_ALL:
+            E->select_all_active = 1;
+            editor_del_char();
+            break;
+        case JOURNAL_UNDO:
+            editor_undo();
+            break;
+        case JOURNAL_GROUP_BEGIN:
+            editor_begin_action_group();
+            break;
+        case JOURNAL_GROUP_END:
+            editor_end_action_group();
+            break;
+        case JOURNAL_CURSORS:
+            if (rec->payload_len % sizeof(EditorCursor) != 0) return -1;
+            if (editor_cursors_restore((const EditorCursor *)payload, rec->payload_len / sizeof(EditorCursor), rec->arg) == -1) return -1;
+            break;
+        case JOURNAL_CURSOR_INSERT_CHAR:
+            editor_cursors_insert_char(rec->arg);
+            break;
+        case JOURNAL_CURSOR_DELETE_CHAR:
+            editor_cursors_del_char();
+            break;
+        case JOURNAL_SPLICE: {
+            int64_t removed;
+            if (rec->payload_len < sizeof(removed)) return -1;
+            memcpy(&removed, payload, sizeof(removed));
+            if (editor_splice_rows(rec->row, removed, payload + sizeof(removed), rec->payload_len - sizeof(removed)) == -1) return -1;
+            break;
+        }
+        case JOURNAL_REPLACE: {
+            JournalReplaceRange range;
+            if (rec->payload_len < sizeof(range) + 1) return -1;
+            memcpy(&range, payload, sizeof(range));
+            payload[rec->payload_len] = '\0';
+            const char *query = payload + sizeof(range);
+            size_t query_len = strlen(query);
+            if (sizeof(range) + query_len + 1 > rec->payload_len) return -1;
+            if (editor_replace_range(query, query + query_len + 1, rec->row, rec->col, range.to_row, range.to_col) == -1) return -1;
+            break;
+        }
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+// Replays the journal for filename on top of the freshly loaded buffer.
+// Returns the number of operations applied, or -1 if the journal belongs to
+// a different version of the file. A torn or corrupt tail is cut off so the
+// journal can be resumed.
+int journal_replay(const char *filename, const struct stat *base) {
+    char *path = journal_path(filename);
+    if (path == NULL) return -1;
+    int fd = open(path, O_RDWR);
+    free(path);
+    if (fd == -1) return -1;
+
+    JournalHeader header;
+    if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        !journal_base_matches(&header, base)) {
+        close(fd);
+        return -1;
+    }
+
+    int applied = 0;
+    off_t valid_end = sizeof(header);
+    char *payload = NULL;
+    JournalRecord rec;
+    while (read(fd, &rec, sizeof(rec)) == (ssize_t)sizeof(rec)) {
+        if (rec.magic != JOURNAL_RECORD_MAGIC) break;
+        char *grown = realloc(payload, rec.payload_len + 1);
+        if (grown == NULL) break;
+        payload = grown;
+        if (rec.payload_len > 0 && read(fd, payload, rec.payload_len) != (ssize_t)rec.payload_len) break;
+        if (journal_checksum(&rec, payload) != rec.checksum) break;
+        if (journal_apply(&rec, payload) == -1) break;
+        applied++;
+        valid_end += sizeof(rec) + rec.payload_len;
+    }
+    free(payload);
+
+    if (ftruncate(fd, valid_end) == 0) fdatasync(fd);
+    close(fd);
+    return applied;
+}
@@ -0,0 +1,45 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Write-ahead log of buffer operations. Each record is replayed by driving
+// the same editor functions that produced it, starting from the file as it
+// was on disk when the journal was (re)started.
+typedef enum {
+    JOURNAL_INSERT_CHAR = 1,
+    JOURNAL_INSERT_NEWLINE,
+    JOURNAL_DELETE_CHAR,
+    JOURNAL_CLEAR_ALL,
+    JOURNAL_UNDO,
+    JOURNAL_REPLACE,
+    JOURNAL_GROUP_BEGIN,
+    JOURNAL_GROUP_END,
+    JOURNAL_CURSORS,
+    JOURNAL_CURSOR_INSERT_CHAR,
+    JOURNAL_CURSOR_DELETE_CHAR,
+    JOURNAL_SPLICE,
+} JournalOp;
+
+// One per buffer, in EditorConfig.journal; NULL while not journaling. The
+// functions below act on the current buffer's.
+typedef struct Journal Journal;
+
+void journal_start(const char *filename, const struct stat *base, int resume);
+void journal_record(JournalOp op, long long row, long long col, int arg);
+// Logs editor_replace_range(query, replacement, from_row, from_col, to_row, to_col).
+void journal_record_replace(long long from_row, long long from_col, long long to_row, long long to_col,
+                            const char *query, const char *replacement);
+// Logs editor_splice_rows(first, count, text, len).
+void journal_record_splice(long long first, long long count, const char *text, size_t len);
+// Logs the cursors the next JOURNAL_CURSOR_* operations apply at.
+struct EditorCursor;
+void journal_record_cursors(const struct EditorCursor *cursors, long long count, long long primary);
+void journal_checkpoint(const char *filename, const struct stat *base);
+void journal_stop(int discard);
+
+int journal_has_records(const char *filename);
+int journal_replay(const char *filename, const struct stat *base);
+
+#endif // JOURNAL_H
@@ -0,0 +1,126 @@
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Each sequence is a token byte (literal count in the high nibble, match
+// length minus LZ_MIN_MATCH in the low one), extra length bytes for either
+// nibble that is 15, the literals, then a two byte little-endian offset.
+// The last sequence has literals only and ends the block.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+size_t lz_compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+static uint32_t lz_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *lz_put_length(unsigned char *out, size_t len) {
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = (unsigned char)len;
+    return out;
+}
+
+static unsigned char *lz_put_literals(unsigned char *out, unsigned char *token, const unsigned char *literals, size_t count) {
+    *token = (unsigned char)((count < 15 ? count : 15) << 4);
+    if (count >= 15) out = lz_put_length(out, count - 15);
+    memcpy(out, literals, count);
+    return out + count;
+}
+
+size_t lz_compress(const char *src, size_t len, char *dst) {
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst;
+    size_t table[1 << LZ_HASH_BITS]; // position + 1 of the last sequence with this hash
+    memset(table, 0, sizeof(table));
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (len >= LZ_MIN_MATCH && pos <= len - LZ_MIN_MATCH) {
+        uint32_t seq = lz_read32(in + pos);
+        unsigned h = lz_hash(seq);
+        size_t candidate = table[h];
+        table[h] = pos + 1;
+        if (candidate == 0 || pos - (candidate - 1) > LZ_MAX_OFFSET || lz_read32(in + candidate - 1) != seq) {
+            pos++;
+            continue;
+        }
+        candidate--;
+
+        size_t match = LZ_MIN_MATCH;
+        while (pos + match < len && in[candidate + match] == in[pos + match]) match++;
+
+        unsigned char *token = out++;
+        out = lz_put_literals(out, token, in + anchor, pos - anchor);
+        size_t offset = pos - candidate;
+        *out++ = (unsigned char)(offset & 0xff);
+        *out++ = (unsigned char)(offset >> 8);
+        size_t extra = match - LZ_MIN_MATCH;
+        *token |= (unsigned char)(extra < 15 ? extra : 15);
+        if (extra >= 15) out = lz_put_length(out, extra - 15);
+
+        pos += match;
+        anchor = pos;
+    }
+
+    unsigned char *token = out++;
+    out = lz_put_literals(out, token, in + anchor, len - anchor);
+    return out - (unsigned char *)dst;
+}
+
+static int lz_get_length(const unsigned char **ip, const unsigned char *ip_end, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= ip_end) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz_decompress(const char *src, size_t src_len, char *dst, size_t dst_len) {
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *ip_end = ip + src_len;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *op_end = op + dst_len;
+
+    while (ip < ip_end) {
+        unsigned char token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && lz_get_length(&ip, ip_end, &literals) == -1) return -1;
+        if (literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op)) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == ip_end) break;
+
+        if (ip_end - ip < 2) return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && lz_get_length(&ip, ip_end, &match) == -1) return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst) || match > (size_t)(op_end - op)) return -1;
+
+        // Byte at a time: the source may overlap what is being written.
+        const unsigned char *from = op - offset;
+        for (size_t i = 0; i < match; i++) op[i] = from[i];
+        op += match;
+    }
+    return op == op_end ? 0 : -1;
+}
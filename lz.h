@@ -0,0 +1,16 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+// A small LZ77 block codec in the LZ4 mould: byte-aligned sequences of
+// literals followed by a back-reference into the previous 64 KB. It trades
+// ratio for speed, which suits text that is decompressed every time it is
+// scrolled past.
+
+size_t lz_compress_bound(size_t len);
+size_t lz_compress(const char *src, size_t len, char *dst);
+// Returns 0 when src decodes to exactly dst_len bytes, -1 on corrupt input.
+int lz_decompress(const char *src, size_t src_len, char *dst, size_t dst_len);
+
+#endif // LZ_H
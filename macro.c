@@ -0,0 +1,170 @@
+#include "macro.h"
+#include "editor.h"
+#include "error_handler.h"
+#include "event_loop.h"
+#include "input.h"
+#include "swap.h"
+#include "syntax.h"
+#include "ui.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A replay feeds the recorded keys to editor_process_keypress in a loop on
+// the editor thread, so they do exactly what they did when typed. While it
+// runs, editor_refresh_screen draws nothing, edited lines are only flagged
+// for highlighting, and every action lands in one undo group.
+
+// How many runs go by between giving memory back under a memory limit.
+#define MACRO_TRIM_INTERVAL 64
+
+static struct {
+    int *keys;
+    int len, capacity;
+    int recording;
+    int replaying;
+    int pos;            // next key of the current run
+    int search_failed;
+} M;
+
+int editor_macro_recording() {
+    return M.recording;
+}
+
+int editor_macro_replaying() {
+    return M.replaying;
+}
+
+void editor_macro_toggle_recording() {
+    if (M.recording) {
+        M.recording = 0;
+        editor_set_status_message("Macro recorded (%d keys). Ctrl+E replays it.", M.len);
+        return;
+    }
+    M.len = 0;
+    M.recording = 1;
+    editor_set_status_message("Recording macro. Ctrl+K stops recording.");
+}
+
+void editor_macro_record_key(int key) {
+    // Mouse events refer to a screen position the replay will not have.
+    if (!M.recording || key == CTRL('k') || key == CTRL('e') || key == KEY_MOUSE) return;
+    if (M.len == M.capacity) {
+        int capacity = M.capacity ? M.capacity * 2 : 64;
+        int *grown = realloc(M.keys, capacity * sizeof(int));
+        if (grown == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (macro).");
+            return;
+        }
+        M.keys = grown;
+        M.capacity = capacity;
+    }
+    M.keys[M.len++] = key;
+}
+
+int editor_macro_next_key(int *key) {
+    if (!M.replaying) return 0;
+    // A prompt still open when the run's keys are used up is cancelled
+    // rather than left waiting on the terminal.
+    *key = M.pos < M.len ? M.keys[M.pos++] : 27;
+    return 1;
+}
+
+void editor_macro_search_failed() {
+    if (M.replaying) M.search_failed = 1;
+}
+
+// Keys that close or leave the buffer being replayed in.
+static int macro_leaves_buffer(int key) {
+    switch (key) {
+        case CTRL('q'):
+        case CTRL('c'):
+        case CTRL('o'):
+        case CTRL('n'):
+        case CTRL('b'):
+        case CTRL('w'):
+        case CTRL('p'):
+            return 1;
+    }
+    return 0;
+}
+
+static int macro_has_search() {
+    for (int i = 0; i < M.len; i++) {
+        if (M.keys[i] == CTRL('f')) return 1;
+    }
+    return 0;
+}
+
+void editor_macro_replay() {
+    if (M.recording) {
+        editor_set_status_message("Stop recording with Ctrl+K before replaying.");
+        return;
+    }
+    if (M.len == 0) {
+        editor_set_status_message("No macro recorded. Ctrl+K starts recording.");
+        return;
+    }
+
+    char *answer = editor_prompt_allow_empty("Replay macro how many times (Enter: until a search fails)? %s");
+    if (answer == NULL) return;
+    long long count = LLONG_MAX;
+    if (answer[0] != '\0') {
+        char *end;
+        errno = 0;
+        count = strtoll(answer, &end, 10);
+        if (errno || end == answer || *end != '\0' || count < 1) {
+            editor_set_status_message("Invalid count: %s", answer);
+            free(answer);
+            return;
+        }
+    } else if (!macro_has_search()) {
+        editor_set_status_message("The macro has no search to stop it. Give a count.");
+        free(answer);
+        return;
+    }
+    free(answer);
+
+    EditorConfig *E = get_editor_config();
+    M.replaying = 1;
+    M.search_failed = 0;
+    editor_begin_action_group();
+    editor_syntax_defer(1);
+
+    long long runs = 0;
+    const char *stopped = NULL;
+    while (runs < count && stopped == NULL) {
+        M.pos = 0;
+        while (M.pos < M.len && stopped == NULL) {
+            int key = M.keys[M.pos++];
+            if (macro_leaves_buffer(key)) {
+                stopped = "it switches buffers";
+                break;
+            }
+            editor_process_keypress(key);
+            if (M.search_failed) stopped = "a search failed";
+            else if (get_editor_config() != E) stopped = "it switches buffers";
+        }
+        if (stopped) break;
+        runs++;
+        if (editor_input_cancel_requested()) stopped = "cancelled";
+        if (runs % MACRO_TRIM_INTERVAL == 0) editor_swap_trim(&E->lines);
+    }
+
+    // Enter on a Ctrl+P result may have moved to another buffer.
+    EditorConfig *current = get_editor_config();
+    editor_set_config(E);
+    editor_syntax_defer(0);
+    editor_end_action_group();
+    editor_set_config(current);
+    M.replaying = 0;
+
+    if (stopped == NULL) {
+        editor_set_status_message("Macro replayed %lld times.", runs);
+    } else {
+        editor_set_status_message("Macro replayed %lld times; stopped because %s.", runs, stopped);
+    }
+    editor_request_redraw();
+}
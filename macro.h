@@ -0,0 +1,20 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+// Keyboard macros. Ctrl+K starts and stops recording every key typed,
+// including those answering prompts; Ctrl+E replays them a given number of
+// times or until a search in them fails. A replay draws nothing until it is
+// over, defers highlighting to the end and is undone as a single step.
+
+void editor_macro_toggle_recording();
+void editor_macro_replay();
+int editor_macro_recording();
+int editor_macro_replaying();
+// Key source hooks. A replay supplies the keys that prompts read; keys read
+// from the terminal are added to the macro being recorded.
+int editor_macro_next_key(int *key);
+void editor_macro_record_key(int key);
+// Called by a search that finds nothing; it ends a replay.
+void editor_macro_search_failed();
+
+#endif // MACRO_H
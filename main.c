@@ -1,38 +1,37 @@
 #include "ui.h"
 #include "editor_lines_array.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "error_handler.h"
+#include "batch.h"
+#include "buffer.h"
 #include "editor.h"
+#include "event_loop.h"
 #include "file.h"
 #include "syntax.h"
 #include "ui.h"
 
-EditorConfig *E = NULL;
-
 int main(int argc, char *argv[]) {
-    E = get_editor_config();
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s --batch script.ed file...\n", argv[0]);
+            return 2;
+        }
+        return editor_batch_run(argv[2], argv + 3, argc - 3);
+    }
+
     init_editor();
 
     if (argc >= 2) {
-        editor_read_file(argv[1]);
+        editor_buffer_open_files(argv + 1, argc - 1);
     } else {
-        init_editor_lines_array(&E->lines);
-        EditorLine empty_line = { .text = strdup(""), .len = 0, .hl = NULL, .hl_open_comment = 0 };
-        if (empty_line.text == NULL) {
-            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (main empty line text).");
-        }
-        editor_lines_array_append(&E->lines, empty_line);
-        editor_update_syntax(0);
+        editor_buffer_init_empty();
         editor_set_status_message("ErwinText: Press Ctrl+Q to quit. Ctrl+S to save. Ctrl+F to find.");
     }
     
-    editor_refresh_screen();
-
-    while (1) {
-        editor_process_keypress();
-    }
+    editor_event_loop();
 
     return 0;
 }
@@ -0,0 +1,71 @@
+#include "parallel.h"
+#include "error_handler.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PARALLEL_MAX_WORKERS 64
+
+typedef struct {
+    ParallelTaskFn fn;
+    void *ctx;
+    int task_count;
+    int next_task;
+    pthread_mutex_t lock;
+} ParallelJob;
+
+int parallel_worker_count() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    if (cpus > PARALLEL_MAX_WORKERS) return PARALLEL_MAX_WORKERS;
+    return (int)cpus;
+}
+
+static void *parallel_worker(void *arg) {
+    ParallelJob *job = arg;
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int task = job->next_task++;
+        pthread_mutex_unlock(&job->lock);
+        if (task >= job->task_count) break;
+        job->fn(job->ctx, task);
+    }
+    return NULL;
+}
+
+void parallel_run(int task_count, ParallelTaskFn fn, void *ctx) {
+    if (task_count <= 0) return;
+
+    int workers = parallel_worker_count();
+    if (workers > task_count) workers = task_count;
+    if (workers <= 1) {
+        for (int i = 0; i < task_count; i++) {
+            fn(ctx, i);
+        }
+        return;
+    }
+
+    ParallelJob job = { .fn = fn, .ctx = ctx, .task_count = task_count, .next_task = 0 };
+    pthread_mutex_init(&job.lock, NULL);
+
+    // The calling thread takes a share of the tasks too, so a failed
+    // pthread_create only costs parallelism, never correctness.
+    pthread_t threads[PARALLEL_MAX_WORKERS];
+    int started = 0;
+    // A fatal error must not unwind past the threads still sharing job.
+    EditorErrorTrap *trap = editor_error_trap;
+    editor_error_trap = NULL;
+    for (int i = 0; i < workers - 1; i++) {
+        if (pthread_create(&threads[started], NULL, parallel_worker, &job) == 0) {
+            started++;
+        }
+    }
+    parallel_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    editor_error_trap = trap;
+
+    pthread_mutex_destroy(&job.lock);
+}
@@ -0,0 +1,10 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Called once per task index; tasks may run concurrently on different threads.
+typedef void (*ParallelTaskFn)(void *ctx, int task);
+
+int parallel_worker_count();
+void parallel_run(int task_count, ParallelTaskFn fn, void *ctx);
+
+#endif // PARALLEL_H
@@ -0,0 +1,968 @@
+#include "search.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEARCH_MAX_DEPTH 256        // nested groups
+#define SEARCH_MAX_REPEAT 1000      // largest {m,n} bound
+#define SEARCH_MAX_INSTS 65536
+#define SEARCH_MAX_DFA_STATES 2048  // cache is flushed when it fills up
+#define SEARCH_DFA_HASH (SEARCH_MAX_DFA_STATES * 2)
+
+typedef enum {
+    OP_CLASS,   // consume a byte in classes[x], continue at pc + 1
+    OP_SPLIT,   // continue at both x and y
+    OP_JMP,
+    OP_MATCH,
+    OP_BOL,     // assertions continue at pc + 1
+    OP_EOL,
+    OP_WORDB,
+} OpCode;
+
+typedef struct {
+    OpCode op;
+    int x;
+    int y;
+} Inst;
+
+typedef struct {
+    uint32_t bits[8];
+} ByteClass;
+
+typedef enum {
+    NODE_EMPTY,
+    NODE_CLASS,
+    NODE_CAT,
+    NODE_ALT,
+    NODE_STAR,
+    NODE_PLUS,
+    NODE_QUEST,
+    NODE_REPEAT,
+    NODE_BOL,
+    NODE_EOL,
+    NODE_WORDB,
+} NodeType;
+
+// Nodes refer to each other by index, since the pool moves as it grows.
+typedef struct {
+    NodeType type;
+    int left;
+    int right;
+    int cls;
+    int min;
+    int max;    // -1 for no upper bound
+} Node;
+
+typedef struct {
+    int *pcs;       // sorted CLASS and MATCH instructions
+    int count;
+    int accepting;
+    int next[256];  // -1 until the transition is first taken
+} DfaState;
+
+typedef struct {
+    int *sparse;
+    int *dense;
+    size_t *start;
+    int count;
+} ThreadList;
+
+struct SearchPattern {
+    int flags;
+
+    char *literal;  // literal mode; lower-cased when ignoring case
+    size_t literal_len;
+
+    Inst *insts;
+    int inst_count;
+    ByteClass *classes;
+    int class_count;
+
+    int *start_pcs; // DFA closure of the first instruction
+    int start_count;
+    int start_byte; // the only byte that can begin a match, or -1
+    DfaState *dfa;
+    int dfa_count;
+    int dfa_capacity;
+    int dfa_hash[SEARCH_DFA_HASH];
+    int dfa_start;
+
+    // Scratch space, sized by instruction count.
+    int *stack;
+    int *set;
+    unsigned *mark;
+    unsigned mark_generation;
+    ThreadList threads[2];
+};
+
+static int search_is_word(unsigned char c) {
+    return isalnum(c) || c == '_';
+}
+
+static int search_at_word_boundary(const char *text, size_t len, size_t pos) {
+    int before = pos > 0 && search_is_word((unsigned char)text[pos - 1]);
+    int after = pos < len && search_is_word((unsigned char)text[pos]);
+    return before != after;
+}
+
+static int class_has(const ByteClass *cls, unsigned char c) {
+    return (cls->bits[c >> 5] >> (c & 31)) & 1;
+}
+
+static void class_set(ByteClass *cls, unsigned char c) {
+    cls->bits[c >> 5] |= 1u << (c & 31);
+}
+
+static void class_set_range(ByteClass *cls, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) class_set(cls, (unsigned char)c);
+}
+
+static void class_invert(ByteClass *cls) {
+    for (int i = 0; i < 8; i++) cls->bits[i] = ~cls->bits[i];
+}
+
+static void class_fold(ByteClass *cls) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        if (class_has(cls, c) || class_has(cls, toupper(c))) {
+            class_set(cls, c);
+            class_set(cls, toupper(c));
+        }
+    }
+}
+
+// --- Parser: recursive descent into a node pool ---
+
+typedef struct {
+    const char *p;
+    int flags;
+    Node *nodes;
+    int node_count;
+    int node_capacity;
+    ByteClass *classes;
+    int class_count;
+    int class_capacity;
+    const char *error;
+} Parser;
+
+static int parser_node(Parser *ps, Node node) {
+    if (ps->node_count == ps->node_capacity) {
+        int capacity = ps->node_capacity ? ps->node_capacity * 2 : 32;
+        Node *nodes = realloc(ps->nodes, capacity * sizeof(Node));
+        if (nodes == NULL) {
+            ps->error = "out of memory";
+            return -1;
+        }
+        ps->nodes = nodes;
+        ps->node_capacity = capacity;
+    }
+    ps->nodes[ps->node_count] = node;
+    return ps->node_count++;
+}
+
+static int parser_class(Parser *ps, ByteClass cls) {
+    if (ps->class_count == ps->class_capacity) {
+        int capacity = ps->class_capacity ? ps->class_capacity * 2 : 16;
+        ByteClass *classes = realloc(ps->classes, capacity * sizeof(ByteClass));
+        if (classes == NULL) {
+            ps->error = "out of memory";
+            return -1;
+        }
+        ps->classes = classes;
+        ps->class_capacity = capacity;
+    }
+    ps->classes[ps->class_count] = cls;
+    int index = ps->class_count++;
+    return parser_node(ps, (Node){ .type = NODE_CLASS, .cls = index });
+}
+
+// \d \w \s and their negations; returns 0 if c names no such class.
+static int parser_named_class(char c, ByteClass *cls) {
+    memset(cls, 0, sizeof(*cls));
+    switch (tolower((unsigned char)c)) {
+        case 'd':
+            class_set_range(cls, '0', '9');
+            break;
+        case 'w':
+            class_set_range(cls, '0', '9');
+            class_set_range(cls, 'a', 'z');
+            class_set_range(cls, 'A', 'Z');
+            class_set(cls, '_');
+            break;
+        case 's':
+            class_set(cls, ' ');
+            class_set_range(cls, '\t', '\r');
+            break;
+        default:
+            return 0;
+    }
+    if (isupper((unsigned char)c)) class_invert(cls);
+    return 1;
+}
+
+static unsigned char parser_escaped_char(char c) {
+    switch (c) {
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        default: return (unsigned char)c;
+    }
+}
+
+static int parser_bracket(Parser *ps) {
+    ByteClass cls;
+    memset(&cls, 0, sizeof(cls));
+    int negate = 0;
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+
+    int first = 1;
+    while (*ps->p && (*ps->p != ']' || first)) {
+        first = 0;
+        unsigned char lo;
+        if (*ps->p == '\\') {
+            ps->p++;
+            if (*ps->p == '\0') break;
+            ByteClass named;
+            if (parser_named_class(*ps->p, &named)) {
+                for (int i = 0; i < 8; i++) cls.bits[i] |= named.bits[i];
+                ps->p++;
+                continue;
+            }
+            lo = parser_escaped_char(*ps->p++);
+        } else {
+            lo = (unsigned char)*ps->p++;
+        }
+
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            ps->p++;
+            unsigned char hi;
+            if (*ps->p == '\\' && ps->p[1]) {
+                ps->p++;
+                hi = parser_escaped_char(*ps->p++);
+            } else {
+                hi = (unsigned char)*ps->p++;
+            }
+            if (hi < lo) {
+                ps->error = "invalid range in []";
+                return -1;
+            }
+            class_set_range(&cls, lo, hi);
+        } else {
+            class_set(&cls, lo);
+        }
+    }
+    if (*ps->p != ']') {
+        ps->error = "missing ]";
+        return -1;
+    }
+    ps->p++;
+
+    if (ps->flags & SEARCH_IGNORE_CASE) class_fold(&cls);
+    if (negate) class_invert(&cls);
+    return parser_class(ps, cls);
+}
+
+static int parse_alt(Parser *ps, int depth);
+
+static int parse_atom(Parser *ps, int depth) {
+    char c = *ps->p;
+    ByteClass cls;
+    memset(&cls, 0, sizeof(cls));
+
+    switch (c) {
+        case '(': {
+            if (depth >= SEARCH_MAX_DEPTH) {
+                ps->error = "groups nested too deeply";
+                return -1;
+            }
+            ps->p++;
+            int inner = parse_alt(ps, depth + 1);
+            if (inner == -1) return -1;
+            if (*ps->p != ')') {
+                ps->error = "missing )";
+                return -1;
+            }
+            ps->p++;
+            return inner;
+        }
+        case '[':
+            ps->p++;
+            return parser_bracket(ps);
+        case '.':
+            ps->p++;
+            class_invert(&cls);
+            return parser_class(ps, cls);
+        case '^':
+            ps->p++;
+            return parser_node(ps, (Node){ .type = NODE_BOL });
+        case '$':
+            ps->p++;
+            return parser_node(ps, (Node){ .type = NODE_EOL });
+        case '*':
+        case '+':
+        case '?':
+            ps->error = "nothing to repeat";
+            return -1;
+        case '\\':
+            ps->p++;
+            if (*ps->p == '\0') {
+                ps->error = "trailing backslash";
+                return -1;
+            }
+            c = *ps->p++;
+            if (c == 'b') return parser_node(ps, (Node){ .type = NODE_WORDB });
+            if (parser_named_class(c, &cls)) return parser_class(ps, cls);
+            class_set(&cls, parser_escaped_char(c));
+            break;
+        default:
+            ps->p++;
+            class_set(&cls, (unsigned char)c);
+            break;
+    }
+    if (ps->flags & SEARCH_IGNORE_CASE) class_fold(&cls);
+    return parser_class(ps, cls);
+}
+
+static int parse_number(Parser *ps) {
+    int n = 0;
+    while (isdigit((unsigned char)*ps->p)) {
+        n = n * 10 + (*ps->p++ - '0');
+        if (n > SEARCH_MAX_REPEAT) return -1;
+    }
+    return n;
+}
+
+static int parse_repeat(Parser *ps, int depth) {
+    int atom = parse_atom(ps, depth);
+    while (atom != -1) {
+        char c = *ps->p;
+        Node node = { .left = atom };
+        if (c == '*') {
+            node.type = NODE_STAR;
+        } else if (c == '+') {
+            node.type = NODE_PLUS;
+        } else if (c == '?') {
+            node.type = NODE_QUEST;
+        } else if (c == '{' && isdigit((unsigned char)ps->p[1])) {
+            ps->p++;
+            node.type = NODE_REPEAT;
+            node.min = parse_number(ps);
+            node.max = node.min;
+            if (*ps->p == ',') {
+                ps->p++;
+                node.max = -1;
+                if (isdigit((unsigned char)*ps->p)) {
+                    node.max = parse_number(ps);
+                    if (node.max == -1) node.min = -1;
+                }
+            }
+            if (node.min == -1) {
+                ps->error = "repeat count too large";
+                return -1;
+            }
+            if (*ps->p != '}' || (node.max != -1 && node.max < node.min)) {
+                ps->error = "invalid {m,n}";
+                return -1;
+            }
+        } else {
+            break;
+        }
+        ps->p++;
+        atom = parser_node(ps, node);
+    }
+    return atom;
+}
+
+static int parse_cat(Parser *ps, int depth) {
+    int left = -1;
+    while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+        int right = parse_repeat(ps, depth);
+        if (right == -1) return -1;
+        left = left == -1 ? right : parser_node(ps, (Node){ .type = NODE_CAT, .left = left, .right = right });
+        if (left == -1) return -1;
+    }
+    return left == -1 ? parser_node(ps, (Node){ .type = NODE_EMPTY }) : left;
+}
+
+static int parse_alt(Parser *ps, int depth) {
+    int left = parse_cat(ps, depth);
+    while (left != -1 && *ps->p == '|') {
+        ps->p++;
+        int right = parse_cat(ps, depth);
+        if (right == -1) return -1;
+        left = parser_node(ps, (Node){ .type = NODE_ALT, .left = left, .right = right });
+    }
+    return left;
+}
+
+// --- Compiler: Thompson construction into a flat program ---
+
+typedef struct {
+    Inst *insts;
+    int count;
+    int capacity;
+    const Node *nodes;
+    const char *error;
+} Compiler;
+
+static int emit(Compiler *c, OpCode op, int x, int y) {
+    if (c->count == SEARCH_MAX_INSTS) {
+        c->error = "pattern too large";
+        return -1;
+    }
+    if (c->count == c->capacity) {
+        int capacity = c->capacity ? c->capacity * 2 : 64;
+        Inst *insts = realloc(c->insts, capacity * sizeof(Inst));
+        if (insts == NULL) {
+            c->error = "out of memory";
+            return -1;
+        }
+        c->insts = insts;
+        c->capacity = capacity;
+    }
+    c->insts[c->count] = (Inst){ .op = op, .x = x, .y = y };
+    return c->count++;
+}
+
+static int compile_node(Compiler *c, int n);
+
+static int compile_star(Compiler *c, int n) {
+    int split = emit(c, OP_SPLIT, 0, 0);
+    if (split == -1) return -1;
+    c->insts[split].x = split + 1;
+    if (compile_node(c, n) == -1 || emit(c, OP_JMP, split, 0) == -1) return -1;
+    c->insts[split].y = c->count;
+    return 0;
+}
+
+static int compile_quest(Compiler *c, int n) {
+    int split = emit(c, OP_SPLIT, 0, 0);
+    if (split == -1) return -1;
+    c->insts[split].x = split + 1;
+    if (compile_node(c, n) == -1) return -1;
+    c->insts[split].y = c->count;
+    return 0;
+}
+
+static int compile_node(Compiler *c, int n) {
+    const Node *node = &c->nodes[n];
+    switch (node->type) {
+        case NODE_EMPTY:
+            return 0;
+        case NODE_CLASS:
+            return emit(c, OP_CLASS, node->cls, 0) == -1 ? -1 : 0;
+        case NODE_BOL:
+            return emit(c, OP_BOL, 0, 0) == -1 ? -1 : 0;
+        case NODE_EOL:
+            return emit(c, OP_EOL, 0, 0) == -1 ? -1 : 0;
+        case NODE_WORDB:
+            return emit(c, OP_WORDB, 0, 0) == -1 ? -1 : 0;
+        case NODE_CAT:
+            if (compile_node(c, node->left) == -1) return -1;
+            return compile_node(c, node->right);
+        case NODE_ALT: {
+            int split = emit(c, OP_SPLIT, 0, 0);
+            if (split == -1) return -1;
+            c->insts[split].x = split + 1;
+            if (compile_node(c, node->left) == -1) return -1;
+            int jmp = emit(c, OP_JMP, 0, 0);
+            if (jmp == -1) return -1;
+            c->insts[split].y = c->count;
+            if (compile_node(c, node->right) == -1) return -1;
+            c->insts[jmp].x = c->count;
+            return 0;
+        }
+        case NODE_STAR:
+            return compile_star(c, node->left);
+        case NODE_PLUS: {
+            int loop = c->count;
+            if (compile_node(c, node->left) == -1) return -1;
+            int split = emit(c, OP_SPLIT, loop, 0);
+            if (split == -1) return -1;
+            c->insts[split].y = split + 1;
+            return 0;
+        }
+        case NODE_QUEST:
+            return compile_quest(c, node->left);
+        case NODE_REPEAT:
+            for (int i = 0; i < node->min; i++) {
+                if (compile_node(c, node->left) == -1) return -1;
+            }
+            if (node->max == -1) return compile_star(c, node->left);
+            for (int i = node->min; i < node->max; i++) {
+                if (compile_quest(c, node->left) == -1) return -1;
+            }
+            return 0;
+    }
+    return -1;
+}
+
+// --- Lazy DFA: a conservative filter that treats assertions as always true ---
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Adds the closure of pc to set; marks of the current generation are skipped.
+static int dfa_closure(SearchPattern *p, int *set, int count, int pc) {
+    int sp = 0;
+    p->stack[sp++] = pc;
+    while (sp > 0) {
+        pc = p->stack[--sp];
+        if (p->mark[pc] == p->mark_generation) continue;
+        p->mark[pc] = p->mark_generation;
+        const Inst *in = &p->insts[pc];
+        switch (in->op) {
+            case OP_JMP:
+                p->stack[sp++] = in->x;
+                break;
+            case OP_SPLIT:
+                p->stack[sp++] = in->y;
+                p->stack[sp++] = in->x;
+                break;
+            case OP_BOL:
+            case OP_EOL:
+            case OP_WORDB:
+                p->stack[sp++] = pc + 1;
+                break;
+            case OP_CLASS:
+            case OP_MATCH:
+                set[count++] = pc;
+                break;
+        }
+    }
+    return count;
+}
+
+static void dfa_flush(SearchPattern *p) {
+    for (int i = 0; i < p->dfa_count; i++) free(p->dfa[i].pcs);
+    p->dfa_count = 0;
+    p->dfa_start = -1;
+    for (int i = 0; i < SEARCH_DFA_HASH; i++) p->dfa_hash[i] = -1;
+}
+
+static unsigned dfa_hash_set(const int *set, int count) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        h ^= (unsigned)set[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Finds or adds the state for a sorted set; sets *flushed if the cache had
+// to be emptied to make room. Returns -1 when out of memory.
+static int dfa_state(SearchPattern *p, const int *set, int count, int *flushed) {
+    unsigned h = dfa_hash_set(set, count) % SEARCH_DFA_HASH;
+    for (int slot = h; p->dfa_hash[slot] != -1; slot = (slot + 1) % SEARCH_DFA_HASH) {
+        DfaState *s = &p->dfa[p->dfa_hash[slot]];
+        if (s->count == count && memcmp(s->pcs, set, count * sizeof(int)) == 0) return p->dfa_hash[slot];
+    }
+
+    if (p->dfa_count == SEARCH_MAX_DFA_STATES) {
+        dfa_flush(p);
+        *flushed = 1;
+    } else if (p->dfa_count == p->dfa_capacity) {
+        int capacity = p->dfa_capacity ? p->dfa_capacity * 2 : 16;
+        DfaState *dfa = realloc(p->dfa, capacity * sizeof(DfaState));
+        if (dfa == NULL) return -1;
+        p->dfa = dfa;
+        p->dfa_capacity = capacity;
+    }
+    DfaState *s = &p->dfa[p->dfa_count];
+    s->pcs = malloc(count * sizeof(int) + 1);
+    if (s->pcs == NULL) return -1;
+    memcpy(s->pcs, set, count * sizeof(int));
+    s->count = count;
+    s->accepting = 0;
+    for (int i = 0; i < count; i++) {
+        if (p->insts[set[i]].op == OP_MATCH) s->accepting = 1;
+    }
+    for (int i = 0; i < 256; i++) s->next[i] = -1;
+
+    int slot = h;
+    while (p->dfa_hash[slot] != -1) slot = (slot + 1) % SEARCH_DFA_HASH;
+    p->dfa_hash[slot] = p->dfa_count;
+    return p->dfa_count++;
+}
+
+static void dfa_new_generation(SearchPattern *p) {
+    if (++p->mark_generation == 0) {
+        memset(p->mark, 0, p->inst_count * sizeof(unsigned));
+        p->mark_generation = 1;
+    }
+}
+
+static int dfa_step(SearchPattern *p, int from, unsigned char c) {
+    // Unanchored: every state also carries a fresh start.
+    dfa_new_generation(p);
+    int count = 0;
+    for (int i = 0; i < p->start_count; i++) {
+        count = dfa_closure(p, p->set, count, p->start_pcs[i]);
+    }
+    const DfaState *s = &p->dfa[from];
+    for (int i = 0; i < s->count; i++) {
+        const Inst *in = &p->insts[s->pcs[i]];
+        if (in->op == OP_CLASS && class_has(&p->classes[in->x], c)) {
+            count = dfa_closure(p, p->set, count, s->pcs[i] + 1);
+        }
+    }
+    qsort(p->set, count, sizeof(int), compare_ints);
+
+    int flushed = 0;
+    int to = dfa_state(p, p->set, count, &flushed);
+    if (to != -1 && !flushed) p->dfa[from].next[c] = to;
+    return to;
+}
+
+// If only one byte can take the DFA out of its start state, scanning can
+// skip to the next occurrence of it with memchr.
+static int dfa_start_byte(const SearchPattern *p) {
+    int byte = -1;
+    for (int i = 0; i < p->start_count; i++) {
+        const Inst *in = &p->insts[p->start_pcs[i]];
+        if (in->op == OP_MATCH) return -1;
+        for (int c = 0; c < 256; c++) {
+            if (!class_has(&p->classes[in->x], (unsigned char)c)) continue;
+            if (byte != -1 && byte != c) return -1;
+            byte = c;
+        }
+    }
+    return byte;
+}
+
+static int dfa_start_state(SearchPattern *p) {
+    if (p->dfa_start == -1) {
+        int flushed = 0;
+        p->dfa_start = dfa_state(p, p->start_pcs, p->start_count, &flushed);
+    }
+    return p->dfa_start;
+}
+
+// Returns 0 only if no match can start at or after `from`.
+static int dfa_may_match(SearchPattern *p, const char *text, size_t len, size_t from) {
+    int s = dfa_start_state(p);
+    if (s == -1) return 1;
+
+    for (size_t i = from; i < len; i++) {
+        if (p->dfa[s].accepting) return 1;
+        unsigned char c = (unsigned char)text[i];
+        int next = p->dfa[s].next[c];
+        if (next == -1) {
+            next = dfa_step(p, s, c);
+            if (next == -1) return 1; // let the exact matcher decide
+        }
+        s = next;
+    }
+    return p->dfa[s].accepting;
+}
+
+static const char *search_last_byte(const char *text, char c, size_t len) {
+    while (len > 0) {
+        if (text[--len] == c) return text + len;
+    }
+    return NULL;
+}
+
+// Runs the filter over '\n'-separated lines, restarting at each one, and
+// returns the start of the first line at or after `from` that may match,
+// or len if none can.
+static size_t dfa_next_line(SearchPattern *p, const char *text, size_t len, size_t from) {
+    size_t line = from;
+    int s = dfa_start_state(p);
+    if (s == -1) return line;
+
+    for (size_t i = from; i < len; i++) {
+        if (p->dfa[s].accepting) return line;
+        if (s == p->dfa_start && p->start_byte != -1) {
+            const char *hit = memchr(text + i, p->start_byte, len - i);
+            if (hit == NULL) return len;
+            const char *nl = search_last_byte(text + i, '\n', hit - (text + i));
+            if (nl) line = nl - text + 1;
+            i = hit - text;
+        }
+        unsigned char c = (unsigned char)text[i];
+        if (c == '\n') {
+            line = i + 1;
+            s = dfa_start_state(p);
+            if (s == -1) return line;
+            continue;
+        }
+        int next = p->dfa[s].next[c];
+        if (next == -1) {
+            next = dfa_step(p, s, c);
+            if (next == -1) return line;
+        }
+        s = next;
+    }
+    return p->dfa[s].accepting ? line : len;
+}
+
+// --- Pike VM: exact leftmost-longest matching ---
+
+static void pike_add(SearchPattern *p, ThreadList *list, int pc, size_t start, const char *text, size_t len, size_t pos) {
+    int sp = 0;
+    p->stack[sp++] = pc;
+    while (sp > 0) {
+        pc = p->stack[--sp];
+        int i = list->sparse[pc];
+        if (i < list->count && list->dense[i] == pc) continue;
+        list->sparse[pc] = list->count;
+        list->dense[list->count] = pc;
+        list->start[list->count] = start;
+        list->count++;
+
+        const Inst *in = &p->insts[pc];
+        switch (in->op) {
+            case OP_JMP:
+                p->stack[sp++] = in->x;
+                break;
+            case OP_SPLIT:
+                p->stack[sp++] = in->y;
+                p->stack[sp++] = in->x;
+                break;
+            case OP_BOL:
+                if (pos == 0) p->stack[sp++] = pc + 1;
+                break;
+            case OP_EOL:
+                if (pos == len) p->stack[sp++] = pc + 1;
+                break;
+            case OP_WORDB:
+                if (search_at_word_boundary(text, len, pos)) p->stack[sp++] = pc + 1;
+                break;
+            case OP_CLASS:
+            case OP_MATCH:
+                break;
+        }
+    }
+}
+
+// Threads are kept in order of start position, so when two reach the same
+// instruction the one that started further left wins.
+static int pike_search(SearchPattern *p, const char *text, size_t len, size_t from, size_t *match_start, size_t *match_end) {
+    ThreadList *current = &p->threads[0];
+    ThreadList *next = &p->threads[1];
+    current->count = 0;
+    int matched = 0;
+    size_t best_start = 0;
+    size_t best_end = 0;
+
+    for (size_t pos = from;; pos++) {
+        if (!matched) pike_add(p, current, 0, pos, text, len, pos);
+        if (current->count == 0) break;
+
+        next->count = 0;
+        for (int i = 0; i < current->count; i++) {
+            size_t start = current->start[i];
+            if (matched && start > best_start) continue;
+            const Inst *in = &p->insts[current->dense[i]];
+            if (in->op == OP_MATCH) {
+                if (pos > start && (!matched || start < best_start || pos > best_end)) {
+                    matched = 1;
+                    best_start = start;
+                    best_end = pos;
+                }
+            } else if (in->op == OP_CLASS && pos < len && class_has(&p->classes[in->x], (unsigned char)text[pos])) {
+                pike_add(p, next, current->dense[i] + 1, start, text, len, pos + 1);
+            }
+        }
+        if (pos >= len) break;
+        ThreadList *swap = current;
+        current = next;
+        next = swap;
+    }
+
+    if (!matched) return 0;
+    *match_start = best_start;
+    *match_end = best_end;
+    return 1;
+}
+
+// --- Literal search ---
+
+static int search_literal(SearchPattern *p, const char *text, size_t len, size_t from, size_t *start, size_t *end) {
+    size_t n = p->literal_len;
+    int ignore_case = p->flags & SEARCH_IGNORE_CASE;
+    unsigned char first = (unsigned char)p->literal[0];
+
+    for (size_t i = from; n > 0 && i + n <= len; i++) {
+        if (!ignore_case) {
+            const char *hit = memchr(text + i, first, len - n + 1 - i);
+            if (hit == NULL) return 0;
+            i = hit - text;
+            if (memcmp(text + i, p->literal, n) != 0) continue;
+        } else {
+            size_t k = 0;
+            while (k < n && tolower((unsigned char)text[i + k]) == (unsigned char)p->literal[k]) k++;
+            if (k < n) continue;
+        }
+        if ((p->flags & SEARCH_WHOLE_WORD) &&
+            (!search_at_word_boundary(text, len, i) || !search_at_word_boundary(text, len, i + n))) {
+            continue;
+        }
+        *start = i;
+        *end = i + n;
+        return 1;
+    }
+    return 0;
+}
+
+// --- Public interface ---
+
+static int search_alloc_scratch(SearchPattern *p) {
+    int n = p->inst_count;
+    p->stack = malloc((2 * n + 1) * sizeof(int));
+    p->set = malloc(n * sizeof(int));
+    p->start_pcs = malloc(n * sizeof(int));
+    p->mark = calloc(n, sizeof(unsigned));
+    if (!p->stack || !p->set || !p->start_pcs || !p->mark) return -1;
+    for (int t = 0; t < 2; t++) {
+        p->threads[t].sparse = calloc(n, sizeof(int));
+        p->threads[t].dense = malloc(n * sizeof(int));
+        p->threads[t].start = malloc(n * sizeof(size_t));
+        if (!p->threads[t].sparse || !p->threads[t].dense || !p->threads[t].start) return -1;
+    }
+    return 0;
+}
+
+static int search_compile_regex(SearchPattern *p, const char *pattern, const char **error) {
+    Parser ps = { .p = pattern, .flags = p->flags };
+    int root = parse_alt(&ps, 0);
+    if (root != -1 && *ps.p == ')') {
+        ps.error = "unmatched )";
+        root = -1;
+    }
+    p->classes = ps.classes;
+    p->class_count = ps.class_count;
+    if (root == -1) {
+        free(ps.nodes);
+        *error = ps.error;
+        return -1;
+    }
+
+    Compiler c = { .nodes = ps.nodes };
+    int whole_word = p->flags & SEARCH_WHOLE_WORD;
+    int ok = (!whole_word || emit(&c, OP_WORDB, 0, 0) != -1) &&
+             compile_node(&c, root) != -1 &&
+             (!whole_word || emit(&c, OP_WORDB, 0, 0) != -1) &&
+             emit(&c, OP_MATCH, 0, 0) != -1;
+    free(ps.nodes);
+    p->insts = c.insts;
+    p->inst_count = c.count;
+    if (!ok) {
+        *error = c.error;
+        return -1;
+    }
+
+    if (search_alloc_scratch(p) == -1) {
+        *error = "out of memory";
+        return -1;
+    }
+    p->mark_generation = 1;
+    p->start_count = dfa_closure(p, p->start_pcs, 0, 0);
+    qsort(p->start_pcs, p->start_count, sizeof(int), compare_ints);
+    p->start_byte = dfa_start_byte(p);
+    dfa_flush(p);
+    return 0;
+}
+
+SearchPattern *search_compile(const char *pattern, int flags, const char **error) {
+    SearchPattern *p = calloc(1, sizeof(SearchPattern));
+    if (p == NULL) {
+        *error = "out of memory";
+        return NULL;
+    }
+    p->flags = flags;
+
+    if (flags & SEARCH_REGEX) {
+        if (search_compile_regex(p, pattern, error) == -1) {
+            search_free(p);
+            return NULL;
+        }
+        return p;
+    }
+
+    p->literal_len = strlen(pattern);
+    p->literal = strdup(pattern);
+    if (p->literal == NULL) {
+        *error = "out of memory";
+        search_free(p);
+        return NULL;
+    }
+    if (flags & SEARCH_IGNORE_CASE) {
+        for (size_t i = 0; i < p->literal_len; i++) p->literal[i] = tolower((unsigned char)p->literal[i]);
+    }
+    return p;
+}
+
+void search_free(SearchPattern *p) {
+    if (p == NULL) return;
+    dfa_flush(p);
+    free(p->dfa);
+    free(p->literal);
+    free(p->insts);
+    free(p->classes);
+    free(p->start_pcs);
+    free(p->stack);
+    free(p->set);
+    free(p->mark);
+    for (int t = 0; t < 2; t++) {
+        free(p->threads[t].sparse);
+        free(p->threads[t].dense);
+        free(p->threads[t].start);
+    }
+    free(p);
+}
+
+int search_next(SearchPattern *p, const char *text, size_t len, size_t from, size_t *start, size_t *end) {
+    if (from > len) return 0;
+    if (p->literal) return search_literal(p, text, len, from, start, end);
+    if (!dfa_may_match(p, text, len, from)) return 0;
+    return pike_search(p, text, len, from, start, end);
+}
+
+int search_next_line(SearchPattern *p, const char *text, size_t len, size_t from, size_t *line_start, size_t *start, size_t *end) {
+    if (p->literal) {
+        // A literal never contains a newline, so one pass over the buffer
+        // finds the same matches.
+        if (from > len || !search_literal(p, text, len, from, start, end)) return 0;
+        size_t line = *start;
+        while (line > from && text[line - 1] != '\n') line--;
+        *line_start = line;
+        return 1;
+    }
+
+    while (from < len) {
+        size_t line = dfa_next_line(p, text, len, from);
+        if (line >= len) return 0;
+        const char *nl = memchr(text + line, '\n', len - line);
+        size_t line_len = (nl ? (size_t)(nl - text) : len) - line;
+        if (pike_search(p, text + line, line_len, 0, start, end)) {
+            *start += line;
+            *end += line;
+            *line_start = line;
+            return 1;
+        }
+        from = line + line_len + 1;
+    }
+    return 0;
+}
+
+int search_prev(SearchPattern *p, const char *text, size_t len, size_t at, size_t *start, size_t *end) {
+    int found = 0;
+    size_t from = 0;
+    size_t s, e;
+    while (search_next(p, text, len, from, &s, &e) && s <= at) {
+        *start = s;
+        *end = e;
+        found = 1;
+        from = e;
+    }
+    return found;
+}
@@ -0,0 +1,36 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+// The editor's search kernel. Patterns are either literal strings or
+// regular expressions with the usual operators: . [] [^] * + ? {m,n} | ()
+// ^ $ \b \d \w \s (and \D \W \S). Regex matching never backtracks: a lazily
+// built DFA rejects lines that cannot match, and a Pike VM finds the
+// leftmost-longest match on the rest, so time is linear in the text.
+//
+// A compiled pattern caches DFA states as it runs and must not be shared
+// between threads.
+
+enum {
+    SEARCH_REGEX = 1 << 0,
+    SEARCH_IGNORE_CASE = 1 << 1,
+    SEARCH_WHOLE_WORD = 1 << 2,
+};
+
+typedef struct SearchPattern SearchPattern;
+
+// Returns NULL and sets *error to a static description on failure.
+SearchPattern *search_compile(const char *pattern, int flags, const char **error);
+void search_free(SearchPattern *pattern);
+// Finds the leftmost non-empty match starting at or after `from`.
+int search_next(SearchPattern *pattern, const char *text, size_t len, size_t from, size_t *start, size_t *end);
+// Finds the last match starting at or before `at`, scanning matches left
+// to right as search_next would.
+int search_prev(SearchPattern *pattern, const char *text, size_t len, size_t at, size_t *start, size_t *end);
+// Searches a buffer of '\n'-separated lines as if search_next were called on
+// each line in turn, starting with the line that begins at `from`. Offsets
+// are into the buffer; *line_start is where the matching line begins.
+int search_next_line(SearchPattern *pattern, const char *text, size_t len, size_t from, size_t *line_start, size_t *start, size_t *end);
+
+#endif // SEARCH_H
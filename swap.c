@@ -0,0 +1,516 @@
+#define _GNU_SOURCE // pwritev
+
+#include "swap.h"
+#include "editor.h"
+#include "error_handler.h"
+#include "lz.h"
+#include "ui.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// A CLOCK hand sweeps each line array: a line read since the hand last passed
+// gets a second chance, anything else is evicted. Neighbouring victims are
+// written with one pwritev as "text\n" records, so a run of swapped lines
+// can be copied straight into a saved file. A line that is paged back in
+// and not modified keeps its swap copy and is evicted again without I/O.
+// Records of lines that were changed or freed leave space for later runs.
+//
+// Unmodified lines, which are byte-identical to the file or have a current
+// swap copy, go first; modified lines only when that is not enough.
+//
+// With ERWINTEXT_COMPRESS set, each evicted run is LZ-compressed into a block
+// kept in memory instead of being written out. Offsets stay in the same
+// address space, so a line finds its block by binary search, and the last
+// few decompressed blocks are cached for scrolling and saving. A block is
+// freed once no line refers to it any more.
+
+#define SWAP_RUN_LINES 512          // two iovecs per line, under IOV_MAX
+#define SWAP_RUN_BYTES (1 << 20)
+#define SWAP_LOW_WATER_PERCENT 90   // trim a bit past the budget to avoid thrashing
+#define SWAP_COMPRESS_DEFAULT_BUDGET (64LL << 20)
+#define SWAP_CACHE_BLOCKS 8
+
+typedef struct {
+    off_t start;        // where the block begins in the swap address space
+    size_t len;         // uncompressed bytes
+    char *data;         // NULL once no line refers to the block
+    size_t data_len;
+    long long live;     // lines whose swap copy is in this block
+} SwapBlock;
+
+typedef struct {
+    long long block;
+    int valid;
+    unsigned long long used;
+    char *text;
+    size_t capacity;
+} SwapCacheEntry;
+
+static long long swap_budget;       // 0 when out-of-core mode is off
+static long long swap_resident;     // bytes of text and hl held by resident lines
+static int swap_fd = -1;
+static off_t swap_end;
+
+// Swap file space no line refers to any more, reused by later runs.
+typedef struct {
+    off_t start;
+    off_t len;
+} SwapExtent;
+
+static SwapExtent *swap_free;
+static long long swap_free_count;
+static long long swap_free_capacity;
+static long long swap_free_next;    // where the next search for space starts
+static int swap_free_unsorted;
+static int swap_free_emptied;
+
+static int swap_compress;
+static SwapBlock *swap_blocks;
+static long long swap_block_count;
+static long long swap_block_capacity;
+static SwapCacheEntry swap_cache[SWAP_CACHE_BLOCKS];
+static unsigned long long swap_cache_tick;
+
+static int swap_line_unmodified(const EditorLine *line) {
+    return line->disk_clean || line->swap_valid;
+}
+
+static long long swap_line_cost(const EditorLine *line) {
+    return (long long)line->len * 2 + 1;
+}
+
+void editor_swap_init() {
+    const char *compress = getenv("ERWINTEXT_COMPRESS");
+    if (compress != NULL && *compress != '\0' && strcmp(compress, "0") != 0) {
+        swap_compress = 1;
+        swap_budget = SWAP_COMPRESS_DEFAULT_BUDGET;
+    }
+
+    const char *limit = getenv("ERWINTEXT_MEMORY_LIMIT");
+    if (limit == NULL || *limit == '\0') return;
+
+    char *end;
+    errno = 0;
+    long long budget = strtoll(limit, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (errno || *end != '\0' || budget <= 0 || budget > (0x7fffffffffffffffLL >> shift)) {
+        editor_set_status_message("Ignoring invalid ERWINTEXT_MEMORY_LIMIT: %s", limit);
+        return;
+    }
+    swap_budget = budget << shift;
+}
+
+int editor_swap_enabled() {
+    return swap_budget > 0;
+}
+
+long long editor_swap_budget() {
+    return swap_budget;
+}
+
+void editor_swap_account(EditorLinesArray *lines, long long bytes) {
+    // Only a memory limit needs the count, and batch workers (which never
+    // have one) load files concurrently.
+    if (swap_budget == 0) return;
+    swap_resident += bytes;
+    lines->resident += bytes;
+}
+
+// Lines are only paged in and edited in the current buffer, so that is the
+// array they are charged to.
+void editor_swap_account_line(const EditorLine *line, long long bytes) {
+    EditorConfig *E = get_editor_config();
+    if (swap_budget == 0 || E == NULL) return;
+    if (line >= E->lines.elements && line < E->lines.elements + E->lines.size) editor_swap_account(&E->lines, bytes);
+}
+
+int editor_swap_fd() {
+    return swap_fd;
+}
+
+static int swap_open() {
+    if (swap_fd != -1) return 0;
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0') dir = "/tmp";
+
+    size_t path_len = strlen(dir) + sizeof("/erwintext-swap-XXXXXX");
+    char *path = malloc(path_len);
+    if (path == NULL) return -1;
+    snprintf(path, path_len, "%s/erwintext-swap-XXXXXX", dir);
+    swap_fd = mkstemp(path);
+    if (swap_fd != -1) unlink(path);
+    free(path);
+    return swap_fd == -1 ? -1 : 0;
+}
+
+static long long swap_find_block(off_t offset) {
+    long long lo = 0;
+    long long hi = swap_block_count - 1;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo + 1) / 2;
+        if (swap_blocks[mid].start <= offset) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Returns the decompressed text of a block, through the cache.
+static const char *swap_block_text(long long index) {
+    SwapCacheEntry *victim = &swap_cache[0];
+    for (int i = 0; i < SWAP_CACHE_BLOCKS; i++) {
+        SwapCacheEntry *entry = &swap_cache[i];
+        if (entry->valid && entry->block == index) {
+            entry->used = ++swap_cache_tick;
+            return entry->text;
+        }
+        if (victim->valid && (!entry->valid || entry->used < victim->used)) victim = entry;
+    }
+
+    SwapBlock *block = &swap_blocks[index];
+    if (victim->capacity < block->len) {
+        char *text = realloc(victim->text, block->len);
+        if (text == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (decompressing lines).");
+            return NULL;
+        }
+        victim->text = text;
+        victim->capacity = block->len;
+    }
+    victim->valid = 0;
+    if (block->data == NULL || lz_decompress(block->data, block->data_len, victim->text, block->len) == -1) {
+        editor_handle_error(ERR_FILE_OPERATION, "Compressed line block %lld is corrupt.", index);
+        return NULL;
+    }
+    victim->block = index;
+    victim->valid = 1;
+    victim->used = ++swap_cache_tick;
+    return victim->text;
+}
+
+static int swap_read(char *text, size_t len, off_t offset) {
+    if (swap_compress) {
+        long long index = swap_find_block(offset);
+        const char *block = swap_block_text(index);
+        if (block == NULL) return -1;
+        memcpy(text, block + (offset - swap_blocks[index].start), len);
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(swap_fd, text + done, len - done, offset + (off_t)done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            editor_handle_error(ERR_FILE_OPERATION, "Failed to read line from swap file: %s",
+                                n == 0 ? "unexpected end of file" : strerror(errno));
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+void editor_line_page_in(EditorLine *line) {
+    line->referenced = 1;
+    if (!line->swapped) return;
+
+    char *text = malloc(line->len + 1);
+    if (text == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (paging in line).");
+        return;
+    }
+    if (swap_read(text, line->len, line->swap_offset) == -1) {
+        free(text);
+        return;
+    }
+    text[line->len] = '\0';
+
+    line->text = text;
+    line->swapped = 0;
+    editor_swap_account_line(line, swap_line_cost(line));
+}
+
+const char *editor_swap_peek(off_t offset, size_t *available) {
+    long long index = swap_find_block(offset);
+    const char *block = swap_block_text(index);
+    if (block == NULL) return NULL;
+    size_t skip = offset - swap_blocks[index].start;
+    *available = swap_blocks[index].len - skip;
+    return block + skip;
+}
+
+static void swap_free_add(off_t start, off_t len) {
+    if (swap_free_count == swap_free_capacity) {
+        long long capacity = swap_free_capacity ? swap_free_capacity * 2 : 64;
+        SwapExtent *extents = realloc(swap_free, capacity * sizeof(SwapExtent));
+        // Losing track of the space only makes the swap file larger.
+        if (extents == NULL) return;
+        swap_free = extents;
+        swap_free_capacity = capacity;
+    }
+    swap_free[swap_free_count++] = (SwapExtent){ .start = start, .len = len };
+    swap_free_unsorted = 1;
+}
+
+static int swap_extent_compare(const void *a, const void *b) {
+    off_t x = ((const SwapExtent *)a)->start;
+    off_t y = ((const SwapExtent *)b)->start;
+    return (x > y) - (x < y);
+}
+
+// Sorts the free list, merges neighbours and gives a free tail back to the
+// file system. Runs before each eviction run rather than on every release.
+static void swap_free_tidy() {
+    if (!swap_free_unsorted && !swap_free_emptied) return;
+    if (swap_free_unsorted) qsort(swap_free, swap_free_count, sizeof(SwapExtent), swap_extent_compare);
+    long long kept = 0;
+    for (long long i = 0; i < swap_free_count; i++) {
+        if (swap_free[i].len == 0) continue;
+        if (kept > 0 && swap_free[kept - 1].start + swap_free[kept - 1].len == swap_free[i].start) {
+            swap_free[kept - 1].len += swap_free[i].len;
+        } else {
+            swap_free[kept++] = swap_free[i];
+        }
+    }
+    swap_free_count = kept;
+    swap_free_next = 0;
+    swap_free_unsorted = 0;
+    swap_free_emptied = 0;
+
+    if (swap_free_count == 0) return;
+    SwapExtent *last = &swap_free[swap_free_count - 1];
+    if (last->start + last->len == swap_end && ftruncate(swap_fd, last->start) == 0) {
+        swap_end = last->start;
+        swap_free_count--;
+    }
+}
+
+// Finds room for records of at least need bytes, up to want bytes in all:
+// the next free extent that fits, or the end of the file.
+static void swap_reserve(off_t need, off_t want, off_t *offset, off_t *room) {
+    for (long long tried = 0; tried < swap_free_count; tried++) {
+        if (swap_free_next >= swap_free_count) swap_free_next = 0;
+        SwapExtent *extent = &swap_free[swap_free_next];
+        if (extent->len >= need) {
+            off_t take = extent->len < want ? extent->len : want;
+            *offset = extent->start;
+            *room = take;
+            extent->start += take;
+            extent->len -= take;
+            if (extent->len == 0) swap_free_emptied = 1;
+            return;
+        }
+        swap_free_next++;
+    }
+    *offset = swap_end;
+    *room = want;
+    swap_end += want;
+}
+
+void editor_swap_release(EditorLine *line, size_t len) {
+    if (!(line->swapped || line->swap_valid)) return;
+    if (!swap_compress) {
+        swap_free_add(line->swap_offset, (off_t)len + 1);
+        return;
+    }
+    if (swap_block_count == 0) return;
+    long long index = swap_find_block(line->swap_offset);
+    SwapBlock *block = &swap_blocks[index];
+    if (--block->live > 0) return;
+
+    free(block->data);
+    block->data = NULL;
+    for (int i = 0; i < SWAP_CACHE_BLOCKS; i++) {
+        if (swap_cache[i].block == index) swap_cache[i].valid = 0;
+    }
+}
+
+static int swap_write_all(struct iovec *iov, int count, off_t offset) {
+    while (count > 0) {
+        ssize_t n = pwritev(swap_fd, iov, count, offset);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        offset += n;
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Packs the records into one buffer and keeps it as a compressed block.
+static int swap_store_block(struct iovec *iov, int iov_count, off_t start, long long live) {
+    size_t len = 0;
+    for (int i = 0; i < iov_count; i++) len += iov[i].iov_len;
+
+    if (swap_block_count == swap_block_capacity) {
+        long long capacity = swap_block_capacity ? swap_block_capacity * 2 : 64;
+        SwapBlock *blocks = realloc(swap_blocks, capacity * sizeof(SwapBlock));
+        if (blocks == NULL) {
+            editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (compressed block table).");
+            return -1;
+        }
+        swap_blocks = blocks;
+        swap_block_capacity = capacity;
+    }
+
+    char *raw = malloc(len);
+    char *packed = malloc(lz_compress_bound(len));
+    if (raw == NULL || packed == NULL) {
+        free(raw);
+        free(packed);
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Out of memory (compressing lines).");
+        return -1;
+    }
+    char *p = raw;
+    for (int i = 0; i < iov_count; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    size_t packed_len = lz_compress(raw, len, packed);
+    free(raw);
+    char *shrunk = realloc(packed, packed_len);
+    if (shrunk != NULL) packed = shrunk;
+
+    swap_blocks[swap_block_count++] = (SwapBlock){
+        .start = start, .len = len, .data = packed, .data_len = packed_len, .live = live,
+    };
+    return 0;
+}
+
+static int swap_store(struct iovec *iov, int iov_count, off_t offset) {
+    if (iov_count == 0) return 0;
+    return swap_compress ? swap_store_block(iov, iov_count, offset, iov_count / 2)
+                         : swap_write_all(iov, iov_count, offset);
+}
+
+// Evicts lines [start, start + count); all are resident. Records are laid
+// out in the free extents they fit, written with one pwritev per extent.
+static int swap_evict_run(EditorLinesArray *lines, long long start, int count) {
+    static char newline[] = "\n";
+    struct iovec iov[SWAP_RUN_LINES * 2];
+    int iov_count = 0;
+
+    off_t want = 0;
+    for (int i = 0; i < count; i++) {
+        EditorLine *line = &lines->elements[start + i];
+        if (!line->swap_valid) want += line->len + 1;
+    }
+    swap_free_tidy();
+    off_t offset = 0;
+    off_t room = 0;
+    off_t write_at = 0;
+    for (int i = 0; i < count; i++) {
+        EditorLine *line = &lines->elements[start + i];
+        if (line->swap_valid) continue;
+        off_t record = line->len + 1;
+        if (record > room) {
+            if (swap_store(iov, iov_count, write_at) == -1) return -1;
+            iov_count = 0;
+            if (room > 0) swap_free_add(offset, room);
+            swap_reserve(record, want, &offset, &room);
+            write_at = offset;
+        }
+        iov[iov_count].iov_base = line->text;
+        iov[iov_count].iov_len = line->len;
+        iov[iov_count + 1].iov_base = newline;
+        iov[iov_count + 1].iov_len = 1;
+        iov_count += 2;
+        line->swap_offset = offset;
+        offset += record;
+        room -= record;
+        want -= record;
+    }
+    if (swap_store(iov, iov_count, write_at) == -1) return -1;
+    if (room > 0) swap_free_add(offset, room);
+
+    for (int i = 0; i < count; i++) {
+        EditorLine *line = &lines->elements[start + i];
+        editor_swap_account(lines, -swap_line_cost(line));
+        editor_line_free_text(line);
+        free(line->hl);
+        free(line->render);
+        line->hl = NULL;
+        line->render = NULL;
+        line->render_valid = 0;
+        line->swapped = 1;
+        line->swap_valid = 1;
+    }
+    return 0;
+}
+
+// Called at safe points only: the event loop between events, between slices
+// while loading, and between lines in long scans.
+void editor_swap_trim(EditorLinesArray *lines) {
+    if (swap_budget == 0 || swap_resident <= swap_budget || lines->size == 0) return;
+    if (!swap_compress && swap_open() == -1) {
+        editor_set_status_message("Cannot create swap file: %s; memory limit disabled.", strerror(errno));
+        swap_budget = 0;
+        return;
+    }
+
+    long long target = swap_budget / 100 * SWAP_LOW_WATER_PERCENT;
+    // Other buffers are out of reach here, and were trimmed when left; this
+    // one keeps the slack above the target rather than emptying for them.
+    long long floor = swap_budget - target;
+    // The first turn takes only unmodified lines and may only clear
+    // reference bits, the second takes whatever is still cold. A turn that
+    // finds nothing to do ends the trim.
+    for (int turn = 0; turn < 2; turn++) {
+        int modified_too = turn == 1;
+        int progress = 0;
+        int skipped_modified = 0;
+        long long scanned = 0;
+        while (scanned < lines->size) {
+            if (swap_resident <= target || lines->resident <= floor) return;
+            if (lines->swap_hand >= lines->size) lines->swap_hand = 0;
+            EditorLine *line = &lines->elements[lines->swap_hand];
+            if (line->swapped || line->text == NULL || line->referenced ||
+                (!modified_too && !swap_line_unmodified(line))) {
+                if (line->referenced) progress = 1;
+                else if (!line->swapped && line->text != NULL) skipped_modified = 1;
+                line->referenced = 0;
+                lines->swap_hand++;
+                scanned++;
+                continue;
+            }
+
+            int count = 0;
+            size_t bytes = 0;
+            while (lines->swap_hand + count < lines->size && count < SWAP_RUN_LINES && bytes < SWAP_RUN_BYTES) {
+                EditorLine *victim = &lines->elements[lines->swap_hand + count];
+                if (victim->swapped || victim->text == NULL || victim->referenced ||
+                    (!modified_too && !swap_line_unmodified(victim))) break;
+                bytes += victim->len + 1;
+                count++;
+            }
+            if (swap_evict_run(lines, lines->swap_hand, count) == -1) {
+                editor_set_status_message("Swap file write failed: %s; memory limit disabled.", strerror(errno));
+                swap_budget = 0;
+                return;
+            }
+            lines->swap_hand += count;
+            scanned += count;
+            progress = 1;
+        }
+        if (!progress && !skipped_modified) return;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "editor_lines_array.h"
+
+// Out-of-core mode, enabled by ERWINTEXT_MEMORY_LIMIT (bytes, or with a
+// K/M/G suffix). Line text past the budget is moved to an unlinked swap file
+// and freed. Code that reads line text pages it back in with
+// editor_line_page_in(); eviction only happens at safe points, when nothing
+// holds a pointer into line text. With ERWINTEXT_COMPRESS the evicted text
+// is kept LZ-compressed in memory instead, and there is no swap file.
+
+void editor_swap_init();
+int editor_swap_enabled();
+long long editor_swap_budget();
+// Adds bytes to what lines holds resident, and to the total held against
+// the budget.
+void editor_swap_account(EditorLinesArray *lines, long long bytes);
+// The same for a line that changed size; only lines of the current buffer
+// are counted.
+void editor_swap_account_line(const EditorLine *line, long long bytes);
+void editor_line_page_in(EditorLine *line);
+void editor_swap_trim(EditorLinesArray *lines);
+int editor_swap_fd();
+// Compressed mode only: text at a swap offset, and how much of it is
+// contiguous in memory. Valid until the next call into this module.
+const char *editor_swap_peek(off_t offset, size_t *available);
+// Drops the line's claim on its swap copy, len bytes of text, before it is
+// changed or freed.
+void editor_swap_release(EditorLine *line, size_t len);
+
+#endif // SWAP_H
@@ -1,12 +1,14 @@
 #include "editor.h"
 #include "syntax.h"
+#include "event_loop.h"
+#include "parallel.h"
+#include "swap.h"
 
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdlib.h>
 
-EditorSyntax *E_syntax = NULL;
-
 char *C_HL_extensions[] = { ".c", ".h", ".cpp", ".hpp", ".cc", NULL };
 char *C_HL_keywords[] = {
     "switch", "if", "while", "for", "break", "continue", "return", "else",
@@ -125,9 +127,9 @@ EditorSyntax *EditorSyntaxes[] = {
 
 void editor_select_syntax_highlight() {
     EditorConfig *E = get_editor_config();
-    E_syntax = NULL;
+    E->syntax = NULL;
 
-    if (E->filename) {
+    if (E->filename && !E->headless) {
         char *ext = strrchr(E->filename, '.');
 
         if (ext) {
@@ -135,7 +137,7 @@ void editor_select_syntax_highlight() {
                 EditorSyntax *syntax = EditorSyntaxes[i];
                 for (int j = 0; syntax->filetype_extensions[j]; j++) {
                     if (strcmp(ext, syntax->filetype_extensions[j]) == 0) {
-                        E_syntax = syntax;
+                        E->syntax = syntax;
                         return;
                     }
                 }
@@ -144,37 +146,31 @@ void editor_select_syntax_highlight() {
     }
 }
 
-void editor_update_syntax(int filerow) {
-    EditorConfig *E = get_editor_config();
-    EditorLine *line = &E->lines.elements[filerow];
-
-    if (line->hl) free(line->hl);
-    line->hl = malloc(line->len);
-    if (line->hl == NULL) { return; }
-    memset(line->hl, HL_NORMAL, line->len);
-
-    if (E_syntax == NULL) return;
+// Lexes one line into hl (which must hold len bytes) starting from the given
+// multi-line comment state, and returns the state at the end of the line.
+// Touches no editor state, so it is safe to call from workers.
+static int syntax_highlight_text(const EditorSyntax *syntax, const char *text, size_t len, char *hl, int in_multiline_comment) {
+    memset(hl, HL_NORMAL, len);
 
-    char **keywords1 = E_syntax->keywords1;
-    char **keywords2 = E_syntax->keywords2;
-    char *sc_start = E_syntax->singleline_comment_start;
-    char *mc_start = E_syntax->multiline_comment_start;
-    char *mc_end = E_syntax->multiline_comment_end;
+    char **keywords1 = syntax->keywords1;
+    char **keywords2 = syntax->keywords2;
+    char *sc_start = syntax->singleline_comment_start;
+    char *mc_start = syntax->multiline_comment_start;
+    char *mc_end = syntax->multiline_comment_end;
 
     int prev_sep = 1;
     int in_string = 0;
-    int in_multiline_comment = (filerow > 0 && E->lines.elements[filerow - 1].hl_open_comment);
 
-    int i = 0;
-    while ((size_t)i < line->len) {
-        char c = line->text[i];
-        unsigned char prev_hl = (i > 0) ? line->hl[i-1] : HL_NORMAL;
+    size_t i = 0;
+    while (i < len) {
+        char c = text[i];
+        unsigned char prev_hl = (i > 0) ? hl[i-1] : HL_NORMAL;
 
         if (mc_start && mc_end) {
             if (in_multiline_comment) {
-                line->hl[i] = HL_COMMENT;
-                if (strncmp(&line->text[i], mc_end, strlen(mc_end)) == 0) {
-                    for (size_t j = 0; j < strlen(mc_end); j++) line->hl[i+j] = HL_COMMENT;
+                hl[i] = HL_COMMENT;
+                if (strncmp(&text[i], mc_end, strlen(mc_end)) == 0) {
+                    for (size_t j = 0; j < strlen(mc_end); j++) hl[i+j] = HL_COMMENT;
                     i += strlen(mc_end);
                     in_multiline_comment = 0;
                     prev_sep = 1;
@@ -182,25 +178,25 @@ void editor_update_syntax(int filerow) {
                 }
                 i++;
                 continue;
-            } else if (strncmp(&line->text[i], mc_start, strlen(mc_start)) == 0) {
-                for (size_t j = 0; j < strlen(mc_start); j++) line->hl[i+j] = HL_COMMENT;
+            } else if (strncmp(&text[i], mc_start, strlen(mc_start)) == 0) {
+                for (size_t j = 0; j < strlen(mc_start); j++) hl[i+j] = HL_COMMENT;
                 i += strlen(mc_start);
                 in_multiline_comment = 1;
                 continue;
             }
         }
 
-        if (sc_start && strncmp(&line->text[i], sc_start, strlen(sc_start)) == 0) {
-            for (size_t j = i; j < line->len; j++) {
-                line->hl[j] = HL_COMMENT;
+        if (sc_start && strncmp(&text[i], sc_start, strlen(sc_start)) == 0) {
+            for (size_t j = i; j < len; j++) {
+                hl[j] = HL_COMMENT;
             }
             break;
         }
 
         if (in_string) {
-            line->hl[i] = HL_STRING;
-            if (c == '\\' && (size_t)i + 1 < line->len) {
-                line->hl[i+1] = HL_STRING;
+            hl[i] = HL_STRING;
+            if (c == '\\' && i + 1 < len) {
+                hl[i+1] = HL_STRING;
                 i += 2;
                 continue;
             }
@@ -213,7 +209,7 @@ void editor_update_syntax(int filerow) {
         } else {
             if (c == '"' || c == '\'') {
                 in_string = c;
-                line->hl[i] = HL_STRING;
+                hl[i] = HL_STRING;
                 i++;
                 prev_sep = 0;
                 continue;
@@ -221,15 +217,15 @@ void editor_update_syntax(int filerow) {
         }
 
         if (isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) {
-            line->hl[i] = HL_NUMBER;
+            hl[i] = HL_NUMBER;
             i++;
             prev_sep = 0;
             continue;
         }
 
         if (i == 0 && c == '#') {
-            for (size_t j = 0; j < line->len; j++) {
-                line->hl[j] = HL_PREPROC;
+            for (size_t j = 0; j < len; j++) {
+                hl[j] = HL_PREPROC;
             }
             break;
         }
@@ -237,9 +233,9 @@ void editor_update_syntax(int filerow) {
         if (prev_sep) {
             for (size_t k = 0; keywords1[k]; k++) {
                 size_t kwlen = strlen(keywords1[k]);
-                if (strncmp(&line->text[i], keywords1[k], kwlen) == 0 &&
-                    is_separator(line->text[i + kwlen])) {
-                    for (size_t j = 0; j < kwlen; j++) line->hl[i+j] = HL_KEYWORD1;
+                if (strncmp(&text[i], keywords1[k], kwlen) == 0 &&
+                    is_separator(text[i + kwlen])) {
+                    for (size_t j = 0; j < kwlen; j++) hl[i+j] = HL_KEYWORD1;
                     i += kwlen;
                     prev_sep = 0;
                     goto next_char_in_loop;
@@ -247,9 +243,9 @@ void editor_update_syntax(int filerow) {
             }
             for (size_t k = 0; keywords2[k]; k++) {
                 size_t kwlen = strlen(keywords2[k]);
-                if (strncmp(&line->text[i], keywords2[k], kwlen) == 0 &&
-                    is_separator(line->text[i + kwlen])) {
-                    for (size_t j = 0; j < kwlen; j++) line->hl[i+j] = HL_KEYWORD2;
+                if (strncmp(&text[i], keywords2[k], kwlen) == 0 &&
+                    is_separator(text[i + kwlen])) {
+                    for (size_t j = 0; j < kwlen; j++) hl[i+j] = HL_KEYWORD2;
                     i += kwlen;
                     prev_sep = 0;
                     goto next_char_in_loop;
@@ -262,28 +258,636 @@ void editor_update_syntax(int filerow) {
         next_char_in_loop:;
     }
 
-    if (E->find_active && E->search_query && filerow >= E->row_offset && filerow < E->row_offset + E->screen_rows) {
-        char *match_ptr = line->text;
-        while ((match_ptr = strstr(match_ptr, E->search_query)) != NULL) {
-            int start_col = match_ptr - line->text;
-            for (size_t k = 0; k < strlen(E->search_query); k++) {
-                if ((size_t)start_col + k < line->len) {
-                    line->hl[start_col + k] = HL_MATCH;
-                }
-            }
-            match_ptr += strlen(E->search_query);
+    return in_multiline_comment;
+}
+
+// Background highlighting. When an edit changes a line's multi-line comment
+// state, every following line may need re-lexing. Rather than doing that
+// synchronously, the next line is flagged hl_stale and the worker thread
+// re-lexes snapshots of the text from there on. Results are installed on
+// the main thread only for lines whose version still matches; until then
+// the old highlighting is drawn.
+
+#define SYNTAX_WORKER_JOB_LINES 2048
+
+typedef struct {
+    size_t offset, len;        // into the job's text arena
+    unsigned long long version;
+    int old_state;
+    char *hl;
+    int state;
+} SyntaxWorkerLine;
+
+typedef struct {
+    const EditorConfig *buffer; // compared only: the buffer may be gone
+    const EditorSyntax *syntax;
+    long long start_row;
+    int in_state;
+    int count;                 // lines snapshotted
+    int done;                  // lines lexed by the worker
+    char *arena;
+    SyntaxWorkerLine *lines;
+} SyntaxWorkerJob;
+
+static struct {
+    int running;
+    int busy;                  // a job is out with the worker
+    SyntaxWorkerJob *job;      // handed to the worker
+    SyntaxWorkerJob *result;   // handed back
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} worker = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static void syntax_mark_stale(long long filerow) {
+    EditorConfig *E = get_editor_config();
+    E->lines.elements[filerow].hl_stale = 1;
+    if (E->hl_stale_hint == -1 || filerow < E->hl_stale_hint) E->hl_stale_hint = filerow;
+}
+
+static void syntax_highlight_matches(long long filerow, EditorLine *line) {
+    EditorConfig *E = get_editor_config();
+    if (E->find_active && E->search_pattern && filerow >= E->row_offset && filerow < E->row_offset + E->screen_rows) {
+        editor_line_page_in(line);
+        size_t from = 0;
+        size_t start, end;
+        while (search_next(E->search_pattern, line->text, line->len, from, &start, &end)) {
+            memset(&line->hl[start], HL_MATCH, end - start);
+            editor_line_invalidate_render(line);
+            from = end;
         }
     }
+}
+
+static struct {
+    int active;
+    long long start, end; // rows asked for by editor_update_syntax_rows
+} defer;
+
+void editor_syntax_defer(int active) {
+    if (active) {
+        defer.active = 1;
+        defer.start = defer.end = 0;
+        return;
+    }
+    defer.active = 0;
+    long long size = get_editor_config()->lines.size;
+    if (defer.end > size) defer.end = size;
+    if (defer.start < defer.end) editor_update_syntax_rows(defer.start, defer.end);
+}
+
+static void syntax_finish_line(long long filerow, EditorLine *line, int in_multiline_comment);
+
+void editor_update_syntax(long long filerow) {
+    EditorConfig *E = get_editor_config();
+    EditorLine *line = &E->lines.elements[filerow];
+    if (defer.active) {
+        // Lines without highlighting are lexed when they are next drawn.
+        free(line->hl);
+        line->hl = NULL;
+        editor_line_invalidate_render(line);
+        if (E->syntax) syntax_mark_stale(filerow);
+        return;
+    }
+    editor_line_page_in(line);
+    editor_line_invalidate_render(line);
+
+    if (line->hl) free(line->hl);
+    line->hl = malloc(line->len);
+    if (line->hl == NULL) { return; }
+    memset(line->hl, HL_NORMAL, line->len);
+
+    if (E->syntax == NULL) return;
 
+    int in_multiline_comment = (filerow > 0 && E->lines.elements[filerow - 1].hl_open_comment);
+    in_multiline_comment = syntax_highlight_text(E->syntax, line->text, line->len, line->hl, in_multiline_comment);
+    syntax_finish_line(filerow, line, in_multiline_comment);
+}
+
+// Takes the end state of a line just lexed and passes a change on to the
+// lines after it.
+static void syntax_finish_line(long long filerow, EditorLine *line, int in_multiline_comment) {
+    EditorConfig *E = get_editor_config();
+    syntax_highlight_matches(filerow, line);
 
     int changed_comment_state = (line->hl_open_comment != in_multiline_comment);
     line->hl_open_comment = in_multiline_comment;
+    line->hl_stale = 0;
+
+    // Edits shift lines by at most one row, so pulling the hint back to the
+    // edited row keeps it at or before the first stale line.
+    if (E->hl_stale_hint > filerow) E->hl_stale_hint = filerow;
 
     if (changed_comment_state && filerow + 1 < E->lines.size) {
-        editor_update_syntax(filerow + 1);
+        if (worker.running) {
+            syntax_mark_stale(filerow + 1);
+        } else {
+            editor_update_syntax(filerow + 1);
+        }
+    }
+}
+
+// Whole-buffer highlighting. Every chunk of lines is lexed by a worker as if
+// it started outside a multi-line comment, and again as if it started inside
+// one until the two runs agree on a line's end state (usually within a few
+// lines). The sequential fix-up then walks the hl_open_comment chain and, for
+// chunks that really do start inside a comment, swaps in the second run.
+//
+// Swapped-out lines are not paged in: their end state is taken as it was
+// when they were last lexed, and if the state coming into them has changed
+// since then they are left flagged for the background worker.
+
+#define SYNTAX_MIN_CHUNK_LINES 4096
+#define SYNTAX_CHUNKS_PER_WORKER 4
+
+typedef struct SyntaxJob SyntaxJob;
+
+typedef struct {
+    SyntaxJob *job;
+    long long start, end;
+    int end_state;          // end state when the chunk starts outside a comment
+    long long alt_count;    // lines that differ when starting inside a comment
+    int alt_end_state;
+    char **alt_hl;
+    int *alt_open_comment;
+    int failed;
+    int stale;              // flagged a swapped-out line for the worker
+} SyntaxChunk;
+
+// Rows [start, end) of one buffer.
+struct SyntaxJob {
+    const EditorSyntax *syntax;
+    EditorLine *lines;
+    SyntaxChunk *chunks;
+    int chunk_count;
+    long long start, end;
+    int in_state;           // state coming into the first chunk
+    int old_end_state;      // state the last row ended in before
+};
+
+static void syntax_highlight_chunk(void *ctx, int task) {
+    SyntaxChunk *chunk = &((SyntaxChunk *)ctx)[task];
+    SyntaxJob *job = chunk->job;
+    EditorLine *lines = job->lines;
+    const EditorSyntax *syntax = job->syntax;
+    int first = chunk == job->chunks;
+
+    int state = first ? job->in_state : 0;
+    int prev_old_state = state;
+    for (long long i = chunk->start; i < chunk->end; i++) {
+        EditorLine *line = &lines[i];
+        int old_state = line->hl_open_comment;
+        if (line->swapped) {
+            if (i > chunk->start && state != prev_old_state) {
+                line->hl_stale = 1;
+                chunk->stale = 1;
+            }
+            state = old_state;
+            prev_old_state = old_state;
+            continue;
+        }
+        prev_old_state = old_state;
+        line->hl_stale = 0;
+        editor_line_invalidate_render(line);
+        free(line->hl);
+        line->hl = malloc(line->len);
+        if (line->hl == NULL) {
+            line->hl_open_comment = state;
+            continue;
+        }
+        if (syntax == NULL) {
+            memset(line->hl, HL_NORMAL, line->len);
+            continue;
+        }
+        state = syntax_highlight_text(syntax, line->text, line->len, line->hl, state);
+        line->hl_open_comment = state;
+    }
+    chunk->end_state = state;
+    chunk->alt_end_state = state;
+
+    int has_mc = syntax && syntax->multiline_comment_start && syntax->multiline_comment_end;
+    if (first || !has_mc) return;
+
+    long long n = chunk->end - chunk->start;
+    chunk->alt_hl = malloc(sizeof(char *) * n);
+    chunk->alt_open_comment = malloc(sizeof(int) * n);
+    if (chunk->alt_hl == NULL || chunk->alt_open_comment == NULL) {
+        chunk->failed = 1;
+        return;
+    }
+
+    int alt_state = 1;
+    for (long long i = chunk->start; i < chunk->end; i++) {
+        int outside_state = (i == chunk->start) ? 0 : lines[i - 1].hl_open_comment;
+        if (alt_state == outside_state) {
+            chunk->alt_end_state = chunk->end_state;
+            return;
+        }
+        EditorLine *line = &lines[i];
+        if (line->swapped) {
+            chunk->failed = 1;
+            return;
+        }
+        char *hl = malloc(line->len);
+        if (hl == NULL && line->len > 0) {
+            chunk->failed = 1;
+            return;
+        }
+        alt_state = syntax_highlight_text(syntax, line->text, line->len, hl, alt_state);
+        chunk->alt_hl[chunk->alt_count] = hl;
+        chunk->alt_open_comment[chunk->alt_count] = alt_state;
+        chunk->alt_count++;
+    }
+    chunk->alt_end_state = alt_state;
+}
+
+// Scattered rows, such as those a multi-cursor edit touched. Every row is
+// lexed in parallel against the end state its previous line has now; rows
+// are then installed in order, and one whose previous line was in the list
+// and ended up in a different state is lexed again in place.
+
+// Fewer rows than this per task are lexed in place.
+#define SYNTAX_LIST_TASK_MIN_ROWS 512
+
+typedef struct {
+    const EditorSyntax *syntax;
+    EditorLine *lines;
+    const long long *rows;
+    long long count;
+    int task_count;
+    char **hl;              // per listed row; NULL if it must be lexed in place
+    int *in_state;
+    int *state;
+} SyntaxListJob;
+
+static void syntax_highlight_list_task(void *ctx, int task) {
+    SyntaxListJob *job = ctx;
+    long long begin = job->count * task / job->task_count;
+    long long end = job->count * (task + 1) / job->task_count;
+    for (long long i = begin; i < end; i++) {
+        long long row = job->rows[i];
+        EditorLine *line = &job->lines[row];
+        job->in_state[i] = row > 0 && job->lines[row - 1].hl_open_comment;
+        job->hl[i] = malloc(line->len);
+        if (job->hl[i] == NULL) continue;
+        job->state[i] = syntax_highlight_text(job->syntax, line->text, line->len, job->hl[i], job->in_state[i]);
+    }
+}
+
+void editor_update_syntax_list(const long long *rows, long long count) {
+    EditorConfig *E = get_editor_config();
+    int task_count = parallel_worker_count();
+    if (count / SYNTAX_LIST_TASK_MIN_ROWS < task_count) task_count = count / SYNTAX_LIST_TASK_MIN_ROWS;
+    SyntaxListJob job = {
+        .syntax = E->syntax,
+        .lines = E->lines.elements,
+        .rows = rows,
+        .count = count,
+        .task_count = task_count,
+    };
+    if (task_count >= 2 && E->syntax != NULL && !defer.active) {
+        job.hl = malloc(count * sizeof(char *));
+        job.in_state = malloc(count * sizeof(int));
+        job.state = malloc(count * sizeof(int));
+    }
+    if (job.hl == NULL || job.in_state == NULL || job.state == NULL) {
+        free(job.hl);
+        free(job.in_state);
+        free(job.state);
+        for (long long i = 0; i < count; i++) editor_update_syntax(rows[i]);
+        return;
+    }
+
+    for (long long i = 0; i < count; i++) editor_line_page_in(&E->lines.elements[rows[i]]);
+    parallel_run(task_count, syntax_highlight_list_task, &job);
+
+    for (long long i = 0; i < count; i++) {
+        long long row = rows[i];
+        EditorLine *line = &E->lines.elements[row];
+        int in_state = row > 0 && E->lines.elements[row - 1].hl_open_comment;
+        if (job.hl[i] == NULL || in_state != job.in_state[i]) {
+            free(job.hl[i]);
+            editor_update_syntax(row);
+            continue;
+        }
+        editor_line_invalidate_render(line);
+        free(line->hl);
+        line->hl = job.hl[i];
+        syntax_finish_line(row, line, job.state[i]);
+    }
+    free(job.hl);
+    free(job.in_state);
+    free(job.state);
+}
+
+void editor_update_syntax_all() {
+    editor_update_syntax_rows(0, get_editor_config()->lines.size);
+}
+
+static long long syntax_chunk_lines(long long total) {
+    long long chunk_lines = total / (parallel_worker_count() * SYNTAX_CHUNKS_PER_WORKER);
+    if (chunk_lines < SYNTAX_MIN_CHUNK_LINES) chunk_lines = SYNTAX_MIN_CHUNK_LINES;
+    return chunk_lines;
+}
+
+static int syntax_chunk_count(long long size, long long chunk_lines) {
+    return (int)((size + chunk_lines - 1) / chunk_lines);
+}
+
+// Sets job up to lex rows [start, end) of E in pieces of chunk_lines rows,
+// taking its chunks from the front of chunks.
+static void syntax_plan(SyntaxJob *job, EditorConfig *E, long long start, long long end,
+                        long long chunk_lines, SyntaxChunk *chunks) {
+    job->syntax = E->syntax;
+    job->lines = E->lines.elements;
+    job->chunks = chunks;
+    job->chunk_count = syntax_chunk_count(end - start, chunk_lines);
+    job->start = start;
+    job->end = end;
+    job->in_state = start > 0 && E->lines.elements[start - 1].hl_open_comment;
+    job->old_end_state = E->lines.elements[end - 1].hl_open_comment;
+    for (int i = 0; i < job->chunk_count; i++) {
+        chunks[i].job = job;
+        chunks[i].start = start + i * chunk_lines;
+        chunks[i].end = (i == job->chunk_count - 1) ? end : chunks[i].start + chunk_lines;
+    }
+}
+
+// The sequential fix-up of a lexed job; job must be for the current buffer.
+static void syntax_finish(SyntaxJob *job) {
+    EditorConfig *E = get_editor_config();
+    long long start = job->start;
+    long long end = job->end;
+    if (start == 0 && end == E->lines.size) E->hl_stale_hint = -1;
+
+    int state = job->in_state;
+    for (int c = 0; c < job->chunk_count; c++) {
+        SyntaxChunk *chunk = &job->chunks[c];
+        if (state && chunk->failed) {
+            // Could not precompute the inside-comment run; redo it in place.
+            for (long long i = 0; i < chunk->alt_count; i++) free(chunk->alt_hl[i]);
+            if (chunk->start > 0) {
+                editor_update_syntax(chunk->start);
+            }
+            state = E->lines.elements[chunk->end - 1].hl_open_comment;
+        } else if (state) {
+            for (long long i = 0; i < chunk->alt_count; i++) {
+                EditorLine *line = &E->lines.elements[chunk->start + i];
+                free(line->hl);
+                line->hl = chunk->alt_hl[i];
+                editor_line_invalidate_render(line);
+                line->hl_open_comment = chunk->alt_open_comment[i];
+            }
+            state = chunk->alt_end_state;
+        } else {
+            for (long long i = 0; i < chunk->alt_count; i++) free(chunk->alt_hl[i]);
+            state = chunk->end_state;
+        }
+        if (chunk->stale && (E->hl_stale_hint == -1 || chunk->start < E->hl_stale_hint)) E->hl_stale_hint = chunk->start;
+        free(chunk->alt_hl);
+        free(chunk->alt_open_comment);
+    }
+    if (end < E->lines.size && state != job->old_end_state) syntax_mark_stale(end);
+
+    for (long long i = E->row_offset; i < end && i < E->row_offset + E->screen_rows; i++) {
+        if (i >= start && E->lines.elements[i].hl) syntax_highlight_matches(i, &E->lines.elements[i]);
+    }
+}
+
+void editor_update_syntax_rows(long long start, long long end) {
+    EditorConfig *E = get_editor_config();
+    long long size = end - start;
+    if (size <= 0) return;
+    if (defer.active) {
+        if (defer.start == defer.end) {
+            defer.start = start;
+            defer.end = end;
+        } else {
+            if (start < defer.start) defer.start = start;
+            if (end > defer.end) defer.end = end;
+        }
+        return;
+    }
+
+    long long chunk_lines = syntax_chunk_lines(size);
+    SyntaxChunk *chunks = calloc(syntax_chunk_count(size, chunk_lines), sizeof(SyntaxChunk));
+    if (chunks == NULL) {
+        for (long long i = start; i < end; i++) editor_update_syntax(i);
+        return;
+    }
+    SyntaxJob job;
+    syntax_plan(&job, E, start, end, chunk_lines, chunks);
+    parallel_run(job.chunk_count, syntax_highlight_chunk, chunks);
+    syntax_finish(&job);
+    free(chunks);
+}
+
+void editor_update_syntax_buffers(EditorConfig **buffers, int count) {
+    EditorConfig *current = get_editor_config();
+    long long total = 0;
+    for (int i = 0; i < count; i++) total += buffers[i]->lines.size;
+    long long chunk_lines = syntax_chunk_lines(total);
+    int chunk_count = 0;
+    for (int i = 0; i < count; i++) chunk_count += syntax_chunk_count(buffers[i]->lines.size, chunk_lines);
+
+    SyntaxJob *jobs = calloc(count, sizeof(SyntaxJob));
+    SyntaxChunk *chunks = calloc(chunk_count, sizeof(SyntaxChunk));
+    if (jobs == NULL || chunks == NULL) {
+        free(jobs);
+        free(chunks);
+        for (int i = 0; i < count; i++) {
+            editor_set_config(buffers[i]);
+            editor_update_syntax_all();
+        }
+        editor_set_config(current);
+        return;
+    }
+
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        if (buffers[i]->lines.size == 0) continue;
+        syntax_plan(&jobs[i], buffers[i], 0, buffers[i]->lines.size, chunk_lines, chunks + next);
+        next += jobs[i].chunk_count;
+    }
+    parallel_run(chunk_count, syntax_highlight_chunk, chunks);
+    for (int i = 0; i < count; i++) {
+        if (buffers[i]->lines.size == 0) continue;
+        editor_set_config(buffers[i]);
+        syntax_finish(&jobs[i]);
     }
+    editor_set_config(current);
+    free(chunks);
+    free(jobs);
 }
 
 int is_separator(int c) {
     return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
+
+static void syntax_worker_free_job(SyntaxWorkerJob *job) {
+    if (job == NULL) return;
+    for (int i = 0; i < job->done; i++) free(job->lines[i].hl);
+    free(job->arena);
+    free(job->lines);
+    free(job);
+}
+
+static void *syntax_worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&worker.lock);
+    while (1) {
+        while (worker.job == NULL) {
+            pthread_cond_wait(&worker.wake, &worker.lock);
+        }
+        SyntaxWorkerJob *job = worker.job;
+        worker.job = NULL;
+        pthread_mutex_unlock(&worker.lock);
+
+        int state = job->in_state;
+        for (int i = 0; i < job->count; i++) {
+            SyntaxWorkerLine *line = &job->lines[i];
+            line->hl = malloc(line->len);
+            if (line->hl == NULL && line->len > 0) break;
+            state = syntax_highlight_text(job->syntax, job->arena + line->offset, line->len, line->hl, state);
+            line->state = state;
+            job->done = i + 1;
+            // Past this line the old highlighting is already right.
+            if (state == line->old_state) break;
+        }
+
+        pthread_mutex_lock(&worker.lock);
+        worker.result = job;
+        editor_wake();
+    }
+    return NULL;
+}
+
+static SyntaxWorkerJob *syntax_worker_snapshot(long long start_row) {
+    EditorConfig *E = get_editor_config();
+    long long remaining = E->lines.size - start_row;
+    int count = remaining > SYNTAX_WORKER_JOB_LINES ? SYNTAX_WORKER_JOB_LINES : (int)remaining;
+
+    SyntaxWorkerJob *job = calloc(1, sizeof(SyntaxWorkerJob));
+    if (job == NULL) return NULL;
+    job->lines = malloc(sizeof(SyntaxWorkerLine) * count);
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) bytes += E->lines.elements[start_row + i].len + 1;
+    job->arena = malloc(bytes);
+    if (job->lines == NULL || job->arena == NULL) {
+        syntax_worker_free_job(job);
+        return NULL;
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        EditorLine *line = &E->lines.elements[start_row + i];
+        editor_line_page_in(line);
+        memcpy(job->arena + offset, line->text, line->len);
+        job->arena[offset + line->len] = '\0';
+        job->lines[i] = (SyntaxWorkerLine){
+            .offset = offset,
+            .len = line->len,
+            .version = line->version,
+            .old_state = line->hl_open_comment,
+        };
+        offset += line->len + 1;
+    }
+    job->buffer = E;
+    job->syntax = E->syntax;
+    job->start_row = start_row;
+    job->in_state = start_row > 0 && E->lines.elements[start_row - 1].hl_open_comment;
+    job->count = count;
+    return job;
+}
+
+static void syntax_worker_apply(SyntaxWorkerJob *job) {
+    EditorConfig *E = get_editor_config();
+    // A job for a buffer that is no longer current is dropped; its lines
+    // stay flagged until that buffer is shown again.
+    if (job->buffer != E || job->start_row >= E->lines.size) return;
+    int in_state = job->start_row > 0 && E->lines.elements[job->start_row - 1].hl_open_comment;
+    if (job->syntax != E->syntax || in_state != job->in_state) {
+        // Lexed against a state that no longer holds; the first line is
+        // still flagged, so a fresh job will pick it up.
+        return;
+    }
+
+    for (int i = 0; i < job->done; i++) {
+        long long row = job->start_row + i;
+        if (row >= E->lines.size) return;
+        EditorLine *line = &E->lines.elements[row];
+        SyntaxWorkerLine *result = &job->lines[i];
+        if (line->version != result->version) {
+            // Edited or shifted since the snapshot. The job's first line
+            // keeps its own flag wherever it moved; past that, restart the
+            // cascade here.
+            if (i > 0) syntax_mark_stale(row);
+            return;
+        }
+
+        free(line->hl);
+        line->hl = result->hl;
+        result->hl = NULL;
+        editor_line_invalidate_render(line);
+        syntax_highlight_matches(row, line);
+        int changed = line->hl_open_comment != result->state;
+        line->hl_open_comment = result->state;
+        line->hl_stale = 0;
+        if (row >= E->row_offset && row < E->row_offset + E->screen_rows) {
+            editor_request_redraw();
+        }
+        if (!changed) return;
+    }
+
+    long long next = job->start_row + job->done;
+    if (next < E->lines.size) syntax_mark_stale(next);
+}
+
+void editor_syntax_worker_start() {
+    if (worker.running) return;
+    if (pthread_create(&worker.thread, NULL, syntax_worker_main, NULL) != 0) return;
+    pthread_detach(worker.thread);
+    worker.running = 1;
+}
+
+// Called from the event loop: installs a finished job, then hands the
+// worker the next run of stale lines, if any.
+void editor_syntax_worker_poll() {
+    if (!worker.running) return;
+    EditorConfig *E = get_editor_config();
+
+    pthread_mutex_lock(&worker.lock);
+    SyntaxWorkerJob *result = worker.result;
+    worker.result = NULL;
+    pthread_mutex_unlock(&worker.lock);
+    if (result) {
+        syntax_worker_apply(result);
+        syntax_worker_free_job(result);
+        worker.busy = 0;
+    }
+    if (worker.busy || E->hl_stale_hint == -1) return;
+    if (E->syntax == NULL) {
+        E->hl_stale_hint = -1;
+        return;
+    }
+
+    long long row = E->hl_stale_hint;
+    while (row < E->lines.size && !E->lines.elements[row].hl_stale) row++;
+    if (row >= E->lines.size) {
+        E->hl_stale_hint = -1;
+        return;
+    }
+    E->hl_stale_hint = row;
+
+    SyntaxWorkerJob *job = syntax_worker_snapshot(row);
+    if (job == NULL) return;
+
+    pthread_mutex_lock(&worker.lock);
+    worker.job = job;
+    worker.busy = 1;
+    pthread_cond_signal(&worker.wake);
+    pthread_mutex_unlock(&worker.lock);
+}
@@ -21,8 +21,22 @@ typedef struct {
     char *multiline_comment_end;
 } EditorSyntax;
 
+struct EditorConfig;
+
 void editor_select_syntax_highlight();
-void editor_update_syntax(int filerow);
+void editor_update_syntax(long long filerow);
+void editor_update_syntax_all();
+void editor_update_syntax_rows(long long start, long long end);
+// Rows in ascending order, each lexed once, in parallel when there are many.
+void editor_update_syntax_list(const long long *rows, long long count);
+// Highlights several whole buffers in one parallel pass.
+void editor_update_syntax_buffers(struct EditorConfig **buffers, int count);
+// While deferred (a macro replay), an edited line just drops its
+// highlighting and is flagged for the worker, and whole-range requests are
+// merged and run once when deferral ends.
+void editor_syntax_defer(int defer);
+void editor_syntax_worker_start();
+void editor_syntax_worker_poll();
 int is_separator(int c);
 
 #endif // SYNTAX_H
@@ -0,0 +1,27 @@
+# --batch over several files, one of which fails only once it is read: the
+# others must still be edited, and the run must exit nonzero at the end.
+import os
+import subprocess
+import tempfile
+
+from editor_session import EDITOR, check, finish
+
+with tempfile.TemporaryDirectory() as tmp:
+    script = os.path.join(tmp, 'script.ed')
+    with open(script, 'w') as f:
+        f.write('insert "X"\n')
+    paths = [os.path.join(tmp, 'f%d.txt' % i) for i in range(6)]
+    for path in paths:
+        with open(path, 'w') as f:
+            f.write('hello\n')
+
+    # Passes the up-front checks, then fails with EIO on the first read.
+    unreadable = '/proc/self/mem'
+    run = subprocess.run([EDITOR, '--batch', script] + paths[:3] + [unreadable] + paths[3:],
+                         capture_output=True, text=True, timeout=20)
+    edited = all(open(path).read() == 'Xhello\n' for path in paths)
+    check('the other files are edited', edited)
+    check('the failure is reported against its file', unreadable + ':' in run.stderr)
+    check('the run exits with status 1', run.returncode == 1)
+
+finish()
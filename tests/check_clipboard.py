@@ -0,0 +1,76 @@
+# Ctrl+Y / Ctrl+V through stand-in helpers set with ERWINTEXT_CLIPBOARD_COPY
+# and ERWINTEXT_CLIPBOARD_PASTE: copying, pasting, cancelling either with
+# its own key, cleaning up pasted text, and a slow paste finishing after a
+# switch to another buffer.
+import os
+import tempfile
+
+from editor_session import CTRL, check, finish, run
+
+DOWN = '\x1b[B'
+RIGHT = '\x1b[C'
+SAVE_QUIT = [CTRL['s'], 0.4, CTRL['q'], 0.3]
+
+with tempfile.TemporaryDirectory() as tmp:
+    path = os.path.join(tmp, 'a.txt')
+    other = os.path.join(tmp, 'b.txt')
+    clip = os.path.join(tmp, 'clip')
+    text = 'line 0\nline 1\nline 2\n'
+
+    def reset(clip_text=None):
+        with open(path, 'w') as f:
+            f.write(text)
+        with open(other, 'w') as f:
+            f.write('other\n')
+        if os.path.exists(clip):
+            os.unlink(clip)
+        if clip_text is not None:
+            with open(clip, 'w') as f:
+                f.write(clip_text)
+
+    def read(name):
+        if not os.path.exists(name):
+            return None
+        with open(name) as f:
+            return f.read()
+
+    env = {'ERWINTEXT_CLIPBOARD_COPY': 'cat > ' + clip, 'ERWINTEXT_CLIPBOARD_PASTE': 'cat ' + clip}
+
+    reset()
+    run([path], [CTRL['a'], 0.1, CTRL['y'], 0.5, CTRL['q'], 0.3], env)
+    check('copy after select all takes the buffer', read(clip) == text)
+
+    reset()
+    run([path], [DOWN, 0.2, CTRL['y'], 0.5, CTRL['q'], 0.3], env)
+    check('copy takes the current line', read(clip) == 'line 1\n')
+
+    reset('XX\nYY')
+    run([path], [RIGHT, 0.2, RIGHT, 0.2, CTRL['v'], 0.5, '!', 0.1] + SAVE_QUIT, env)
+    check('paste goes in at the cursor', read(path) == 'liXX\nYY!ne 0\nline 1\nline 2\n')
+
+    reset()
+    run([path], [CTRL['v'], 0.5] + SAVE_QUIT,
+        {'ERWINTEXT_CLIPBOARD_PASTE': "printf 'a\\r\\nb\\000c\\td\\re'"})
+    check('pasted CR, CRLF and NUL are cleaned up', read(path) == 'a\nbc\td\neline 0\nline 1\nline 2\n')
+
+    reset('XX\nYY')
+    run([path], [CTRL['v'], 0.5, CTRL['z'], 0.2] + SAVE_QUIT, env)
+    check('one undo takes a paste back', read(path) == text)
+
+    reset()
+    _, out = run([path], [CTRL['v'], 0.3, CTRL['v'], 0.5] + SAVE_QUIT,
+                 {'ERWINTEXT_CLIPBOARD_PASTE': 'sleep 10; echo late'})
+    check('Ctrl+V again cancels a paste', read(path) == text and b'Paste cancelled.' in out)
+
+    reset()
+    _, out = run([path], [CTRL['y'], 0.3, CTRL['y'], 0.5, CTRL['q'], 0.3],
+                 {'ERWINTEXT_CLIPBOARD_COPY': 'sleep 10; cat > ' + clip})
+    check('Ctrl+Y again cancels a copy', read(clip) is None and b'Copy cancelled.' in out)
+
+    reset('XX')
+    run([path, other], [CTRL['v'], 0.1, CTRL['n'], 1.0, CTRL['s'], 0.3, CTRL['b'], 0.3] + SAVE_QUIT,
+        {'ERWINTEXT_CLIPBOARD_PASTE': 'sleep 0.5; cat ' + clip})
+    check('a paste stays in the buffer it was asked for in',
+          read(path) == 'XXline 0\nline 1\nline 2\n' and read(other) == 'other\n')
+
+finish()
@@ -0,0 +1,25 @@
+# Ctrl+X filter, save, undo, save: the undone lines must be written out as
+# they were, not copied from the filtered file the first save left behind.
+import os
+import tempfile
+
+from editor_session import CTRL, ENTER, check, finish, run
+
+with tempfile.TemporaryDirectory() as tmp:
+    path = os.path.join(tmp, 'lines.txt')
+    original = ''.join('line %06d\n' % (i * 7 % 20000) for i in range(20000))
+    with open(path, 'w') as f:
+        f.write(original)
+
+    status, _ = run([path], [CTRL['x'], 'sort', ENTER, ENTER, 0.8, CTRL['s'], 0.5,
+                             CTRL['z'], 0.3, CTRL['s'], 0.5, CTRL['q'], 0.3])
+    with open(path) as f:
+        check('filter, save, undo, save restores the file', status == 0 and f.read() == original)
+
+    status, _ = run([path], [CTRL['x'], 'sort -r', ENTER, ENTER, 0.8, CTRL['s'], 0.5,
+                             CTRL['z'], 0.3, CTRL['x'], 'cat', ENTER, ENTER, 0.8,
+                             CTRL['s'], 0.5, CTRL['q'], 0.3])
+    with open(path) as f:
+        check('a filter after undo sees the restored lines', status == 0 and f.read() == original)
+
+finish()
@@ -0,0 +1,20 @@
+# Ctrl+R: a confirmed match must be replaced even when an earlier match on
+# the same row overlaps it.
+import os
+import tempfile
+
+from editor_session import CTRL, ENTER, check, finish, run
+
+RIGHT = '\x1b[C'
+
+with tempfile.TemporaryDirectory() as tmp:
+    path = os.path.join(tmp, 'overlap.txt')
+    with open(path, 'w') as f:
+        f.write('aaa\nzaaa\n')
+
+    status, _ = run([path], [RIGHT, 0.2, CTRL['r'], 0.2, 'aa', 0.2, ENTER, 0.2, 'X', 0.2, ENTER, 0.3,
+                             'y', 0.3, 'q', 0.2, CTRL['s'], 0.4, CTRL['q'], 0.3])
+    with open(path) as f:
+        check('yes replaces a match overlapped by an earlier one', status == 0 and f.read() == 'aX\nzaaa\n')
+
+finish()
@@ -0,0 +1,38 @@
+# Saving through --batch: a file with another hard link is rewritten in
+# place, so both names see the edit, and a file that belongs to someone
+# else keeps its owner (that part needs root to set up).
+import os
+import subprocess
+import tempfile
+
+from editor_session import EDITOR, check, finish
+
+with tempfile.TemporaryDirectory() as tmp:
+    script = os.path.join(tmp, 'script.ed')
+    with open(script, 'w') as f:
+        f.write('insert "X"\n')
+
+    def edit(path):
+        return subprocess.run([EDITOR, '--batch', script, path], capture_output=True, timeout=20).returncode
+
+    path = os.path.join(tmp, 'a.txt')
+    link = os.path.join(tmp, 'b.txt')
+    with open(path, 'w') as f:
+        f.write('hello\n')
+    os.link(path, link)
+    inode = os.stat(path).st_ino
+    status = edit(path)
+    with open(link) as f:
+        check('a hard-linked file is saved in place',
+              status == 0 and f.read() == 'Xhello\n' and os.stat(path).st_ino == inode)
+
+    if os.geteuid() == 0:
+        owned = os.path.join(tmp, 'owned.txt')
+        with open(owned, 'w') as f:
+            f.write('hello\n')
+        os.chown(owned, 1234, 5678)
+        status = edit(owned)
+        st = os.stat(owned)
+        check('a saved file keeps its owner', status == 0 and (st.st_uid, st.st_gid) == (1234, 5678))
+
+finish()
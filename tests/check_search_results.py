@@ -0,0 +1,29 @@
+# Ctrl+P results are read-only: filtering, typing, undo and a paste that
+# lands while they are shown must all leave them alone, or Enter would open
+# the wrong match.
+import os
+import tempfile
+
+from editor_session import CTRL, ENTER, check, finish, run
+
+with tempfile.TemporaryDirectory() as tmp:
+    tree = os.path.join(tmp, 'tree')
+    os.mkdir(tree)
+    with open(os.path.join(tree, 'a.txt'), 'w') as f:
+        f.write('needle one\nhay\nneedle two\nneedle three\n')
+    clip = os.path.join(tmp, 'clip')
+    env = {'ERWINTEXT_CLIPBOARD_COPY': 'cat >> %s; echo ---- >> %s' % (clip, clip),
+           'ERWINTEXT_CLIPBOARD_PASTE': 'sleep 0.5; echo pasted'}
+
+    copy_all = [CTRL['a'], 0.1, CTRL['y'], 0.5]
+    status, out = run([], [CTRL['p'], 0.2, 'needle', ENTER, 0.2, tree, ENTER, 1.0] + copy_all +
+                      [CTRL['v'], 0.1, CTRL['x'], 0.2, 'zz', 0.1, '\t', 0.1, '\x7f', 0.1,
+                       CTRL['z'], 0.1, CTRL['r'], 0.1, 1.0] + copy_all +
+                      [CTRL['q'], 0.3, CTRL['q'], 0.3], env)
+    with open(clip) as f:
+        copies = f.read().split('----\n')
+    check('results copied twice', len(copies) == 3 and copies[0].count('needle') == 3)
+    check('results unchanged by edits', len(copies) == 3 and copies[0] == copies[1])
+    check('edits are refused with a message', b'Search results are read-only' in out)
+
+finish()
@@ -0,0 +1,61 @@
+# Drives erwintext on a pseudo-terminal: the checks in this directory type
+# keys into a real session and then look at the files it leaves behind.
+import os
+import pty
+import select
+import sys
+import time
+
+EDITOR = os.environ.get('ERWINTEXT', os.path.join(os.path.dirname(__file__), '..', 'erwintext'))
+
+CTRL = {c: chr(ord(c) - ord('a') + 1) for c in 'abcdefghijklmnopqrstuvwxyz'}
+ESC = '\x1b'
+ENTER = '\r'
+
+
+def run(args, keys, env=None, timeout=20):
+    """Runs the editor on args, typing keys (strings) and pausing for the
+    given seconds (numbers). Returns the exit status and the screen output."""
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.execve(EDITOR, [EDITOR] + args,
+                  dict(os.environ, TERM='xterm', LINES='24', COLUMNS='80', **(env or {})))
+    out = bytearray()
+
+    def pump(seconds):
+        end = time.time() + seconds
+        while time.time() < end:
+            if select.select([fd], [], [], 0.01)[0]:
+                try:
+                    out.extend(os.read(fd, 65536))
+                except OSError:
+                    return
+
+    for key in [0.8] + keys:
+        if isinstance(key, (int, float)):
+            pump(key)
+        else:
+            os.write(fd, key.encode())
+            pump(0.1)
+    end = time.time() + timeout
+    while time.time() < end:
+        done, status = os.waitpid(pid, os.WNOHANG)
+        if done:
+            return status, bytes(out)
+        pump(0.05)
+    os.kill(pid, 9)
+    os.waitpid(pid, 0)
+    return None, bytes(out)
+
+
+def check(name, ok):
+    print('%s: %s' % ('ok' if ok else 'FAIL', name))
+    if not ok:
+        check.failed = True
+
+
+check.failed = False
+
+
+def finish():
+    sys.exit(1 if check.failed else 0)
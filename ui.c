@@ -1,81 +1,118 @@
 #include "editor.h"
 #include "ui.h"
+#include "buffer.h"
 
 #include <ncurses.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 #include "error_handler.h"
+#include "event_loop.h"
+#include "input.h"
 #include "ui_constants.h"
+#include "vt100.h"
+#include "swap.h"
+#include "macro.h"
+#include "cursors.h"
+
+// Per thread, like the current buffer: messages set by batch workers never
+// reach the screen, and they do not race with each other.
+_Thread_local char status_message[STATUS_MESSAGE_MAX_LEN];
+_Thread_local time_t status_message_time;
+
+// Expands tabs and bakes highlight colors into the line's cached cells, so
+// redrawing a line that has not changed costs a single mvaddchnstr.
+static chtype *editor_render_line(EditorLine *line, int colored) {
+    if (line->render_valid && line->render_colored == colored) return line->render;
+
+    long long width = 0;
+    for (size_t i = 0; i < line->len; i++) {
+        width += (line->text[i] == '\t') ? TAB_STOP - (width % TAB_STOP) : 1;
+    }
 
-#include "ui_constants.h"
+    chtype *render = realloc(line->render, sizeof(chtype) * (width + 1));
+    if (render == NULL) {
+        editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to allocate render buffer for line.");
+        return NULL;
+    }
 
-char status_message[STATUS_MESSAGE_MAX_LEN];
-time_t status_message_time;
+    long long display_col = 0;
+    for (size_t i = 0; i < line->len; i++) {
+        chtype attr = (colored && line->hl) ? COLOR_PAIR(line->hl[i]) : 0;
+        unsigned char c = line->text[i];
+        if (c == '\t') {
+            int char_display_width = TAB_STOP - (display_col % TAB_STOP);
+            for (int k = 0; k < char_display_width; k++) {
+                render[display_col++] = ' ' | attr;
+            }
+        } else {
+            // Cells are copied to the screen as-is, so control and non-ASCII
+            // bytes are shown as '?' rather than sent to the terminal.
+            render[display_col++] = ((c >= 32 && c < 127) ? c : '?') | attr;
+        }
+    }
+
+    line->render = render;
+    line->render_len = width;
+    line->render_valid = 1;
+    line->render_colored = colored;
+    return render;
+}
 
 void editor_draw_rows() {
     EditorConfig *E = get_editor_config();
+    int colored = E->syntax && has_colors();
     int y;
     for (y = 0; y < E->screen_rows; y++) {
-        int filerow = y + E->row_offset;
+        long long filerow = y + E->row_offset;
+        int drawn = 0;
 
-        if (filerow >= E->lines.size) {
-        } else {
+        if (filerow < E->lines.size) {
             EditorLine *line = &E->lines.elements[filerow];
-            int current_color_pair = HL_NORMAL;
-            int display_col = 0;
-
-            for (size_t i = 0; i < line->len; i++) {
-                int char_display_width = 1;
-                if (line->text[i] == '	') {
-                    char_display_width = TAB_STOP - (display_col % TAB_STOP);
-                }
-
-                if (display_col < E->col_offset) {
-                    display_col += char_display_width;
-                    continue;
-                }
-
-                if ((display_col - E->col_offset) >= E->screen_cols) break;
-
-                if (E_syntax && has_colors()) {
-                    int hl_type = line->hl[i];
-                    if (hl_type != current_color_pair) {
-                        attroff(COLOR_PAIR(current_color_pair));
-                        current_color_pair = hl_type;
-                        attron(COLOR_PAIR(current_color_pair));
-                    }
-                }
-
-                if (line->text[i] == '	') {
-                    for (int k = 0; k < char_display_width; k++) {
-                        mvaddch(y, (display_col - E->col_offset) + k, ' ');
-                    }
-                } else {
-                    mvaddch(y, (display_col - E->col_offset), line->text[i]);
-                }
-                display_col += char_display_width;
-            }
-            if (E_syntax && has_colors()) {
-                attroff(COLOR_PAIR(current_color_pair));
+            editor_line_page_in(line);
+            // Lines that were swapped out come back without highlighting.
+            if (line->hl == NULL) editor_update_syntax(filerow);
+            chtype *render = editor_render_line(line, colored);
+            if (render && line->render_len > E->col_offset) {
+                long long visible = line->render_len - E->col_offset;
+                drawn = visible > E->screen_cols ? E->screen_cols : (int)visible;
+                mvaddchnstr(y, 0, render + E->col_offset, drawn);
             }
         }
-        clrtoeol();
+        if (drawn < E->screen_cols) {
+            move(y, drawn);
+            clrtoeol();
+        }
     }
 }
 
-void editor_draw_status_bar() {
+void editor_status_bar_text(char *lstatus, size_t lsize, char *rstatus, size_t rsize) {
     EditorConfig *E = get_editor_config();
-    attron(A_REVERSE);
-
-    mvprintw(E->screen_rows, 0, "%.20s - %d lines %s",
+    char cursors[32] = "";
+    if (E->cursor_count > 0) snprintf(cursors, sizeof(cursors), " [%lld cursors]", E->cursor_count);
+    snprintf(lstatus, lsize, "%.20s - %lld lines %s%s%s",
              E->filename ? E->filename : "[No Name]", E->lines.size,
-             E->dirty ? "(modified)" : "");
+             E->dirty ? "(modified)" : "",
+             editor_macro_recording() ? " [recording]" : "", cursors);
+    if (editor_buffer_count() > 1) {
+        snprintf(rstatus, rsize, "[%d/%d] %lld/%lld", editor_buffer_index() + 1, editor_buffer_count(), E->cy + 1, E->lines.size);
+    } else {
+        snprintf(rstatus, rsize, "%lld/%lld", E->cy + 1, E->lines.size);
+    }
+}
 
+void editor_draw_status_bar() {
+    EditorConfig *E = get_editor_config();
+    char lstatus[80];
     char rstatus[80];
-    snprintf(rstatus, sizeof(rstatus), "%d/%d", E->cy + 1, E->lines.size);
-    mvprintw(E->screen_rows, E->screen_cols - strlen(rstatus), "%s", rstatus);
+    editor_status_bar_text(lstatus, sizeof(lstatus), rstatus, sizeof(rstatus));
 
+    attron(A_REVERSE);
+    mvprintw(E->screen_rows, 0, "%s", lstatus);
+    mvprintw(E->screen_rows, E->screen_cols - strlen(rstatus), "%s", rstatus);
     attroff(A_REVERSE);
 }
 
@@ -87,27 +124,38 @@ void editor_set_status_message(const char *fmt, ...) {
     status_message_time = time(NULL);
 }
 
+// Returns the status message, or "" once it has timed out.
+const char *editor_message_bar_text() {
+    if (time(NULL) - status_message_time < STATUS_MESSAGE_TIMEOUT_SECONDS) {
+        return status_message;
+    }
+    return "";
+}
+
 void editor_draw_message_bar() {
     EditorConfig *E = get_editor_config();
     move(E->screen_rows + 1, 0);
     clrtoeol();
 
-    int msglen = strlen(status_message);
+    const char *msg = editor_message_bar_text();
+    int msglen = strlen(msg);
     if (msglen > E->screen_cols) msglen = E->screen_cols;
-    if (time(NULL) - status_message_time < STATUS_MESSAGE_TIMEOUT_SECONDS) {
-        mvprintw(E->screen_rows + 1, 0, "%.*s", msglen, status_message);
-    }
+    mvprintw(E->screen_rows + 1, 0, "%.*s", msglen, msg);
 }
 
-void editor_draw_clock() {
-    EditorConfig *E = get_editor_config();
+void editor_clock_text(char *buf, size_t size) {
     time_t rawtime;
     struct tm *info;
-    char time_str[6];
 
     time(&rawtime);
     info = localtime(&rawtime);
-    strftime(time_str, sizeof(time_str), "%H:%M", info);
+    strftime(buf, size, "%H:%M", info);
+}
+
+void editor_draw_clock() {
+    EditorConfig *E = get_editor_config();
+    char time_str[6];
+    editor_clock_text(time_str, sizeof(time_str));
 
     int clock_len = strlen(time_str);
     if (E->screen_cols >= clock_len) {
@@ -124,12 +172,12 @@ void editor_scroll() {
         E->row_offset = E->cy - E->screen_rows + 1;
     }
 
-    int current_line_len = (E->cy < E->lines.size) ? E->lines.elements[E->cy].len : 0;
+    long long current_line_len = (E->cy < E->lines.size) ? (long long)E->lines.elements[E->cy].len : 0;
     if (E->cx > current_line_len) {
         E->cx = current_line_len;
     }
 
-    int current_cx_display = get_cx_display();
+    long long current_cx_display = get_cx_display();
 
     if (current_cx_display < E->col_offset) {
         E->col_offset = current_cx_display;
@@ -139,28 +187,44 @@ void editor_scroll() {
     }
 }
 
+// Extra cursors show as reversed cells, keeping the text's color.
+static void editor_draw_extra_cursor(int y, int x) {
+    mvchgat(y, x, 1, A_REVERSE, PAIR_NUMBER(mvinch(y, x) & A_COLOR), NULL);
+}
+
 void editor_refresh_screen() {
+    // A macro replay shows only its result.
+    if (editor_macro_replaying()) return;
     EditorConfig *E = get_editor_config();
     editor_scroll();
 
-    clear();
+    if (vt100_backend_active) {
+        vt100_refresh_screen((int)(E->cy - E->row_offset), (int)(get_cx_display() - E->col_offset));
+        return;
+    }
+
+    // erase() rather than clear(): clear() makes ncurses repaint the whole
+    // terminal on every frame instead of only the cells that changed.
+    erase();
 
     editor_draw_rows();
+    editor_cursors_visible(editor_draw_extra_cursor);
     editor_draw_status_bar();
     editor_draw_message_bar();
     editor_draw_clock();
 
-    move(E->cy - E->row_offset, get_cx_display() - E->col_offset);
+    move((int)(E->cy - E->row_offset), (int)(get_cx_display() - E->col_offset));
     refresh();
 }
 
-int get_cx_display() {
+long long get_cx_display() {
     EditorConfig *E = get_editor_config();
-    int display_cx = 0;
+    long long display_cx = 0;
     if (E->cy >= E->lines.size) return 0;
 
     EditorLine *line = &E->lines.elements[E->cy];
-    for (int i = 0; i < E->cx; i++) {
+    editor_line_page_in(line);
+    for (long long i = 0; i < E->cx; i++) {
         if ((size_t)i >= line->len) break;
         if (line->text[i] == '	') {
             display_cx += (TAB_STOP - (display_cx % TAB_STOP));
@@ -171,7 +235,7 @@ int get_cx_display() {
     return display_cx;
 }
 
-char *editor_prompt(const char *prompt_fmt, ...) {
+static char *editor_prompt_run(const char *prompt_fmt, EditorPromptCallback callback, int allow_empty) {
     char buffer[128];
     int buflen = 0;
     buffer[0] = '\0';
@@ -179,10 +243,11 @@ char *editor_prompt(const char *prompt_fmt, ...) {
     while (1) {
         editor_set_status_message(prompt_fmt, buffer);
         editor_refresh_screen();
+        if (callback && !editor_input_pending() && !editor_macro_replaying()) callback(buffer, 0);
 
-        int c = getch();
+        int c = editor_read_key();
         if (c == '\r' || c == '\n') {
-            if (buflen > 0) {
+            if (buflen > 0 || allow_empty) {
                 return strdup(buffer);
             }
             editor_set_status_message("");
@@ -201,15 +266,36 @@ char *editor_prompt(const char *prompt_fmt, ...) {
                 buffer[buflen] = '\0';
             }
         }
+        if (callback) callback(buffer, c);
     }
 }
 
-void handle_winch(int sig) {
+char *editor_prompt(const char *prompt_fmt, ...) {
+    return editor_prompt_run(prompt_fmt, NULL, 0);
+}
+
+char *editor_prompt_with_callback(const char *prompt_fmt, EditorPromptCallback callback) {
+    return editor_prompt_run(prompt_fmt, callback, 0);
+}
+
+char *editor_prompt_allow_empty(const char *prompt_fmt) {
+    return editor_prompt_run(prompt_fmt, NULL, 1);
+}
+
+// Called from the event loop after SIGWINCH; stdin belongs to the input
+// thread, so ncurses never gets the chance to notice the resize itself.
+void editor_handle_resize() {
     EditorConfig *E = get_editor_config();
-    (void)sig;
-    endwin();
-    refresh();
-    getmaxyx(stdscr, E->screen_rows, E->screen_cols);
+    if (vt100_backend_active) {
+        vt100_get_window_size(&E->screen_rows, &E->screen_cols);
+        vt100_resize(E->screen_rows, E->screen_cols);
+    } else {
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+            resizeterm(ws.ws_row, ws.ws_col);
+        }
+        getmaxyx(stdscr, E->screen_rows, E->screen_cols);
+    }
     E->screen_rows -= 2;
-    editor_refresh_screen();
+    editor_request_redraw();
 }
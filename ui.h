@@ -1,17 +1,30 @@
 #ifndef UI_H
 #define UI_H
 
+#include <stddef.h>
+
 void editor_draw_rows();
 void editor_refresh_screen();
 void editor_draw_status_bar();
+void editor_status_bar_text(char *lstatus, size_t lsize, char *rstatus, size_t rsize);
 void editor_set_status_message(const char *fmt, ...);
 void editor_draw_message_bar();
+const char *editor_message_bar_text();
 void editor_draw_clock();
+void editor_clock_text(char *buf, size_t size);
 void editor_scroll();
-int get_cx_display();
+long long get_cx_display();
 char *editor_prompt(const char *prompt_fmt, ...);
+// The callback sees the prompt contents after every key, and is called with
+// key 0 whenever the prompt is idle; idle work should return as soon as
+// editor_input_pending() reports a key.
+typedef void (*EditorPromptCallback)(const char *buffer, int key);
+char *editor_prompt_with_callback(const char *prompt_fmt, EditorPromptCallback callback);
+// Like editor_prompt, but Enter on an empty prompt returns "" rather than NULL.
+char *editor_prompt_allow_empty(const char *prompt_fmt);
+void editor_handle_resize();
 #include <time.h>
 
-extern time_t status_message_time;
+extern _Thread_local time_t status_message_time;
 
 #endif // UI_H
@@ -0,0 +1,301 @@
+#include "vt100.h"
+#include "editor.h"
+#include "syntax.h"
+#include "ui.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "error_handler.h"
+#include "ui_constants.h"
+#include "swap.h"
+#include "cursors.h"
+
+#define VT100_ATTR_REVERSE 0x10
+#define VT100_ATTR_UNKNOWN 0xff
+// Worst case per cell is a full SGR sequence followed by the character.
+#define VT100_CELL_BYTES 20
+#define VT100_ROW_BYTES 16
+#define VT100_FRAME_BYTES 64
+// Unchanged cells shorter than this are rewritten rather than jumped over,
+// since a cursor move costs about as many bytes.
+#define VT100_MAX_GAP 8
+
+typedef struct {
+    unsigned char ch;
+    unsigned char attr;
+} Vt100Cell;
+
+int vt100_backend_active = 0;
+
+static struct termios orig_termios;
+static int term_rows;
+static int term_cols;
+static Vt100Cell *front; // what the terminal is showing
+static Vt100Cell *back;  // the frame being composed
+static char *out;
+static size_t out_len;
+static int need_clear;
+static int pen = VT100_ATTR_UNKNOWN; // attribute the terminal draws with
+
+// Matches the pairs init_editor sets up for the ncurses backend; pair 0
+// keeps the terminal's default colors.
+static const char *vt100_colors[] = {
+    [HL_NORMAL] = "",
+    [HL_COMMENT] = ";36;40",
+    [HL_KEYWORD1] = ";33;40",
+    [HL_KEYWORD2] = ";32;40",
+    [HL_STRING] = ";35;40",
+    [HL_NUMBER] = ";31;40",
+    [HL_MATCH] = ";30;43",
+    [HL_PREPROC] = ";34;40",
+};
+
+static void vt100_write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void vt100_append(const char *s, size_t len) {
+    memcpy(out + out_len, s, len);
+    out_len += len;
+}
+
+static void vt100_append_move(int row, int col) {
+    out_len += sprintf(out + out_len, "\x1b[%d;%dH", row + 1, col + 1);
+}
+
+static void vt100_append_pen(unsigned char attr) {
+    if (attr == pen) return;
+    int hl = attr & 0x0f;
+    out_len += sprintf(out + out_len, "\x1b[0%s%sm",
+                       (attr & VT100_ATTR_REVERSE) ? ";7" : "",
+                       hl < (int)(sizeof(vt100_colors) / sizeof(vt100_colors[0])) ? vt100_colors[hl] : "");
+    pen = attr;
+}
+
+static void vt100_put_text(int y, int x, const char *s, unsigned char attr) {
+    if (y < 0 || y >= term_rows) return;
+    Vt100Cell *row = &back[y * term_cols];
+    for (; *s && x < term_cols; s++, x++) {
+        if (x < 0) continue;
+        row[x].ch = *s;
+        row[x].attr = attr;
+    }
+}
+
+// Raw bytes go straight to the terminal, so anything that is not printable
+// ASCII is shown as '?' instead of being interpreted.
+static unsigned char vt100_printable(char c) {
+    unsigned char uc = (unsigned char)c;
+    return (uc >= 32 && uc < 127) ? uc : '?';
+}
+
+static void vt100_compose_rows(EditorConfig *E) {
+    int colored = E->syntax != NULL;
+    for (int y = 0; y < E->screen_rows && y < term_rows; y++) {
+        long long filerow = y + E->row_offset;
+        if (filerow >= E->lines.size) continue;
+
+        Vt100Cell *row = &back[y * term_cols];
+        EditorLine *line = &E->lines.elements[filerow];
+        editor_line_page_in(line);
+        if (line->hl == NULL) editor_update_syntax(filerow);
+        long long display_col = 0;
+
+        for (size_t i = 0; i < line->len; i++) {
+            int char_display_width = 1;
+            if (line->text[i] == '\t') {
+                char_display_width = TAB_STOP - (display_col % TAB_STOP);
+            }
+
+            if (display_col < E->col_offset) {
+                display_col += char_display_width;
+                continue;
+            }
+
+            if (display_col - E->col_offset >= term_cols) break;
+            int x = (int)(display_col - E->col_offset);
+
+            unsigned char attr = (colored && line->hl) ? (unsigned char)line->hl[i] : HL_NORMAL;
+            if (line->text[i] == '\t') {
+                for (int k = 0; k < char_display_width && x + k < term_cols; k++) {
+                    row[x + k].ch = ' ';
+                    row[x + k].attr = attr;
+                }
+            } else {
+                row[x].ch = vt100_printable(line->text[i]);
+                row[x].attr = attr;
+            }
+            display_col += char_display_width;
+        }
+    }
+}
+
+static void vt100_mark_cursor(int y, int x) {
+    if (y < term_rows && x < term_cols) back[y * term_cols + x].attr |= VT100_ATTR_REVERSE;
+}
+
+static void vt100_compose(EditorConfig *E) {
+    for (int i = 0; i < term_rows * term_cols; i++) {
+        back[i].ch = ' ';
+        back[i].attr = HL_NORMAL;
+    }
+
+    vt100_compose_rows(E);
+    editor_cursors_visible(vt100_mark_cursor);
+
+    char lstatus[80];
+    char rstatus[80];
+    editor_status_bar_text(lstatus, sizeof(lstatus), rstatus, sizeof(rstatus));
+    vt100_put_text(E->screen_rows, 0, lstatus, VT100_ATTR_REVERSE);
+    vt100_put_text(E->screen_rows, E->screen_cols - (int)strlen(rstatus), rstatus, VT100_ATTR_REVERSE);
+
+    vt100_put_text(E->screen_rows + 1, 0, editor_message_bar_text(), HL_NORMAL);
+
+    char clock[6];
+    editor_clock_text(clock, sizeof(clock));
+    int clock_len = strlen(clock);
+    if (E->screen_cols >= clock_len) {
+        vt100_put_text(0, E->screen_cols - clock_len, clock, HL_NORMAL);
+    }
+}
+
+static int vt100_same(const Vt100Cell *a, const Vt100Cell *b) {
+    return a->ch == b->ch && a->attr == b->attr;
+}
+
+static void vt100_emit_row_changes(int y) {
+    Vt100Cell *f = &front[y * term_cols];
+    Vt100Cell *b = &back[y * term_cols];
+    int x = 0;
+
+    while (x < term_cols) {
+        if (vt100_same(&f[x], &b[x])) {
+            x++;
+            continue;
+        }
+
+        int last_diff = x;
+        for (int j = x + 1; j < term_cols && j - last_diff <= VT100_MAX_GAP; j++) {
+            if (!vt100_same(&f[j], &b[j])) last_diff = j;
+        }
+
+        vt100_append_move(y, x);
+        for (int j = x; j <= last_diff; j++) {
+            vt100_append_pen(b[j].attr);
+            out[out_len++] = b[j].ch;
+        }
+        memcpy(&f[x], &b[x], (last_diff - x + 1) * sizeof(Vt100Cell));
+        x = last_diff + 1;
+    }
+}
+
+void vt100_refresh_screen(int cursor_row, int cursor_col) {
+    EditorConfig *E = get_editor_config();
+    if (!vt100_backend_active) return;
+
+    vt100_compose(E);
+
+    out_len = 0;
+    vt100_append("\x1b[?25l", 6);
+    if (need_clear) {
+        vt100_append("\x1b[0m\x1b[2J", 8);
+        pen = HL_NORMAL;
+        for (int i = 0; i < term_rows * term_cols; i++) {
+            front[i].ch = ' ';
+            front[i].attr = HL_NORMAL;
+        }
+        need_clear = 0;
+    }
+
+    for (int y = 0; y < term_rows; y++) {
+        vt100_emit_row_changes(y);
+    }
+
+    vt100_append_move(cursor_row, cursor_col);
+    vt100_append("\x1b[?25h", 6);
+    vt100_write_all(out, out_len);
+}
+
+void vt100_get_window_size(int *rows, int *cols) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        *rows = ws.ws_row;
+        *cols = ws.ws_col;
+    } else {
+        *rows = 24;
+        *cols = 80;
+    }
+}
+
+// The output buffer is sized for the worst case frame, so composing a frame
+// never allocates.
+void vt100_resize(int rows, int cols) {
+    size_t cells = (size_t)rows * cols;
+    Vt100Cell *new_front = realloc(front, cells * sizeof(Vt100Cell));
+    if (!new_front) editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to allocate screen buffer");
+    front = new_front;
+    Vt100Cell *new_back = realloc(back, cells * sizeof(Vt100Cell));
+    if (!new_back) editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to allocate screen buffer");
+    back = new_back;
+    char *new_out = realloc(out, cells * VT100_CELL_BYTES + (size_t)rows * VT100_ROW_BYTES + VT100_FRAME_BYTES);
+    if (!new_out) editor_handle_error(ERR_OUT_OF_MEMORY, "Failed to allocate output buffer");
+    out = new_out;
+
+    term_rows = rows;
+    term_cols = cols;
+    need_clear = 1;
+}
+
+int vt100_init() {
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) return -1;
+    if (tcgetattr(STDIN_FILENO, &orig_termios) == -1) return -1;
+
+    struct termios raw = orig_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~(OPOST);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) return -1;
+
+    // Alternate screen, no autowrap (so the bottom-right cell never scrolls),
+    // and button plus SGR mouse reports for the input thread to decode.
+    static const char enter[] = "\x1b[?1049h\x1b[?7l\x1b[?1000h\x1b[?1006h";
+    vt100_write_all(enter, sizeof(enter) - 1);
+
+    int rows, cols;
+    vt100_get_window_size(&rows, &cols);
+    vt100_resize(rows, cols);
+    vt100_backend_active = 1;
+    return 0;
+}
+
+void vt100_shutdown() {
+    if (!vt100_backend_active) return;
+    vt100_backend_active = 0;
+
+    static const char leave[] = "\x1b[0m\x1b[?1006l\x1b[?1000l\x1b[?7h\x1b[?25h\x1b[?1049l";
+    vt100_write_all(leave, sizeof(leave) - 1);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+
+    free(front);
+    free(back);
+    free(out);
+    front = NULL;
+    back = NULL;
+    out = NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef VT100_H
+#define VT100_H
+
+// Optional output backend that bypasses ncurses: each frame is diffed
+// against the previous one and emitted with a single write(). Enabled with
+// ERWINTEXT_BACKEND=vt100.
+
+extern int vt100_backend_active;
+
+int vt100_init();
+void vt100_shutdown();
+void vt100_get_window_size(int *rows, int *cols);
+void vt100_resize(int rows, int cols);
+void vt100_refresh_screen(int cursor_row, int cursor_col);
+
+#endif // VT100_H